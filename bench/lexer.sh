@@ -0,0 +1,25 @@
+#!/bin/sh
+# Lexer throughput benchmark: tokenizes a large generated script heavy in
+# whitespace, comments and string literals (like machine-generated sources)
+# with each bulk scanner the CPU supports, and reports MB/s.
+#
+# Usage: bench/lexer.sh [lines]    (build src/v9 first)
+
+V9=${V9:-$(dirname "$0")/../src/v9}
+LINES=${1:-100000}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+SCRIPT=$WORK/lexer.js
+awk -v lines="$LINES" 'BEGIN {
+  for (i = 0; i < lines; i++) {
+    printf "        var v%d = \"string literal number %d with an \\\"escaped\\\" quote\";\n", i, i
+    printf "        // Generated comment for v%d, long enough to span a few vectors\n\n", i
+    printf "        v%d = v%d + '\''more text in single quotes'\'' + %d;\n", i, i, i
+  }
+}' > "$SCRIPT"
+
+echo "script: $LINES blocks, $(wc -c < "$SCRIPT") bytes"
+for scanner in scalar sse2 avx2; do
+  V9_SIMD=$scanner "$V9" --lex-bench "$SCRIPT" || exit 1
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Server benchmark: runs a small rule script with an input binding through
+# `v9 --serve`, by path and as inline source, and compares it with starting
+# a new v9 process per run.  Reports requests per second and latencies.
+#
+# Usage: bench/serve.sh [requests] [connections]    (build src/v9 and
+#        src/v9-load first: cd src && make v9 v9-load)
+
+SRC=$(dirname "$0")/../src
+V9=${V9:-$SRC/v9}
+V9_LOAD=${V9_LOAD:-$SRC/v9-load}
+REQUESTS=${1:-20000}
+CONNECTIONS=${2:-4}
+WORK=$(mktemp -d)
+SOCKET=$WORK/v9.sock
+
+"$V9" --serve="$SOCKET" &
+SERVER=$!
+trap 'kill -INT $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+SCRIPT=$WORK/rule.js
+cat > "$SCRIPT" <<'EOF'
+var order;
+var limit = 100;
+var total = order.price * order.qty;
+if (total > limit) { ; console.log("review ", total); }
+else { ; console.log("accept ", total); }
+EOF
+INPUT='order={"price": 30, "qty": 5}'
+
+# Wait for the server to create its socket.
+tries=0
+while [ ! -S "$SOCKET" ] && [ $tries -lt 50 ]; do
+  sleep 0.1
+  tries=$((tries + 1))
+done
+
+echo "by path, 1 connection:"
+"$V9_LOAD" --socket="$SOCKET" --requests="$REQUESTS" --bind="$INPUT" "$SCRIPT" || exit 1
+echo "by path, $CONNECTIONS connections:"
+"$V9_LOAD" --socket="$SOCKET" --requests="$REQUESTS" --connections="$CONNECTIONS" --bind="$INPUT" "$SCRIPT" || exit 1
+echo "inline source, 1 connection:"
+"$V9_LOAD" --socket="$SOCKET" --requests="$REQUESTS" --inline --bind="$INPUT" "$SCRIPT" || exit 1
+
+# The same rule as a standalone script, one process per run.
+sed "s/^var order;/var order = { price: 30, qty: 5 };/" "$SCRIPT" > "$WORK/standalone.js"
+RUNS=200
+start=$(date +%s%N)
+run=0
+while [ $run -lt $RUNS ]; do
+  "$V9" "$WORK/standalone.js" > /dev/null || exit 1
+  run=$((run + 1))
+done
+echo "one process per run: $(( ($(date +%s%N) - start) / RUNS / 1000 )) us/run"
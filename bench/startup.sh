@@ -0,0 +1,41 @@
+#!/bin/sh
+# Startup benchmark for the code cache: times cold runs (cache cleared before
+# each run, so every run lexes, parses and writes the cache) against warm runs
+# (cache loaded, no lexing or parsing).
+#
+# Usage: bench/startup.sh [statements] [runs]    (build src/v9 first)
+
+V9=${V9:-$(dirname "$0")/../src/v9}
+STATEMENTS=${1:-20000}
+RUNS=${2:-10}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# A large script whose run time is negligible next to its parse time.
+SCRIPT=$WORK/startup.js
+i=0
+echo "var total = 0;" > "$SCRIPT"
+while [ $i -lt "$STATEMENTS" ]; do
+  echo "var v$i = { a: $i, b: 'str$i' }; total = total + v$i.a * 2 - $i;" >> "$SCRIPT"
+  i=$((i + 1))
+done
+echo "console.log(total);" >> "$SCRIPT"
+
+now_ms() { date +%s%N | cut -b1-13; }
+
+time_runs() {
+  # $1 = "cold" or "warm"
+  start=$(now_ms)
+  run=0
+  while [ $run -lt "$RUNS" ]; do
+    if [ "$1" = cold ]; then rm -rf "$WORK/cache"; fi
+    "$V9" --code-cache="$WORK/cache" "$SCRIPT" > /dev/null || exit 1
+    run=$((run + 1))
+  done
+  echo $(( ($(now_ms) - start) / RUNS ))
+}
+
+echo "script: $STATEMENTS statements, $(wc -c < "$SCRIPT") bytes, $RUNS runs each"
+echo "cold (lex + parse + save): $(time_runs cold) ms/run"
+"$V9" --code-cache="$WORK/cache" "$SCRIPT" > /dev/null
+echo "warm (load from cache):    $(time_runs warm) ms/run"
@@ -1,28 +1,88 @@
 #include "ast.h"
+#include "budget.h"
+#include "event_loop.h"
+#include "file_reader.h"
+#include "json.h"
+#include "operators.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "worker.h"
 #include "v9-parser.tab.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+
 extern void yyerror(std::string err_string);
 extern void yyerror2(std::string err_string, int orig_line);
+extern void AbortScript();
+
+static void CopyValue(tableEntry * left, tableEntry * right);
+
+astArena ast_arena;
+atomTable atom_table;
+std::mutex print_lock;  // Held while a line of output is written, so workers' lines stay whole
+thread_local char * astArena::chunk_next = NULL;
+thread_local char * astArena::chunk_end = NULL;
+thread_local bool in_parallel_task = false;
 
 // ASTNode
 
+void ASTNode::AddChild(ASTNode * in_child)
+{
+  // Grow the child array by doubling; the old array stays in the arena.
+  if (num_children == child_capacity) {
+    uint32_t new_capacity = child_capacity ? child_capacity * 2 : 4;
+    uint32_t * new_refs = (uint32_t *) ast_arena.Allocate(new_capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_children; i++) new_refs[i] = GetChildRefs()[i];
+    child_refs = ast_arena.ToRef(new_refs);
+    child_capacity = new_capacity;
+  }
+  GetChildRefs()[num_children++] = ast_arena.ToRef(in_child);
+}
+
 void ASTNode::TransferChildren(ASTNode * from_node)
 {
   // Move all of the children out of the from_node
   for (int i = 0; i < from_node->GetNumChildren(); i++) {
     AddChild(from_node->GetChild(i));
   }
+  from_node->num_children = 0;
+}
+
+void ASTNode::AssignResultSlots(symbolTable & table)
+{
+  if (MakesResult() && result_slot < 0) result_slot = table.AddResultSlot();
 
-  // Clear the children in from_node so they are not recursively deleted when it is.
-  from_node->children.resize(0);
+  // An object literal's keys are never run, only its values.
+  int step = (dynamic_cast<ASTNode_Literal *>(this) && type == Type::OBJECT) ? 2 : 1;
+  for (int i = step - 1; i < GetNumChildren(); i += step) {
+    if (GetChild(i)) GetChild(i)->AssignResultSlots(table);
+  }
 }
 
 //  ASTNode_Block
 
+// Poll the execution budget; once it runs out, unwind the whole program.
+static inline bool OutOfBudget(symbolTable & table)
+{
+  if (!Budget::Poll()) return false;
+  table.SetCompletion(symbolTable::HALT);
+  return true;
+}
+
 tableEntry * ASTNode_Block::Interpret(symbolTable & table)
 {
+  if (OutOfBudget(table)) return NULL;
+
   for (int i = 0; i < GetNumChildren(); i++) {
+    HeapProfile::SetLine(GetChild(i)->GetLineNum());
     tableEntry * current = GetChild(i)->Interpret(table);
+
+    // Stop early when break, continue or return unwinds the block.
+    if (table.GetCompletion() != symbolTable::NORMAL) break;
   }
 
   return NULL;
@@ -32,36 +92,46 @@ tableEntry * ASTNode_Block::Interpret(symbolTable & table)
 
 tableEntry * ASTNode_Variable::Interpret(symbolTable & table)
 {
-  if(var_entry->GetType() == Type::REFERENCE) {
-    ASTNode * var = new ASTNode_Variable(var_entry->GetReference());
-    return var->Interpret(table);
-  }
-  else {
-    return var_entry;
-  }
+  tableEntry * entry = var_entry;
+  while (entry->GetType() == Type::REFERENCE) entry = entry->GetReference();
+  return entry;
 }
 
 // ASTNode_Literal
 
 ASTNode_Literal::ASTNode_Literal(int in_type)
-  : ASTNode(in_type)
+  : ASTNode(in_type), result(NULL), key_atom(atomTable::NONE), boilerplate(NULL)
+  , boilerplate_built(false)
 {
 }
 
 ASTNode_Literal::ASTNode_Literal(int in_type, std::string in_lex)
-  : ASTNode(in_type), lexeme(in_lex)
+  : ASTNode(in_type), lexeme(in_lex), result(NULL), key_atom(atomTable::NONE)
+  , boilerplate(NULL), boilerplate_built(false)
+{
+}
+
+void ASTNode_Literal::InternKeys()
 {
+  for (int i = 0; i < GetNumChildren(); i += 2) {
+    ASTNode_Literal * key = (ASTNode_Literal *) GetChild(i);
+    key->key_atom = atom_table.Intern(key->lexeme);
+  }
 }
 
 tableEntry * ASTNode_Literal::Interpret(symbolTable & table)
 {
-  tableEntry * out_var = table.AddTempEntry(GetType());
+  // Each object or array literal makes a new one.
+  tableEntry * out_var;
+  if (GetType() == Type::OBJECT || GetType() == Type::ARRAY) out_var = table.AddTempEntry(GetType());
+  else out_var = ResultEntry(table, result, GetType());
+
   if(GetType() == Type::NUMBER) {
     if(lexeme.length() > 1) {
       if(lexeme[0] == '0' && lexeme[1] == 'x') {
         out_var->SetNumberValue(strtol(lexeme.c_str(), NULL, 16));
       }
-      else if(lexeme[0] == '0') {
+      else if(lexeme[0] == '0' && lexeme.find('.') == std::string::npos) {
         out_var->SetNumberValue(strtol(lexeme.c_str(), NULL, 8));
       }
       else {
@@ -81,18 +151,10 @@ tableEntry * ASTNode_Literal::Interpret(symbolTable & table)
     }
   }
   else if(GetType() == Type::STRING) {
-    out_var->SetStringValue(lexeme);
+    out_var->AssignStringValue(lexeme.data(), lexeme.size());
   }
   else if(GetType() == Type::OBJECT) {
-    out_var->InitializeObject();
-    if(GetNumChildren() > 0) {
-      ASTNode * obj = new ASTNode_Variable(out_var);
-      for(int i = 0; i < GetNumChildren(); i += 2) {
-        ASTNode * property = new ASTNode_Property(obj, GetChild(i), true);
-        ASTNode * assign = new ASTNode_Assign(property, GetChild(i + 1));
-        assign->Interpret(table);
-      }
-    }
+    BuildObject(table, out_var);
   }
   else if(GetType() == Type::ARRAY) {
     out_var->InitializeArray();
@@ -101,46 +163,221 @@ tableEntry * ASTNode_Literal::Interpret(symbolTable & table)
   return out_var;
 }
 
+// The children of an object literal are its keys (string literals) and
+// values, in pairs.
+tableEntry * ASTNode_Literal::MakeBoilerplate(symbolTable & table)
+{
+  tableEntry * plate = table.AddTempEntry(Type::OBJECT);
+  plate->InitializeObject();
+  for (int i = 0; i < GetNumChildren(); i += 2) {
+    uint32_t key = ((ASTNode_Literal *) GetChild(i))->key_atom;
+    ASTNode_Literal * value = dynamic_cast<ASTNode_Literal *>(GetChild(i + 1));
+
+    tableEntry * constant = NULL;
+    if (value && value->GetType() != Type::OBJECT && value->GetType() != Type::ARRAY) {
+      constant = table.AddTempEntry(Type::VOID);
+      CopyValue(constant, value->Interpret(table));
+    }
+    plate->SetProperty(key, constant);
+  }
+  if (plate->GetPropertyMap()->GetSize() * 2 != GetNumChildren()) return NULL;
+  return plate;
+}
+
+// Copy the boilerplate's keys in one go, then give each property an entry
+// of its own: a copy of the constant, or of the value evaluated now.
+void ASTNode_Literal::BuildObject(symbolTable & table, tableEntry * out_var)
+{
+  // Other threads may be running this node too, so only the serial path
+  // keeps the boilerplate it makes.
+  tableEntry * plate = boilerplate;
+  if (!boilerplate_built) {
+    plate = MakeBoilerplate(table);
+    if (!table.InParallel()) {
+      boilerplate = plate;
+      boilerplate_built = true;
+    }
+  }
+
+  if (!plate) {
+    // Repeated keys: the last value wins, in the first key's place.
+    out_var->InitializeObject();
+    for (int i = 0; i < GetNumChildren(); i += 2) {
+      uint32_t key = ((ASTNode_Literal *) GetChild(i))->key_atom;
+      tableEntry * prop = table.AddTempEntry(Type::VOID);
+      out_var->SetProperty(key, prop);
+      tableEntry * value = Operators::Operand(GetChild(i + 1)->Interpret(table));
+      if (value) CopyValue(prop, value);
+    }
+    return;
+  }
+
+  const propertyMap & layout = *plate->GetPropertyMap();
+  out_var->InitializeObject(layout);
+  propertyMap * props = out_var->GetPropertyMap();
+  for (int pos = 0; pos < layout.GetSize(); pos++) {
+    tableEntry * prop = table.AddTempEntry(Type::VOID);
+    props->SetValue(pos, prop);
+    tableEntry * value = layout.GetEntry(pos).value;
+    if (!value) value = Operators::Operand(GetChild(2 * pos + 1)->Interpret(table));
+    if (value) CopyValue(prop, value);
+  }
+}
+
 // ASTNode_Property
 
 ASTNode_Property::ASTNode_Property(ASTNode * obj, ASTNode * index,
-    bool assignment) : ASTNode(Type::VOID)
+    bool assignment) : ASTNode(Type::VOID), key_atom(atomTable::NONE),
+    element(NULL), typed_target(false), store_array(NULL), store_pos(0)
 {
-  children.push_back(obj);
-  children.push_back(index);
+  AddChild(obj);
+  AddChild(index);
   this->assignment = assignment;
+
+  // Intern constant keys ('obj.name', 'obj["name"]') now, so running the node
+  // does not build a string for them.
+  ASTNode_Literal * literal = dynamic_cast<ASTNode_Literal *>(index);
+  if (literal && literal->GetType() == Type::STRING) {
+    key_atom = atom_table.Intern(literal->GetLexeme());
+  }
+}
+
+std::string ASTNode_Property::KeyString(tableEntry * index) const
+{
+  if (key_atom != atomTable::NONE) return atom_table.GetName(key_atom);
+  return Operators::ToString(index);
+}
+
+// Whole numbers index arrays directly; anything else goes through its string.
+unsigned int ASTNode_Property::ArrayIndex(tableEntry * index) const
+{
+  if (index && index->GetType() == Type::NUMBER &&
+      index->GetNumberValue() >= 0 && index->GetNumberValue() < 2147483648.0 &&
+      index->GetNumberValue() == floor(index->GetNumberValue())) {
+    return (unsigned int) index->GetNumberValue();
+  }
+  // Keys from for-in over an array are strings of digits.
+  if (index && index->GetType() == Type::STRING) return atoi(index->GetStringValue().c_str());
+  return atoi(KeyString(index).c_str());
+}
+
+// Numeric value of an entry for storing into a typed array.
+static double TypedStoreValue(tableEntry * in_var)
+{
+  if (in_var && in_var->GetType() == Type::NUMBER) return in_var->GetNumberValue();
+  if (in_var && in_var->GetType() == Type::BOOL) return in_var->GetBoolValue() ? 1 : 0;
+  if (in_var && in_var->GetType() == Type::STRING) {
+    return atof(in_var->GetStringValue().c_str());
+  }
+  return NAN;
+}
+
+tableEntry * ASTNode_Property::InterpretTyped(symbolTable & table,
+    typedArray * array)
+{
+  tableEntry * index = NULL;
+  if (key_atom == atomTable::NONE) index = GetChild(1)->Interpret(table);
+
+  // Parallel callbacks share this node with other threads (and never assign),
+  // so they read into the node's slot in the callback's frame.
+  tableEntry * element = this->element;
+  if (table.InParallel()) {
+    element = ResultEntry(table, element, Type::NUMBER);
+  }
+  else {
+    if (!element) element = this->element = table.AddTempEntry(Type::NUMBER);
+    store_array = NULL;
+    typed_target = assignment;
+  }
+  element->SetType(Type::NUMBER);
+
+  if (key_atom == atomTable::LENGTH || (index && index->GetType() == Type::STRING &&
+                                         index->GetStringValue() == "length")) {
+    if (assignment) {
+      yyerror2("cannot assign to the length of a typed array", GetLineNum());
+      return element;
+    }
+    element->SetNumberValue(array->GetLength());
+    return element;
+  }
+
+  double pos = (key_atom == atomTable::NONE) ? TypedStoreValue(index)
+                                             : atof(atom_table.GetName(key_atom).c_str());
+  if (!(pos >= 0 && pos < array->GetLength())) {
+    // Out of range reads are undefined and out of range writes are dropped.
+    if (!assignment) return NULL;
+    return element;
+  }
+
+  // Load the current value even when assigning so compound assignments that
+  // read through this node see it.
+  element->SetNumberValue(array->GetElement((unsigned int) pos));
+  if (assignment) {
+    store_array = array;
+    store_pos = (unsigned int) pos;
+  }
+  return element;
+}
+
+bool ASTNode_Property::CommitTypedStore(tableEntry * value)
+{
+  if (!typed_target) return false;
+  typed_target = false;
+
+  // A NULL store_array means the index was out of range; drop the write.
+  if (store_array) {
+    store_array->SetElement(store_pos, TypedStoreValue(value));
+    element->SetNumberValue(store_array->GetElement(store_pos));
+    store_array = NULL;
+  }
+  return true;
 }
 
 tableEntry * ASTNode_Property::Interpret(symbolTable & table)
 {
   tableEntry * obj = GetChild(0)->Interpret(table);
+  if (!table.InParallel()) typed_target = false;
+
+  if(obj->GetType() == Type::TYPED_ARRAY) {
+    return InterpretTyped(table, obj->GetTypedArray());
+  }
 
-  ASTNode * cast = new ASTNode_StringCast(GetChild(1));
-  std::string sindex = cast->Interpret(table)->GetStringValue();
+  // Constant keys were interned when the node was built; computed ones are
+  // evaluated now.
+  tableEntry * index = NULL;
+  if (key_atom == atomTable::NONE) index = GetChild(1)->Interpret(table);
 
   if(obj->GetType() == Type::OBJECT) {
+    uint32_t atom = key_atom;
+    if (atom == atomTable::NONE) {
+      // A name that was never interned cannot be a property yet, so reads
+      // only look it up (which is also safe on several threads).
+      std::string key = Operators::ToString(index);
+      atom = assignment ? atom_table.Intern(key) : atom_table.Find(key);
+    }
+
     if(assignment) {
       tableEntry * prop = table.AddTempEntry(Type::VOID);
-      obj->SetProperty(sindex, prop);
+      obj->SetProperty(atom, prop);
       return prop;
     }
     else {
-      tableEntry * prop = obj->GetProperty(sindex);
+      tableEntry * prop = (atom == atomTable::NONE) ? NULL : obj->GetProperty(atom);
       if(prop) {
-        SetType(prop->GetType());
         return prop;
       }
       else {
         std::string error = "object ";
         error += obj->GetName();
         error += " does not have property";
-        error += sindex;
+        error += KeyString(index);
         yyerror(error);
       }
     }
   }
   else if(obj->GetType() == Type::ARRAY) {
-    unsigned int idx = atoi(sindex.c_str());
+    unsigned int idx = ArrayIndex(index);
+
     if(assignment) {
       tableEntry * val = table.AddTempEntry(Type::VOID);
       obj->SetIndex(idx, val);
@@ -149,38 +386,81 @@ tableEntry * ASTNode_Property::Interpret(symbolTable & table)
     else {
       tableEntry * val = obj->GetIndex(idx);
       if(val) {
-        SetType(val->GetType());
         return val;
       }
       else {
         std::string error = "array ";
         error += obj->GetName();
         error += " does not have index";
-        error += sindex;
+        error += KeyString(index);
         yyerror(error);
       }
     }
   }
 
+  return NULL;
 }
 
-// ASTNode_Assign
-
-ASTNode_Assign::ASTNode_Assign(ASTNode * lhs, ASTNode * rhs)
-  : ASTNode(lhs->GetType())
+// Numbers, strings, booleans and undefined can be updated where they are;
+// anything else may be shared, so a new value goes into a new entry.
+static bool UpdatableInPlace(tableEntry * value)
 {
-  children.push_back(lhs);
-  children.push_back(rhs);
+  switch (value->GetType()) {
+    case Type::VOID: case Type::NUMBER: case Type::BOOL: case Type::STRING:
+    case Type::NLL:
+      return true;
+  }
+  return false;
 }
 
-tableEntry * ASTNode_Assign::Interpret(symbolTable & table)
+tableEntry * ASTNode_Property::Locate(symbolTable & table, tableEntry *& current)
 {
-  tableEntry * left = GetChild(0)->Interpret(table);
-  tableEntry * right = GetChild(1)->Interpret(table);
+  tableEntry * obj = GetChild(0)->Interpret(table);
+  if (!table.InParallel()) typed_target = false;
+  current = NULL;
+
+  // A typed array element is loaded into the node's element entry, and
+  // written back by CommitTypedStore().
+  if (obj->GetType() == Type::TYPED_ARRAY) {
+    current = InterpretTyped(table, obj->GetTypedArray());
+    return current;
+  }
+
+  tableEntry * index = NULL;
+  if (key_atom == atomTable::NONE) index = GetChild(1)->Interpret(table);
+
+  // A missing property or index reads as undefined.
+  tableEntry * slot = NULL;
+  if (obj->GetType() == Type::OBJECT) {
+    uint32_t atom = key_atom;
+    if (atom == atomTable::NONE) atom = atom_table.Intern(Operators::ToString(index));
+    current = obj->GetProperty(atom);
+    if (current && UpdatableInPlace(current)) return current;
+    slot = table.AddTempEntry(Type::VOID);
+    obj->SetProperty(atom, slot);
+  }
+  else if (obj->GetType() == Type::ARRAY) {
+    unsigned int idx = ArrayIndex(index);
+    current = obj->GetIndex(idx);
+    if (current && UpdatableInPlace(current)) return current;
+    slot = table.AddTempEntry(Type::VOID);
+    obj->SetIndex(idx, slot);
+  }
+  return slot;
+}
 
-  // Right expression is undefined, don't perform any assignment
-  if(!right) {
-    return NULL;
+// ASTNode_Assign
+
+// Copy the value of right into left.  Numbers, booleans, strings and
+// functions are copied; objects and arrays are shared through a reference.
+static void CopyValue(tableEntry * left, tableEntry * right)
+{
+  // A string is copied into the one left already holds, so reassigning a
+  // string variable (once per line read, say) does not allocate.
+  if (left->GetType() == Type::STRING && right->GetType() == Type::STRING) {
+    const std::string & value = right->GetStringValue();
+    left->AssignStringValue(value.data(), value.size());
+    return;
   }
 
   left->SetType(right->GetType());
@@ -194,6 +474,9 @@ tableEntry * ASTNode_Assign::Interpret(symbolTable & table)
   else if(left->GetType() == Type::STRING) {
     left->SetStringValue(right->GetStringValue());
   }
+  else if(left->GetType() == Type::FUNCTION) {
+    left->SetFunction(right->GetFunction());
+  }
   else if(left->GetType() == Type::OBJECT) {
     left->SetReference(right);
     left->SetType(Type::REFERENCE);
@@ -202,22 +485,176 @@ tableEntry * ASTNode_Assign::Interpret(symbolTable & table)
     left->SetReference(right);
     left->SetType(Type::REFERENCE);
   }
+  else if(left->GetType() == Type::TYPED_ARRAY) {
+    left->SetReference(right);
+    left->SetType(Type::REFERENCE);
+  }
+}
+
+ASTNode_Assign::ASTNode_Assign(ASTNode * lhs, ASTNode * rhs)
+  : ASTNode(lhs->GetType()), target_kind(OTHER_TARGET)
+{
+  if (dynamic_cast<ASTNode_Variable *>(lhs)) target_kind = VARIABLE_TARGET;
+  else if (dynamic_cast<ASTNode_LocalVariable *>(lhs)) target_kind = LOCAL_TARGET;
+  AddChild(lhs);
+  AddChild(rhs);
+}
+
+tableEntry * ASTNode_Assign::Target(symbolTable & table)
+{
+  switch (target_kind) {
+    case VARIABLE_TARGET: return ((ASTNode_Variable *) GetChild(0))->GetVarEntry();
+    case LOCAL_TARGET: return ((ASTNode_LocalVariable *) GetChild(0))->GetSlotEntry(table);
+  }
+  return GetChild(0)->Interpret(table);
+}
+
+tableEntry * ASTNode_Assign::Interpret(symbolTable & table)
+{
+  tableEntry * left = Target(table);
+  tableEntry * right = Operators::Operand(GetChild(1)->Interpret(table));
+
+  // Typed array elements are written straight into the array's buffer.
+  ASTNode_Property * prop = NULL;
+  if (target_kind == OTHER_TARGET) prop = dynamic_cast<ASTNode_Property *>(GetChild(0));
+  if (prop && prop->CommitTypedStore(right)) {
+    return left;
+  }
+
+  // Right expression is undefined, don't perform any assignment
+  if(!right) {
+    return NULL;
+  }
+
+  CopyValue(left, right);
 
+  return Operators::Operand(left);
+}
+
+// ASTNode_NumberAssign
+
+tableEntry * ASTNode_NumberAssign::Interpret(symbolTable & table)
+{
+  tableEntry * left = Target(table);
+  tableEntry * right = GetChild(1)->Interpret(table);
+  left->AssignNumberValue(right->GetNumberValue());
   return left;
 }
 
+// ASTNode_CompoundAssign
+
+// Truth value of a condition, a boolean operand or a callback result.
+static bool IsTruthy(tableEntry * in_var)
+{
+  if (!in_var) return false;
+  in_var = Operators::Operand(in_var);
+  switch (in_var->GetType()) {
+    case Type::BOOL: return in_var->GetBoolValue();
+    case Type::NUMBER: return in_var->GetNumberValue() != 0 &&
+                              !std::isnan(in_var->GetNumberValue());
+    case Type::STRING: return in_var->GetStringValue() != "";
+    case Type::VOID: case Type::NLL: return false;
+  }
+  return true;
+}
+
+// Integer value of a bitwise operand (NaN and infinities count as zero).
+static int BitwiseOperand(tableEntry * value)
+{
+  double number = (value && value->GetType() == Type::NUMBER) ? value->GetNumberValue()
+                                                              : Operators::ToNumber(value);
+  return std::isfinite(number) ? (int) number : 0;
+}
+
+static int BitwiseResult(int op, int left, int right)
+{
+  switch(op) {
+    case '&': return left & right;
+    case '|': return left | right;
+    case '^': return left ^ right;
+    case LSHIFT: return left << right;
+    case RSHIFT: return left >> right;
+    case ZF_RSHIFT: return left >> unsigned(right);
+  }
+  return 0;
+}
+
+ASTNode_CompoundAssign::ASTNode_CompoundAssign(ASTNode * lhs, ASTNode * rhs, int op)
+  : ASTNode(lhs->GetType()), assign_op(op), kernel_op(Operators::MathOp(op))
+  , target_kind(VARIABLE_TARGET)
+{
+  if (dynamic_cast<ASTNode_Property *>(lhs)) target_kind = PROPERTY_TARGET;
+  else if (dynamic_cast<ASTNode_LocalVariable *>(lhs)) target_kind = LOCAL_TARGET;
+  AddChild(lhs);
+  AddChild(rhs);
+}
+
+tableEntry * ASTNode_CompoundAssign::Interpret(symbolTable & table)
+{
+  // The entry to update, and the value it holds now (followed through a
+  // reference, so 'x += 1' replaces a reference rather than what it names).
+  tableEntry * target = NULL;
+  tableEntry * current = NULL;
+  if (target_kind == PROPERTY_TARGET) {
+    target = ((ASTNode_Property *) GetChild(0))->Locate(table, current);
+  }
+  else {
+    if (target_kind == LOCAL_TARGET) target = ((ASTNode_LocalVariable *) GetChild(0))->GetSlotEntry(table);
+    else target = ((ASTNode_Variable *) GetChild(0))->GetVarEntry();
+    current = target;
+  }
+  current = Operators::Operand(current);
+  tableEntry * value = Operators::Operand(GetChild(1)->Interpret(table));
+  if (!target) return NULL;
+
+  tableEntry * result = target;
+  if (kernel_op < 0) {
+    target->SetType(Type::NUMBER);
+    target->SetNumberValue(BitwiseResult(assign_op, BitwiseOperand(current), BitwiseOperand(value)));
+  }
+  else if (kernel_op == Operators::ADD && target->GetType() == Type::STRING) {
+    // Appending grows the string's buffer geometrically, so a loop that
+    // builds a string this way takes linear time overall.
+    if (value && value->GetType() == Type::STRING) target->AppendStringValue(value->GetStringValue());
+    else target->AppendStringValue(Operators::ToString(value));
+  }
+  else if (target->GetType() == Type::NUMBER && value && value->GetType() == Type::NUMBER) {
+    // The number kernels may write over their own operand.
+    Operators::Math(kernel_op, target, target, value);
+  }
+  else {
+    result = table.AddTempEntry(Type::NUMBER);
+    Operators::Math(kernel_op, result, current, value);
+  }
+
+  // A typed array element takes the result as a number; anything else
+  // holds a copy of it.
+  ASTNode_Property * prop = NULL;
+  if (target_kind == PROPERTY_TARGET) prop = (ASTNode_Property *) GetChild(0);
+  if (prop && prop->CommitTypedStore(result)) return target;
+  if (result != target) CopyValue(target, result);
+  return target;
+}
+
 // ASTNode_Math1
 
 ASTNode_Math1::ASTNode_Math1(ASTNode * in_child, int op, bool pre)
-  : ASTNode(Type::NUMBER), math_op(op), prefix(pre)
+  : ASTNode(Type::NUMBER), math_op(op), prefix(pre), result(NULL)
 {
-  children.push_back(in_child);
+  AddChild(in_child);
 }
 
 tableEntry * ASTNode_Math1::Interpret(symbolTable & table)
 {
   tableEntry * in_var = GetChild(0)->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
+
+  // ++ and -- leave a number behind whatever the variable held before.
+  if ((math_op == INCREMENT || math_op == DECREMENT) && in_var->GetType() != Type::NUMBER) {
+    double start = Operators::ToNumber(in_var);
+    in_var->SetType(Type::NUMBER);
+    in_var->SetNumberValue(start);
+  }
 
   switch (math_op) {
     case '-':
@@ -251,195 +688,97 @@ tableEntry * ASTNode_Math1::Interpret(symbolTable & table)
 // ASTNode_Math2
 
 ASTNode_Math2::ASTNode_Math2(ASTNode * in1, ASTNode * in2, int op)
-  : ASTNode(Type::NUMBER), math_op(op)
+  : ASTNode(Type::NUMBER), math_op(op), kernel_op(Operators::MathOp(op)), result(NULL)
 {
-  children.push_back(in1);
-  children.push_back(in2);
+  AddChild(in1);
+  AddChild(in2);
 }
 
 tableEntry * ASTNode_Math2::Interpret(symbolTable & table)
 {
-  tableEntry * in1 = GetChild(0)->Interpret(table);
-  tableEntry * in2 = GetChild(1)->Interpret(table);
-  tableEntry * out_var;
-
-  if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::NUMBER) {
-    out_var = table.AddTempEntry(Type::NUMBER);
-    float in1_val = in1->GetNumberValue();
-    float in2_val = in2->GetNumberValue();
-
-    if (math_op == '+') { out_var->SetNumberValue(in1_val + in2_val); }
-    else if (math_op == '-') { out_var->SetNumberValue(in1_val - in2_val); }
-    else if (math_op == '*') { out_var->SetNumberValue(in1_val * in2_val); }
-    else if (math_op == '/') { out_var->SetNumberValue(in1_val / in2_val); }
-    else if (math_op == '%') { out_var->SetNumberValue(fmod(in1_val, in2_val)); }
-  }
-  else if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::STRING) {
-    out_var = table.AddTempEntry(Type::STRING);
-
-    std::stringstream ss;
-    ss << in1->GetNumberValue();
-    std::string in1_val = ss.str();
-    std::string in2_val = in2->GetStringValue();
+  tableEntry * in1 = Operators::Operand(GetChild(0)->Interpret(table));
+  tableEntry * in2 = Operators::Operand(GetChild(1)->Interpret(table));
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
 
-    if (math_op == '+') { out_var->SetStringValue(in1_val + in2_val); }
-  }
-  else if(in1->GetType() == Type::STRING && in2->GetType() == Type::NUMBER) {
-    out_var = table.AddTempEntry(Type::STRING);
+  Operators::Math(kernel_op, out_var, in1, in2);
+  return out_var;
+}
 
-    std::stringstream ss;
-    ss << in2->GetNumberValue();
-    std::string in1_val = in1->GetStringValue();
-    std::string in2_val = ss.str();
+// ASTNode_NumberMath2
 
-    if (math_op == '+') { out_var->SetStringValue(in1_val + in2_val); }
-  }
-  else if(in1->GetType() == Type::STRING && in2->GetType() == Type::STRING) {
-    out_var = table.AddTempEntry(Type::STRING);
-    std::string in1_val = in1->GetStringValue();
-    std::string in2_val = in2->GetStringValue();
+tableEntry * ASTNode_NumberMath2::Interpret(symbolTable & table)
+{
+  // Both operands are evaluated before either is read, as in Math2.
+  tableEntry * in1 = GetChild(0)->Interpret(table);
+  tableEntry * in2 = GetChild(1)->Interpret(table);
+  double a = in1->GetNumberValue(), b = in2->GetNumberValue();
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
 
-    if (math_op == '+') { out_var->SetStringValue(in1_val + in2_val); }
+  switch (math_op) {
+    case '+': out_var->SetNumberValue(a + b); break;
+    case '-': out_var->SetNumberValue(a - b); break;
+    case '*': out_var->SetNumberValue(a * b); break;
+    case '/': out_var->SetNumberValue(a / b); break;
+    default: out_var->SetNumberValue(fmod(a, b)); break;
   }
-
   return out_var;
 }
 
 // ASTNode_Comparison
 
 ASTNode_Comparison::ASTNode_Comparison(ASTNode * in1, ASTNode * in2, int op)
-  : ASTNode(Type::BOOL), comp_op(op)
+  : ASTNode(Type::BOOL), comp_op(op), kernel_op(Operators::CompareOp(op)), result(NULL)
 {
-  children.push_back(in1);
-  children.push_back(in2);
+  AddChild(in1);
+  AddChild(in2);
 }
 
-bool strict_equality(tableEntry * a, tableEntry * b) {
-  if(a->GetType() != b->GetType()) {
-    return false;
-  }
-
-  else if(a->GetType() == Type::NUMBER) {
-    if(isnan(a->GetNumberValue()) || isnan(b->GetNumberValue())) {
-      return false;
-    }
-
-    return a->GetNumberValue() == b->GetNumberValue();
-  }
-
-  else if(a->GetType() == Type::STRING) {
-    return a->GetStringValue() == b->GetStringValue();
-  }
-
-  else if(a->GetType() == Type::BOOL) {
-    return a->GetBoolValue() == b->GetBoolValue();
-  }
+tableEntry * ASTNode_Comparison::Interpret(symbolTable & table)
+{
+  tableEntry * in1 = Operators::Operand(GetChild(0)->Interpret(table));
+  tableEntry * in2 = Operators::Operand(GetChild(1)->Interpret(table));
+  tableEntry * out_var = ResultEntry(table, result, Type::BOOL);
 
-  else {
-    return a == b;
-  }
+  out_var->SetBoolValue(Operators::Compare(kernel_op, in1, in2));
+  return out_var;
 }
 
-bool abstract_equality(tableEntry * a, tableEntry * b, symbolTable & table) {
-  if(a && b && a->GetType() == b->GetType()) {
-    return strict_equality(a, b);
-  }
-
-  else if(a->GetType() == NLL && !b) {
-    return true;
-  }
-
-  else if(a->GetType() == NLL && !a) {
-    return true;
-  }
-
-  else if(a->GetType() == Type::NUMBER && b->GetType() == Type::STRING) {
-    ASTNode * cast = new ASTNode_NumberCast(new ASTNode_Variable(b));
-    return a->GetNumberValue() == cast->Interpret(table)->GetNumberValue();
-  }
-
-  else if(a->GetType() == Type::STRING && b->GetType() == Type::NUMBER) {
-    ASTNode * cast = new ASTNode_NumberCast(new ASTNode_Variable(b));
-    return cast->Interpret(table)->GetNumberValue() == b->GetNumberValue();
-  }
-
-  else if(a->GetType() == Type::NUMBER && b->GetType() == Type::BOOL) {
-    ASTNode * cast = new ASTNode_NumberCast(new ASTNode_Variable(b));
-    return a->GetNumberValue() == cast->Interpret(table)->GetNumberValue();
-  }
-
-  else if(a->GetType() == Type::BOOL && b->GetType() == Type::NUMBER) {
-    ASTNode * cast = new ASTNode_NumberCast(new ASTNode_Variable(b));
-    return cast->Interpret(table)->GetNumberValue() == b->GetNumberValue();
-  }
-
-  return false;
-}
+// ASTNode_NumberComparison
 
-tableEntry * ASTNode_Comparison::Interpret(symbolTable & table)
+tableEntry * ASTNode_NumberComparison::Interpret(symbolTable & table)
 {
   tableEntry * in1 = GetChild(0)->Interpret(table);
   tableEntry * in2 = GetChild(1)->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::BOOL);
+  double a = in1->GetNumberValue(), b = in2->GetNumberValue();
+  tableEntry * out_var = ResultEntry(table, result, Type::BOOL);
 
-  bool value;
-  switch(comp_op) {
-    case COMP_EQU:
-      value = abstract_equality(in1, in2, table);
-      break;
-    case COMP_NEQU:
-      value = !abstract_equality(in1, in2, table);
-      break;
-    case COMP_SEQU:
-      value = strict_equality(in1, in2);
-      break;
-    case COMP_SNEQU:
-      value = !strict_equality(in1, in2);
-      break;
-    case COMP_GTR:
-      if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::NUMBER) {
-        value = (in1->GetNumberValue() > in2->GetNumberValue());
-      }
-      break;
-    case COMP_GTE:
-      if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::NUMBER) {
-        value = (in1->GetNumberValue() >= in2->GetNumberValue());
-      }
-      break;
-    case COMP_LESS:
-      if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::NUMBER) {
-        value = (in1->GetNumberValue() < in2->GetNumberValue());
-      }
-      break;
-    case COMP_LTE:
-      if(in1->GetType() == Type::NUMBER && in2->GetType() == Type::NUMBER) {
-        value = (in1->GetNumberValue() <= in2->GetNumberValue());
-      }
-      break;
+  switch (kernel_op) {
+    case Operators::EQU: case Operators::SEQU: out_var->SetBoolValue(a == b); break;
+    case Operators::NEQU: case Operators::SNEQU: out_var->SetBoolValue(a != b); break;
+    case Operators::LESS: out_var->SetBoolValue(a < b); break;
+    case Operators::LTE: out_var->SetBoolValue(a <= b); break;
+    case Operators::GTR: out_var->SetBoolValue(a > b); break;
+    default: out_var->SetBoolValue(a >= b); break;
   }
-
-  out_var->SetBoolValue(value);
-
   return out_var;
 }
 
 // ASTNode_Bool1
 
 ASTNode_Bool1::ASTNode_Bool1(ASTNode * in, int op)
-  : ASTNode(Type::BOOL), bool_op(op)
+  : ASTNode(Type::BOOL), bool_op(op), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_Bool1::Interpret(symbolTable & table)
 {
-  ASTNode_BoolCast * cast = new ASTNode_BoolCast(GetChild(0));
-  tableEntry * in_var = cast->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::BOOL);
+  bool in_value = IsTruthy(GetChild(0)->Interpret(table));
+  tableEntry * out_var = ResultEntry(table, result, Type::BOOL);
 
   switch(bool_op) {
     case '!':
-      out_var->SetBoolValue(!in_var->GetBoolValue());
+      out_var->SetBoolValue(!in_value);
       break;
   }
 
@@ -449,20 +788,19 @@ tableEntry * ASTNode_Bool1::Interpret(symbolTable & table)
 // ASTNode_Bool2
 
 ASTNode_Bool2::ASTNode_Bool2(ASTNode * in1, ASTNode * in2, int op)
-  : ASTNode(Type::NUMBER), bool_op(op)
+  : ASTNode(Type::NUMBER), bool_op(op), result(NULL)
 {
-  children.push_back(in1);
-  children.push_back(in2);
+  AddChild(in1);
+  AddChild(in2);
 }
 
 
 tableEntry * ASTNode_Bool2::Interpret(symbolTable & table)
 {
-  ASTNode_BoolCast * cast1 = new ASTNode_BoolCast(GetChild(0));
-  tableEntry * in1 = cast1->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::BOOL);
+  bool in1 = IsTruthy(GetChild(0)->Interpret(table));
+  tableEntry * out_var = ResultEntry(table, result, Type::BOOL);
 
-  out_var->SetBoolValue(in1->GetBoolValue());
+  out_var->SetBoolValue(in1);
 
   // Determine the correct operation for short-circuiting
   if (bool_op == BOOL_AND) {
@@ -477,14 +815,13 @@ tableEntry * ASTNode_Bool2::Interpret(symbolTable & table)
   }
 
   // Only reach here if we don't short circuit
-  ASTNode_BoolCast * cast2 = new ASTNode_BoolCast(GetChild(1));
-  tableEntry * in2 = cast2->Interpret(table);
+  bool in2 = IsTruthy(GetChild(1)->Interpret(table));
 
   if (bool_op == BOOL_AND) {
-    out_var->SetBoolValue(in1->GetBoolValue() && in2->GetBoolValue());
+    out_var->SetBoolValue(in1 && in2);
   }
   else if (bool_op == BOOL_OR) {
-    out_var->SetBoolValue(in1->GetBoolValue() || in2->GetBoolValue());
+    out_var->SetBoolValue(in1 || in2);
   }
 
   return out_var;
@@ -493,9 +830,9 @@ tableEntry * ASTNode_Bool2::Interpret(symbolTable & table)
 // ASTNode_Bitwise1
 
 ASTNode_Bitwise1::ASTNode_Bitwise1(ASTNode * in, int op)
-  : ASTNode(Type::NUMBER), bitwise_op(op)
+  : ASTNode(Type::NUMBER), bitwise_op(op), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_Bitwise1::Interpret(symbolTable & table)
@@ -504,7 +841,7 @@ tableEntry * ASTNode_Bitwise1::Interpret(symbolTable & table)
 
   int value = in_var->GetNumberValue();
 
-  tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
 
   switch(bitwise_op) {
     case '~':
@@ -519,10 +856,10 @@ tableEntry * ASTNode_Bitwise1::Interpret(symbolTable & table)
 // ASTNode_Bitwise2
 
 ASTNode_Bitwise2::ASTNode_Bitwise2(ASTNode * in1, ASTNode * in2, int op)
-  : ASTNode(Type::NUMBER), bitwise_op(op)
+  : ASTNode(Type::NUMBER), bitwise_op(op), result(NULL)
 {
-  children.push_back(in1);
-  children.push_back(in2);
+  AddChild(in1);
+  AddChild(in2);
 }
 
 tableEntry * ASTNode_Bitwise2::Interpret(symbolTable & table)
@@ -530,34 +867,8 @@ tableEntry * ASTNode_Bitwise2::Interpret(symbolTable & table)
   tableEntry * in0 = GetChild(0)->Interpret(table);
   tableEntry * in1 = GetChild(1)->Interpret(table);
 
-  int left = in0->GetNumberValue();
-  int right = in1->GetNumberValue();
-
-  tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
-
-  int value;
-  switch(bitwise_op) {
-    case '&':
-      value = left & right;
-      break;
-    case '|':
-      value = left | right;
-      break;
-    case '^':
-      value = left ^ right;
-      break;
-    case LSHIFT:
-      value = left << right;
-      break;
-    case RSHIFT:
-      value = left >> right;
-      break;
-    case ZF_RSHIFT:
-      value = left >> unsigned(right);
-      break;
-  }
-
-  out_var->SetNumberValue(value);
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
+  out_var->SetNumberValue(BitwiseResult(bitwise_op, in0->GetNumberValue(), in1->GetNumberValue()));
   return out_var;
 }
 
@@ -566,9 +877,9 @@ tableEntry * ASTNode_Bitwise2::Interpret(symbolTable & table)
 ASTNode_If::ASTNode_If(ASTNode * in1, ASTNode * in2, ASTNode * in3)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in1);
-  children.push_back(in2);
-  children.push_back(in3);
+  AddChild(in1);
+  AddChild(in2);
+  AddChild(in3);
 }
 
 tableEntry * ASTNode_If::Interpret(symbolTable & table)
@@ -587,25 +898,52 @@ tableEntry * ASTNode_If::Interpret(symbolTable & table)
   return NULL;
 }
 
+// Handle a loop body that completed abruptly.  break and continue are
+// consumed by the innermost loop; return and halt keep unwinding.  Returns
+// true if the loop should go on to its next iteration.
+static bool ContinueLoop(symbolTable & table)
+{
+  int completion = table.GetCompletion();
+  if (completion == symbolTable::RETURN || completion == symbolTable::HALT) return false;
+
+  table.SetCompletion(symbolTable::NORMAL);
+  return completion == symbolTable::CONTINUE;
+}
+
+// With --trace, record a loop that ran long enough to show on the timeline,
+// with its line and how many iterations it ran.
+static void TraceLoop(const char * name, const ASTNode * loop, Trace::timestamp start,
+                      long long iterations)
+{
+  if (Trace::Now() - start < Trace::MIN_SPAN_NANOS) return;
+  Trace::Span(name, "loop", start, Trace::Arg("line", loop->GetLineNum()) + ", " +
+                                   Trace::Arg("iterations", iterations));
+}
+
 // ASTNode_While
 
 ASTNode_While::ASTNode_While(ASTNode * in1, ASTNode * in2)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in1);
-  children.push_back(in2);
+  AddChild(in1);
+  AddChild(in2);
 }
 
 tableEntry * ASTNode_While::Interpret(symbolTable & table)
 {
-  ASTNode_BoolCast * cast = new ASTNode_BoolCast(GetChild(0));
+  Trace::timestamp start = Trace::enabled ? Trace::Now() : 0;
+  long long iterations = 0;
 
-  while(cast->Interpret(table)->GetBoolValue()) {
+  while(IsTruthy(GetChild(0)->Interpret(table))) {
+    if (OutOfBudget(table)) break;
+    iterations++;
     if (GetChild(1)) {
       tableEntry * in1 = GetChild(1)->Interpret(table);
+      if (table.GetCompletion() != symbolTable::NORMAL && !ContinueLoop(table)) break;
     }
   }
 
+  if (Trace::enabled) TraceLoop("while", this, start, iterations);
   return NULL;
 }
 
@@ -614,28 +952,33 @@ tableEntry * ASTNode_While::Interpret(symbolTable & table)
 ASTNode_For::ASTNode_For(ASTNode * in1, ASTNode * in2, ASTNode * in3,
     ASTNode * in4) : ASTNode(Type::VOID)
 {
-  children.push_back(in1);
-  children.push_back(in2);
-  children.push_back(in3);
-  children.push_back(in4);
+  AddChild(in1);
+  AddChild(in2);
+  AddChild(in3);
+  AddChild(in4);
 }
 
 tableEntry * ASTNode_For::Interpret(symbolTable & table)
 {
-  ASTNode_BoolCast * cast = new ASTNode_BoolCast(GetChild(1));
+  Trace::timestamp start = Trace::enabled ? Trace::Now() : 0;
+  long long iterations = 0;
 
   if(GetChild(0)) {
     tableEntry * in0 = GetChild(0)->Interpret(table);
   }
-  while(cast->Interpret(table)->GetBoolValue()) {
+  while(IsTruthy(GetChild(1)->Interpret(table))) {
+    if (OutOfBudget(table)) break;
+    iterations++;
     if (GetChild(3)) {
       tableEntry * in3 = GetChild(3)->Interpret(table);
+      if (table.GetCompletion() != symbolTable::NORMAL && !ContinueLoop(table)) break;
     }
     if (GetChild(2)) {
       tableEntry * in2 = GetChild(2)->Interpret(table);
     }
   }
 
+  if (Trace::enabled) TraceLoop("for", this, start, iterations);
   return NULL;
 }
 
@@ -644,37 +987,105 @@ tableEntry * ASTNode_For::Interpret(symbolTable & table)
 ASTNode_ForIn::ASTNode_ForIn(ASTNode * in1, ASTNode * in2, ASTNode * in3)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in1);
-  children.push_back(in2);
-  children.push_back(in3);
+  AddChild(in1);
+  AddChild(in2);
+  AddChild(in3);
+}
+
+// Store a for-in key in the loop variable.  A variable that already holds a
+// string keeps its buffer, so a loop allocates nothing once the buffer is
+// as long as its longest key.
+static void SetLoopKey(tableEntry * iterator, const char * key, size_t length)
+{
+  if (iterator->GetType() != Type::STRING) {
+    iterator->SetType(Type::STRING);
+    iterator->SetStringValue(std::string(key, length));
+    return;
+  }
+  iterator->AssignStringValue(key, length);
 }
 
 tableEntry * ASTNode_ForIn::Interpret(symbolTable & table)
 {
-  // Setup a variable to be assigned at each iteration
-  tableEntry * iterator = GetChild(0)->Interpret(table);
-  ASTNode * iterator_usage = new ASTNode_Variable(iterator);
+  // The loop variable is always a declaration; keys are written straight
+  // into its entry (rebinding it if it held an object).
+  tableEntry * iterator = NULL;
+  if (ASTNode_LocalVariable * local = dynamic_cast<ASTNode_LocalVariable *>(GetChild(0))) {
+    iterator = local->GetSlotEntry(table);
+  }
+  else {
+    iterator = ((ASTNode_Variable *) GetChild(0))->GetVarEntry();
+  }
 
   // The item to be iterated over
-  tableEntry * iterable = GetChild(1)->Interpret(table);
+  tableEntry * iterable = Operators::Operand(GetChild(1)->Interpret(table));
+  if (!iterable) return NULL;
+  Trace::timestamp start = Trace::enabled ? Trace::Now() : 0;
+  long long iterations = 0;
 
   if(iterable->GetType() == Type::OBJECT) {
-    // Iterate over each property of the object
-    std::map<std::string, tableEntry*> * pm = iterable->GetPropertyMap();
-    for (std::map<std::string, tableEntry*>::iterator i = pm->begin();
-         i != pm->end(); i++) {
-      // Assign the iterator
-      ASTNode * prop_str = new ASTNode_Literal(Type::STRING, i->first);
-      ASTNode * assignment = new ASTNode_Assign(iterator_usage, prop_str);
-      assignment->Interpret(table);
+    // Iterate over each property of the object in insertion order.  Properties
+    // added by the loop body are not visited.  Keys are atoms, so their
+    // strings come from the atom table rather than being built each time.
+    propertyMap * pm = iterable->GetPropertyMap();
+    int num_props = pm->GetSize();
+    for (int i = 0; i < num_props; i++) {
+      if (OutOfBudget(table)) break;
+      iterations++;
+
+      const std::string & key = atom_table.GetName(pm->GetEntry(i).atom);
+      SetLoopKey(iterator, key.data(), key.size());
+
+      // Run body of loop
+      if(GetChild(2)) {
+        GetChild(2)->Interpret(table);
+        if (table.GetCompletion() != symbolTable::NORMAL && !ContinueLoop(table)) break;
+      }
+    }
+  }
+  else if(iterable->GetType() == Type::ARRAY || iterable->GetType() == Type::TYPED_ARRAY) {
+    // Visit the indices below the length the array had when the loop
+    // started, in order.  Each step looks up the next index that is present,
+    // so holes, and elements the body deletes before they are reached, are
+    // skipped.
+    std::map<unsigned int, tableEntry*> * elements = NULL;
+    typedArray * typed = NULL;
+    unsigned int end = 0;
+    if (iterable->GetType() == Type::ARRAY) {
+      elements = iterable->GetArray();
+      if (!elements->empty()) end = elements->rbegin()->first + 1;
+    }
+    else {
+      typed = iterable->GetTypedArray();
+      end = typed->GetLength();
+    }
+
+    char key[16];
+    for (unsigned int index = 0; index < end; index++) {
+      if (OutOfBudget(table)) break;
+
+      if (elements) {
+        std::map<unsigned int, tableEntry*>::iterator it = elements->lower_bound(index);
+        if (it == elements->end() || it->first >= end) break;
+        index = it->first;
+      }
+      else if (index >= typed->GetLength()) {
+        break;
+      }
+
+      iterations++;
+      int length = snprintf(key, sizeof(key), "%u", index);
+      SetLoopKey(iterator, key, length);
 
       // Run body of loop
       if(GetChild(2)) {
         GetChild(2)->Interpret(table);
+        if (table.GetCompletion() != symbolTable::NORMAL && !ContinueLoop(table)) break;
       }
     }
   }
 
+  if (Trace::enabled) TraceLoop("for-in", this, start, iterations);
   return NULL;
 }
 
@@ -687,6 +1098,20 @@ ASTNode_Break::ASTNode_Break()
 
 tableEntry * ASTNode_Break::Interpret(symbolTable & table)
 {
+  table.SetCompletion(symbolTable::BREAK);
+  return NULL;
+}
+
+// ASTNode_Continue
+
+ASTNode_Continue::ASTNode_Continue()
+  : ASTNode(Type::VOID)
+{
+}
+
+tableEntry * ASTNode_Continue::Interpret(symbolTable & table)
+{
+  table.SetCompletion(symbolTable::CONTINUE);
   return NULL;
 }
 
@@ -702,14 +1127,15 @@ ASTNode_Print::ASTNode_Print(ASTNode * out_child)
 
 tableEntry * ASTNode_Print::Interpret(symbolTable & table)
 {
+  std::string line;
   for (int i = 0; i < GetNumChildren(); i++) {
-    ASTNode * cast = new ASTNode_StringCast(GetChild(i));
-    tableEntry * cur_var = cast->Interpret(table);
-
-    std::cout << cur_var->GetStringValue();
+    tableEntry * cur_var = GetChild(i)->Interpret(table);
+    if (cur_var && cur_var->GetType() == Type::STRING) line += cur_var->GetStringValue();
+    else line += Operators::ToString(cur_var);
   }
 
-  std::cout << std::endl;
+  std::lock_guard<std::mutex> hold(print_lock);
+  std::cout << line << std::endl;
 
   return NULL;
 }
@@ -733,119 +1159,70 @@ tableEntry * ASTNode_Delete::Interpret(symbolTable & table)
 // ASTNode_NumberCast
 
 ASTNode_NumberCast::ASTNode_NumberCast(ASTNode * in)
-  : ASTNode(Type::NUMBER)
+  : ASTNode(Type::NUMBER), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_NumberCast::Interpret(symbolTable & table)
 {
   tableEntry * in_var = GetChild(0)->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
-
-  if(!in_var) {
-    out_var->SetNumberValue(0.0 / 0.0);
-    return out_var;
-  }
-
-  if(in_var->GetType() == Type::NUMBER) {
+  if(in_var && in_var->GetType() == Type::NUMBER) {
     return in_var;
   }
 
-  if(in_var->GetType() == Type::STRING) {
-    out_var->SetNumberValue(atof(in_var->GetStringValue().c_str()));
-  }
-  else if(in_var->GetType() == Type::BOOL) {
-    if(in_var->GetBoolValue()) {
-      out_var->SetNumberValue(1);
-    }
-    else {
-      out_var->SetNumberValue(0);
-    }
-  }
-
+  tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
+  out_var->SetNumberValue(Operators::ToNumber(in_var));
   return out_var;
 }
 
 // ASTNode_BoolCast
 
 ASTNode_BoolCast::ASTNode_BoolCast(ASTNode * in)
-  : ASTNode(Type::NUMBER)
+  : ASTNode(Type::NUMBER), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_BoolCast::Interpret(symbolTable & table)
 {
   tableEntry * in_var = GetChild(0)->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::BOOL);
-
-  if(!in_var) {
-    out_var->SetBoolValue(false);
-    return out_var;
-  }
-
-  if(in_var->GetType() == Type::BOOL) {
+  if(in_var && in_var->GetType() == Type::BOOL) {
     return in_var;
   }
 
-  if(in_var->GetType() == Type::NUMBER) {
-    out_var->SetBoolValue(in_var->GetNumberValue() != 0);
-  }
-
+  tableEntry * out_var = ResultEntry(table, result, Type::BOOL);
+  out_var->SetBoolValue(IsTruthy(in_var));
   return out_var;
 }
 
 // ASTNode_StringCast
 
 ASTNode_StringCast::ASTNode_StringCast(ASTNode * in)
-  : ASTNode(Type::STRING)
+  : ASTNode(Type::STRING), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_StringCast::Interpret(symbolTable & table)
 {
   tableEntry * in_var = GetChild(0)->Interpret(table);
-  tableEntry * out_var = table.AddTempEntry(Type::STRING);
-
-  if(!in_var) {
-    out_var->SetStringValue("undefined");
-    return out_var;
-  }
-
-  if(in_var->GetType() == Type::STRING) {
+  if(in_var && in_var->GetType() == Type::STRING) {
     return in_var;
   }
 
-  std::stringstream ss;
-
-  if(in_var->GetType() == Type::NUMBER) {
-    ss << in_var->GetNumberValue();
-  }
-  else if(in_var->GetType() == Type::BOOL) {
-    if(in_var->GetBoolValue()) {
-      ss << "true";
-    }
-    else {
-      ss << "false";
-    }
-  }
-  else if(in_var->GetType() == Type::NLL) {
-    ss << "null";
-  }
-
-  out_var->SetStringValue(ss.str());
-
+  std::string text = Operators::ToString(in_var);
+  tableEntry * out_var = ResultEntry(table, result, Type::STRING);
+  out_var->AssignStringValue(text.data(), text.size());
   return out_var;
 }
 
 // ASTNode_TypeOf
 
 ASTNode_TypeOf::ASTNode_TypeOf(ASTNode * in)
-  : ASTNode(Type::STRING)
+  : ASTNode(Type::STRING), result(NULL)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_TypeOf::Interpret(symbolTable & table)
@@ -860,9 +1237,9 @@ tableEntry * ASTNode_TypeOf::Interpret(symbolTable & table)
     type = "undefined";
   }
 
-  ASTNode * out_var = new ASTNode_Literal(Type::STRING, type);
-
-  return out_var->Interpret(table);
+  tableEntry * out_var = ResultEntry(table, result, Type::STRING);
+  out_var->AssignStringValue(type.data(), type.size());
+  return out_var;
 }
 
 // ASTNode_Void
@@ -870,7 +1247,7 @@ tableEntry * ASTNode_TypeOf::Interpret(symbolTable & table)
 ASTNode_Void::ASTNode_Void(ASTNode * in)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_Void::Interpret(symbolTable & table)
@@ -883,10 +1260,10 @@ tableEntry * ASTNode_Void::Interpret(symbolTable & table)
 // ASTNode_Join
 
 ASTNode_Join::ASTNode_Join(ASTNode * in, ASTNode * sep)
-  : ASTNode(Type::STRING)
+  : ASTNode(Type::STRING), result(NULL)
 {
-  children.push_back(in);
-  children.push_back(sep);
+  AddChild(in);
+  AddChild(sep);
 }
 
 tableEntry * ASTNode_Join::Interpret(symbolTable & table)
@@ -899,18 +1276,18 @@ tableEntry * ASTNode_Join::Interpret(symbolTable & table)
   std::map<unsigned int, tableEntry*> * pm = in_var->GetArray();
   for (std::map<unsigned int, tableEntry*>::iterator i = pm->begin();
        i != pm->end(); i++) {
-    ASTNode * var = new ASTNode_Variable(i->second);
-    ASTNode * cast = new ASTNode_StringCast(var);
-    tableEntry * string_val = cast->Interpret(table);
-    join_str += string_val->GetStringValue();
+    tableEntry * string_val = Operators::Operand(i->second);
+    if (string_val->GetType() == Type::STRING) join_str += string_val->GetStringValue();
+    else join_str += Operators::ToString(string_val);
     std::map<unsigned int, tableEntry*>::iterator end = pm->end();
     if(i != --end) {
       join_str += seperator->GetStringValue();
     }
   }
 
-  ASTNode * out_var = new ASTNode_Literal(Type::STRING, join_str);
-  return out_var->Interpret(table);
+  tableEntry * out_var = ResultEntry(table, result, Type::STRING);
+  out_var->AssignStringValue(join_str.data(), join_str.size());
+  return out_var;
 }
 
 // ASTNode_Push
@@ -918,19 +1295,24 @@ tableEntry * ASTNode_Join::Interpret(symbolTable & table)
 ASTNode_Push::ASTNode_Push(ASTNode * in, ASTNode * elem)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in);
-  children.push_back(elem);
+  AddChild(in);
+  AddChild(elem);
 }
 
 tableEntry * ASTNode_Push::Interpret(symbolTable & table)
 {
   tableEntry * in_var = GetChild(0)->Interpret(table);
-  tableEntry * element = GetChild(1)->Interpret(table);
+  tableEntry * element = Operators::Operand(GetChild(1)->Interpret(table));
 
-  std::map<unsigned int, tableEntry*>::iterator end = in_var->GetArray()->end();
-  unsigned int last_index = end->first;
+  // The array gets an entry of its own: element may be a result that the
+  // node producing it reuses.  A call that returns nothing pushes undefined.
+  tableEntry * copy = table.AddTempEntry(Type::VOID);
+  if (element) CopyValue(copy, element);
 
-  in_var->SetIndex(last_index++, element);
+  // The new element goes one past the highest index.
+  std::map<unsigned int, tableEntry*> * elements = in_var->GetArray();
+  unsigned int next_index = elements->empty() ? 0 : elements->rbegin()->first + 1;
+  in_var->SetIndex(next_index, copy);
 
   return NULL;
 }
@@ -940,7 +1322,7 @@ tableEntry * ASTNode_Push::Interpret(symbolTable & table)
 ASTNode_Pop::ASTNode_Pop(ASTNode * in)
   : ASTNode(Type::VOID)
 {
-  children.push_back(in);
+  AddChild(in);
 }
 
 tableEntry * ASTNode_Pop::Interpret(symbolTable & table)
@@ -959,3 +1341,985 @@ tableEntry * ASTNode_Pop::Interpret(symbolTable & table)
 
   return last_elem;
 }
+
+// ASTNode_TypedArrayNew
+
+ASTNode_TypedArrayNew::ASTNode_TypedArrayNew(ASTNode * length, int kind)
+  : ASTNode(Type::TYPED_ARRAY), elem_kind(kind)
+{
+  AddChild(length);
+}
+
+tableEntry * ASTNode_TypedArrayNew::Interpret(symbolTable & table)
+{
+  tableEntry * in_var = GetChild(0)->Interpret(table);
+
+  double length = TypedStoreValue(in_var);
+  if (!(length >= 0 && length <= 4294967295.0) || length != floor(length)) {
+    yyerror2("invalid typed array length", GetLineNum());
+    length = 0;
+  }
+
+  tableEntry * out_var = table.AddTempEntry(Type::TYPED_ARRAY);
+  out_var->InitializeTypedArray(elem_kind, (unsigned int) length);
+
+  return out_var;
+}
+
+// ASTNode_TypedArrayMethod
+
+int ASTNode_TypedArrayMethod::LookupMethod(const std::string & name)
+{
+  if (name == "fill") return FILL;
+  if (name == "sum") return SUM;
+  if (name == "min") return MIN;
+  if (name == "max") return MAX;
+  if (name == "scale") return SCALE;
+  if (name == "add") return ADD;
+  if (name == "mul") return MUL;
+  if (name == "dot") return DOT;
+  return UNKNOWN;
+}
+
+int ASTNode_TypedArrayMethod::GetArgCount(int method)
+{
+  switch (method) {
+    case SUM: case MIN: case MAX:
+      return 0;
+  }
+  return 1;
+}
+
+ASTNode_TypedArrayMethod::ASTNode_TypedArrayMethod(ASTNode * in, int method)
+  : ASTNode(Type::VOID), method(method), result(NULL)
+{
+  AddChild(in);
+}
+
+typedArray * ASTNode_TypedArrayMethod::GetArrayArg(tableEntry * in_var)
+{
+  if (!in_var || in_var->GetType() != Type::TYPED_ARRAY) {
+    yyerror2("expected a typed array", GetLineNum());
+    return NULL;
+  }
+  return in_var->GetTypedArray();
+}
+
+tableEntry * ASTNode_TypedArrayMethod::Interpret(symbolTable & table)
+{
+  tableEntry * in_var = GetChild(0)->Interpret(table);
+  typedArray * array = GetArrayArg(in_var);
+  if (!array) return NULL;
+
+  tableEntry * arg = NULL;
+  if (GetNumChildren() > 1) arg = GetChild(1)->Interpret(table);
+
+  // Methods that produce a number
+  if (MakesResult()) {
+    double value = 0;
+
+    if (method == SUM) value = array->Sum();
+    else if (method == MIN) value = array->Min();
+    else if (method == MAX) value = array->Max();
+    else {
+      typedArray * other = GetArrayArg(arg);
+      if (!other) return NULL;
+      if (!array->Dot(*other, value)) {
+        yyerror2("typed array lengths do not match", GetLineNum());
+        return NULL;
+      }
+    }
+
+    tableEntry * out_var = ResultEntry(table, result, Type::NUMBER);
+    out_var->SetNumberValue(value);
+    return out_var;
+  }
+
+  // Methods that update the array in place, and return it for chaining
+  if (method == FILL) array->Fill(TypedStoreValue(arg));
+  else if (method == SCALE) array->Scale(TypedStoreValue(arg));
+  else {
+    typedArray * other = GetArrayArg(arg);
+    if (!other) return NULL;
+    bool ok = (method == ADD) ? array->Add(*other) : array->Mul(*other);
+    if (!ok) {
+      yyerror2("typed array lengths do not match", GetLineNum());
+      return NULL;
+    }
+  }
+
+  return in_var;
+}
+
+// ASTNode_Json
+
+int ASTNode_Json::LookupMethod(const std::string & name)
+{
+  if (name == "parse") return PARSE;
+  if (name == "stringify") return STRINGIFY;
+  return UNKNOWN;
+}
+
+ASTNode_Json::ASTNode_Json(ASTNode * in, int method)
+  : ASTNode(Type::VOID), method(method)
+{
+  AddChild(in);
+}
+
+tableEntry * ASTNode_Json::Interpret(symbolTable & table)
+{
+  tableEntry * in_var = GetChild(0)->Interpret(table);
+  std::string error;
+
+  if (method == PARSE) {
+    if (!in_var || in_var->GetType() != Type::STRING) {
+      yyerror2("JSON.parse expects a string", GetLineNum());
+      return NULL;
+    }
+    tableEntry * out_var = Json::Parse(in_var->GetStringValue(), table, error);
+    if (!out_var) yyerror2("JSON.parse: " + error, GetLineNum());
+    return out_var;
+  }
+
+  std::string text;
+  if (!Json::Stringify(in_var, text, error)) {
+    if (error != "") yyerror2("JSON.stringify: " + error, GetLineNum());
+    return table.AddTempEntry(Type::VOID);
+  }
+  tableEntry * out_var = table.AddTempEntry(Type::STRING);
+  out_var->SetStringValue(text);
+  return out_var;
+}
+
+// ASTNode_HeapSnapshot
+
+ASTNode_HeapSnapshot::ASTNode_HeapSnapshot(ASTNode * path)
+  : ASTNode(Type::VOID)
+{
+  AddChild(path);
+
+  // Snapshots report where values were allocated, so start recording now.
+  HeapProfile::tracking = true;
+}
+
+tableEntry * ASTNode_HeapSnapshot::Interpret(symbolTable & table)
+{
+  tableEntry * in_var = Operators::Operand(GetChild(0)->Interpret(table));
+  if (!in_var || in_var->GetType() != Type::STRING) {
+    yyerror2("console.heapSnapshot expects a file name", GetLineNum());
+    return NULL;
+  }
+
+  std::string error;
+  if (!HeapProfile::WriteSnapshot(in_var->GetStringValue(), table, error)) {
+    yyerror2("console.heapSnapshot: " + error, GetLineNum());
+  }
+  return NULL;
+}
+
+// ASTNode_Worker
+
+int ASTNode_Worker::LookupFunction(const std::string & name)
+{
+  if (name == "Worker") return START;
+  if (name == "postMessage") return POST;
+  if (name == "receiveMessage") return RECEIVE;
+  if (name == "closeWorker") return CLOSE;
+  return UNKNOWN;
+}
+
+bool ASTNode_Worker::CheckArgCount(int function, int num_args)
+{
+  switch (function) {
+    case START: case CLOSE: return num_args == 1;
+    case POST: return num_args == 1 || num_args == 2;
+    case RECEIVE: return num_args == 0 || num_args == 1;
+  }
+  return false;
+}
+
+ASTNode_Worker::ASTNode_Worker(int function)
+  : ASTNode(Type::VOID), function(function)
+{
+}
+
+// The worker named by the first argument, or PARENT if there is none (and
+// the call takes one without it).  Not a worker id if it is not a number.
+int ASTNode_Worker::GetWorkerId(symbolTable & table)
+{
+  bool named = function == POST ? GetNumChildren() == 2 : GetNumChildren() == 1;
+  if (!named) return Workers::PARENT;
+
+  tableEntry * in_var = Operators::Operand(GetChild(0)->Interpret(table));
+  if (!in_var || in_var->GetType() != Type::NUMBER) return -1;
+  return (int) in_var->GetNumberValue();
+}
+
+// A string computed for the message, rather than read from where the script
+// keeps it, can be moved into the message instead of copied.
+static bool IsFreshString(ASTNode * node)
+{
+  return dynamic_cast<ASTNode_Math2 *>(node) || dynamic_cast<ASTNode_StringCast *>(node) ||
+         dynamic_cast<ASTNode_Join *>(node) || dynamic_cast<ASTNode_Json *>(node) ||
+         dynamic_cast<ASTNode_Call *>(node) || dynamic_cast<ASTNode_Literal *>(node);
+}
+
+tableEntry * ASTNode_Worker::Interpret(symbolTable & table)
+{
+  std::string error;
+
+  if (function == START) {
+    tableEntry * path = Operators::Operand(GetChild(0)->Interpret(table));
+    if (!path || path->GetType() != Type::STRING) {
+      yyerror2("Worker expects the path of a script", GetLineNum());
+      return NULL;
+    }
+    int id = Workers::Start(path->GetStringValue(), error);
+    if (!id) {
+      yyerror2("Worker: " + error, GetLineNum());
+      return NULL;
+    }
+    tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+    out_var->SetNumberValue(id);
+    return out_var;
+  }
+
+  int id = GetWorkerId(table);
+  if (function == POST) {
+    ASTNode * value_node = GetChild(GetNumChildren() - 1);
+    tableEntry * value = value_node->Interpret(table);
+    if (!Workers::Post(id, value, IsFreshString(value_node), error)) {
+      yyerror2("postMessage: " + error, GetLineNum());
+    }
+    return NULL;
+  }
+
+  if (function == CLOSE) {
+    if (!Workers::Close(id, error)) yyerror2("closeWorker: " + error, GetLineNum());
+    return NULL;
+  }
+
+  // Once the sender is done, what is left to receive is undefined.
+  tableEntry * out_var = Workers::Receive(id, table, error);
+  if (error != "") yyerror2("receiveMessage: " + error, GetLineNum());
+  if (!out_var) out_var = table.AddTempEntry(Type::VOID);
+  return out_var;
+}
+
+// ASTNode_Async
+
+int ASTNode_Async::LookupFunction(const std::string & name)
+{
+  if (name == "setTimeout") return SET_TIMEOUT;
+  if (name == "clearTimeout") return CLEAR_TIMEOUT;
+  if (name == "readFile") return READ_FILE;
+  if (name == "writeFile") return WRITE_FILE;
+  return UNKNOWN;
+}
+
+bool ASTNode_Async::CheckArgCount(int function, int num_args)
+{
+  switch (function) {
+    case SET_TIMEOUT: case WRITE_FILE: return num_args == 2 || num_args == 3;
+    case CLEAR_TIMEOUT: return num_args == 1;
+    case READ_FILE: return num_args == 2;
+  }
+  return false;
+}
+
+ASTNode_Async::ASTNode_Async(int function)
+  : ASTNode(Type::VOID), function(function)
+{
+}
+
+// The function passed as argument child, or NULL (reported) if it is not one.
+ASTNode_Function * ASTNode_Async::GetCallback(symbolTable & table, int child)
+{
+  tableEntry * callback = Operators::Operand(GetChild(child)->Interpret(table));
+  if (!callback || callback->GetType() != Type::FUNCTION) {
+    yyerror2("callback is not a function", GetLineNum());
+    return NULL;
+  }
+  return callback->GetFunction();
+}
+
+// The string passed as argument child; false (reported) if it is not one.
+bool ASTNode_Async::GetString(symbolTable & table, int child, std::string & value)
+{
+  tableEntry * in_var = Operators::Operand(GetChild(child)->Interpret(table));
+  if (!in_var || in_var->GetType() != Type::STRING) {
+    yyerror2(child == 0 ? "expected the path of a file" : "expected a string", GetLineNum());
+    return false;
+  }
+  value = in_var->GetStringValue();
+  return true;
+}
+
+tableEntry * ASTNode_Async::Interpret(symbolTable & table)
+{
+  if (function == SET_TIMEOUT) {
+    ASTNode_Function * callback = GetCallback(table, 0);
+    tableEntry * delay = Operators::Operand(GetChild(1)->Interpret(table));
+    if (!callback) return NULL;
+    if (!delay || delay->GetType() != Type::NUMBER) {
+      yyerror2("setTimeout expects a delay in milliseconds", GetLineNum());
+      return NULL;
+    }
+
+    // The argument is passed as it is now, like any other.
+    tableEntry * arg = NULL;
+    if (GetNumChildren() == 3) {
+      tableEntry * value = GetChild(2)->Interpret(table);
+      arg = table.AddTempEntry(Type::VOID);
+      if (value) CopyValue(arg, value);
+    }
+
+    tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+    out_var->SetNumberValue(EventLoop::SetTimeout(callback, arg, delay->GetNumberValue(),
+                                                  GetLineNum()));
+    return out_var;
+  }
+
+  if (function == CLEAR_TIMEOUT) {
+    tableEntry * id = Operators::Operand(GetChild(0)->Interpret(table));
+    if (id && id->GetType() == Type::NUMBER) EventLoop::ClearTimeout((int) id->GetNumberValue());
+    return NULL;
+  }
+
+  std::string path;
+  if (!GetString(table, 0, path)) return NULL;
+
+  if (function == READ_FILE) {
+    ASTNode_Function * callback = GetCallback(table, 1);
+    if (callback) EventLoop::ReadFile(path, callback, GetLineNum());
+    return NULL;
+  }
+
+  std::string text;
+  if (!GetString(table, 1, text)) return NULL;
+  ASTNode_Function * callback = NULL;
+  if (GetNumChildren() == 3 && !(callback = GetCallback(table, 2))) return NULL;
+  EventLoop::WriteFile(path, text, callback, GetLineNum());
+  return NULL;
+}
+
+// ASTNode_FileRead
+
+int ASTNode_FileRead::LookupFunction(const std::string & name)
+{
+  if (name == "openFile") return OPEN;
+  if (name == "readLine") return READ_LINE;
+  if (name == "readChunk") return READ_CHUNK;
+  if (name == "closeFile") return CLOSE;
+  return UNKNOWN;
+}
+
+bool ASTNode_FileRead::CheckArgCount(int function, int num_args)
+{
+  return num_args == (function == READ_CHUNK ? 2 : 1);
+}
+
+ASTNode_FileRead::ASTNode_FileRead(int function)
+  : ASTNode(Type::VOID), function(function)
+{
+}
+
+tableEntry * ASTNode_FileRead::Interpret(symbolTable & table)
+{
+  static const char * names[] = { "openFile", "readLine", "readChunk", "closeFile" };
+  std::string error;
+
+  tableEntry * in_var = Operators::Operand(GetChild(0)->Interpret(table));
+  if (function == OPEN) {
+    if (!in_var || in_var->GetType() != Type::STRING) {
+      yyerror2("openFile expects the path of a file", GetLineNum());
+      return table.AddTempEntry(Type::NLL);
+    }
+    int id = FileReader::Open(in_var->GetStringValue(), error);
+    if (!id) {
+      yyerror2("openFile: " + error, GetLineNum());
+      return table.AddTempEntry(Type::NLL);
+    }
+    tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+    out_var->SetNumberValue(id);
+    return out_var;
+  }
+
+  int id = in_var && in_var->GetType() == Type::NUMBER ? (int) in_var->GetNumberValue() : 0;
+  if (function == CLOSE) {
+    if (!FileReader::Close(id, error)) yyerror2("closeFile: " + error, GetLineNum());
+    return NULL;
+  }
+
+  tableEntry * out_var;
+  if (function == READ_LINE) {
+    out_var = FileReader::ReadLine(id, table, error);
+  }
+  else {
+    tableEntry * size = Operators::Operand(GetChild(1)->Interpret(table));
+    if (!size || size->GetType() != Type::NUMBER || !(size->GetNumberValue() >= 1)) {
+      yyerror2("readChunk expects a size of at least one byte", GetLineNum());
+      return table.AddTempEntry(Type::NLL);
+    }
+    out_var = FileReader::ReadChunk(id, (size_t) size->GetNumberValue(), table, error);
+  }
+
+  // The end of the file reads as null.
+  if (error != "") yyerror2(std::string(names[function]) + ": " + error, GetLineNum());
+  if (!out_var) out_var = table.AddTempEntry(Type::NLL);
+  return out_var;
+}
+
+// ASTNode_Function
+
+ASTNode_Function::ASTNode_Function(tableEntry * in_entry, std::string in_name,
+    int in_params, int in_frame)
+  : ASTNode(Type::FUNCTION), var_entry(in_entry), name(in_name),
+    num_params(in_params), frame_size(in_frame)
+{
+  var_entry->SetType(Type::FUNCTION);
+  var_entry->SetFunction(this);
+}
+
+tableEntry * ASTNode_Function::Interpret(symbolTable & table)
+{
+  // Declaring has no run-time effect; the function was bound when parsed.
+  return NULL;
+}
+
+tableEntry * ASTNode_Function::Run(symbolTable & table, int base,
+    tableEntry * out_var)
+{
+  int old_base = table.EnterFrame(base);
+  if (GetNumChildren() > 0) GetChild(0)->Interpret(table);
+
+  tableEntry * value = NULL;
+  if (table.GetCompletion() == symbolTable::RETURN) {
+    value = table.GetReturnValue();
+    table.SetCompletion(symbolTable::NORMAL);
+  }
+
+  // A returned primitive may live in the frame being released, so copy it to
+  // out_var.  Objects and arrays are returned as they are.
+  if (value && value->GetType() != Type::OBJECT && value->GetType() != Type::ARRAY &&
+      value->GetType() != Type::TYPED_ARRAY) {
+    CopyValue(out_var, value);
+    value = out_var;
+  }
+
+  table.LeaveFrame(old_base, base);
+  return value;
+}
+
+tableEntry * ASTNode_Function::Invoke(symbolTable & table, tableEntry ** args,
+    int num_args, tableEntry * out_var, int line)
+{
+  int base = table.ReserveFrame(frame_size);
+  if (base < 0) {
+    yyerror2("maximum call stack size exceeded", line);
+    AbortScript();
+  }
+
+  for (int i = 0; i < num_args && i < num_params; i++) {
+    if (args[i]) CopyValue(table.GetSlot(base + i), args[i]);
+  }
+  return Run(table, base, out_var);
+}
+
+// ASTNode_LocalVariable
+
+tableEntry * ASTNode_LocalVariable::Interpret(symbolTable & table)
+{
+  tableEntry * entry = table.GetLocal(slot);
+  while (entry->GetType() == Type::REFERENCE) entry = entry->GetReference();
+  return entry;
+}
+
+// ASTNode_Call
+
+ASTNode_Call::ASTNode_Call(std::string in_name, tableEntry * in_entry, int in_slot)
+  : ASTNode(Type::VOID), callee_name(in_name),
+    callee_atom(atom_table.Intern(in_name)), callee_entry(in_entry),
+    callee_slot(in_slot), result(NULL)
+{
+}
+
+ASTNode_Function * ASTNode_Call::ResolveCallee(symbolTable & table)
+{
+  tableEntry * callee;
+  if (callee_slot >= 0) {
+    callee = table.GetLocal(callee_slot);
+  }
+  else {
+    if (!callee_entry) callee_entry = table.Lookup(callee_atom);
+    callee = callee_entry;
+  }
+
+  while (callee && callee->GetType() == Type::REFERENCE) {
+    callee = callee->GetReference();
+  }
+
+  if (!callee || callee->GetType() != Type::FUNCTION) {
+    yyerror2("'" + callee_name + "' is not a function", GetLineNum());
+    return NULL;
+  }
+  return callee->GetFunction();
+}
+
+tableEntry * ASTNode_Call::Interpret(symbolTable & table)
+{
+  ASTNode_Function * func = ResolveCallee(table);
+  if (!func) return NULL;
+
+  // Claim the callee's frame before evaluating the arguments, so calls made
+  // while evaluating them stack above it.
+  int base = table.ReserveFrame(func->GetFrameSize());
+  if (base < 0) {
+    yyerror2("maximum call stack size exceeded", GetLineNum());
+    AbortScript();
+  }
+
+  for (int i = 0; i < GetNumChildren(); i++) {
+    tableEntry * arg = GetChild(i)->Interpret(table);
+    if (i < func->GetNumParams() && arg) CopyValue(table.GetSlot(base + i), arg);
+  }
+
+  // The result goes in the caller's frame, or in this node at top level.
+  tableEntry * out_var = ResultEntry(table, result, Type::VOID);
+
+  // Allocations after the call belong to this line again.
+  tableEntry * return_var = func->Run(table, base, out_var);
+  HeapProfile::SetLine(GetLineNum());
+  return return_var;
+}
+
+ASTNode_Function * ASTNode_Call::GetStaticCallee(symbolTable & table)
+{
+  if (callee_slot >= 0 || result_slot < 0) return NULL;
+  if (!callee_entry) callee_entry = table.Lookup(callee_atom);
+
+  tableEntry * callee = callee_entry;
+  while (callee && callee->GetType() == Type::REFERENCE) {
+    callee = callee->GetReference();
+  }
+  if (!callee || callee->GetType() != Type::FUNCTION) return NULL;
+  return callee->GetFunction();
+}
+
+// ASTNode_Return
+
+ASTNode_Return::ASTNode_Return(ASTNode * value)
+  : ASTNode(Type::VOID)
+{
+  if (value) AddChild(value);
+}
+
+tableEntry * ASTNode_Return::Interpret(symbolTable & table)
+{
+  tableEntry * value = NULL;
+  if (GetNumChildren() > 0) value = GetChild(0)->Interpret(table);
+
+  table.SetReturnValue(value);
+  table.SetCompletion(symbolTable::RETURN);
+  return NULL;
+}
+
+// ASTNode_ArrayMethod
+
+int ASTNode_ArrayMethod::LookupMethod(const std::string & name)
+{
+  if (name == "map") return MAP;
+  if (name == "filter") return FILTER;
+  if (name == "reduce") return REDUCE;
+  if (name == "forEach") return FOR_EACH;
+  if (name == "parallelMap") return PARALLEL_MAP;
+  if (name == "parallelFilter") return PARALLEL_FILTER;
+  if (name == "parallelReduce") return PARALLEL_REDUCE;
+  return UNKNOWN;
+}
+
+bool ASTNode_ArrayMethod::CheckArgCount(int method, int num_args)
+{
+  // reduce takes an optional initial value
+  if (method == REDUCE || method == PARALLEL_REDUCE) {
+    return num_args == 1 || num_args == 2;
+  }
+  return num_args == 1;
+}
+
+ASTNode_ArrayMethod::ASTNode_ArrayMethod(ASTNode * in, int method)
+  : ASTNode(Type::VOID), method(method)
+{
+  AddChild(in);
+}
+
+// Can node run on several threads at once?  Callbacks of the parallel
+// builtins may only assign to their own locals and must not print, change
+// arrays or objects, or call anything that does.  Nodes of other kinds keep
+// per-node state while they run, so they are not allowed either.
+static bool IsParallelSafe(ASTNode * node, symbolTable & table,
+                           std::set<ASTNode_Function *> & checked)
+{
+  if (!node) return true;
+
+  if (ASTNode_Function * func = dynamic_cast<ASTNode_Function *>(node)) {
+    // Already checked, or being checked further up a recursive call.
+    if (checked.count(func)) return true;
+    checked.insert(func);
+  }
+  else if (ASTNode_Call * call = dynamic_cast<ASTNode_Call *>(node)) {
+    ASTNode_Function * callee = call->GetStaticCallee(table);
+    if (!callee || !IsParallelSafe(callee, table, checked)) return false;
+  }
+  else if (dynamic_cast<ASTNode_Assign *>(node)) {
+    if (!dynamic_cast<ASTNode_LocalVariable *>(node->GetChild(0))) return false;
+  }
+  else if (ASTNode_Math1 * math = dynamic_cast<ASTNode_Math1 *>(node)) {
+    if (math->GetOp() != '-' &&
+        !dynamic_cast<ASTNode_LocalVariable *>(math->GetChild(0))) return false;
+  }
+  else if (!dynamic_cast<ASTNode_Block *>(node) &&
+           !dynamic_cast<ASTNode_Literal *>(node) &&
+           !dynamic_cast<ASTNode_Variable *>(node) &&
+           !dynamic_cast<ASTNode_LocalVariable *>(node) &&
+           !dynamic_cast<ASTNode_Property *>(node) &&
+           !dynamic_cast<ASTNode_Math2 *>(node) &&
+           !dynamic_cast<ASTNode_Comparison *>(node) &&
+           !dynamic_cast<ASTNode_Bool1 *>(node) &&
+           !dynamic_cast<ASTNode_Bool2 *>(node) &&
+           !dynamic_cast<ASTNode_Bitwise1 *>(node) &&
+           !dynamic_cast<ASTNode_Bitwise2 *>(node) &&
+           !dynamic_cast<ASTNode_NumberCast *>(node) &&
+           !dynamic_cast<ASTNode_BoolCast *>(node) &&
+           !dynamic_cast<ASTNode_StringCast *>(node) &&
+           !dynamic_cast<ASTNode_TypeOf *>(node) &&
+           !dynamic_cast<ASTNode_Void *>(node) &&
+           !dynamic_cast<ASTNode_If *>(node) &&
+           !dynamic_cast<ASTNode_While *>(node) &&
+           !dynamic_cast<ASTNode_For *>(node) &&
+           !dynamic_cast<ASTNode_Break *>(node) &&
+           !dynamic_cast<ASTNode_Continue *>(node) &&
+           !dynamic_cast<ASTNode_Return *>(node)) {
+    return false;
+  }
+
+  for (int i = 0; i < node->GetNumChildren(); i++) {
+    if (!IsParallelSafe(node->GetChild(i), table, checked)) return false;
+  }
+  return true;
+}
+
+// The elements an array builtin walks over: the entries of an array in
+// index order, or the numbers in a typed array.
+struct arrayElements {
+  typedArray * typed;
+  std::vector<unsigned int> indices;
+  std::vector<tableEntry *> values;
+
+  int GetSize() const { return typed ? (int) typed->GetLength() : (int) values.size(); }
+  unsigned int GetIndex(int pos) const { return typed ? pos : indices[pos]; }
+
+  // Typed array elements are loaded into scratch, an entry of the caller's.
+  tableEntry * GetValue(int pos, tableEntry * scratch) const {
+    if (!typed) return values[pos];
+    scratch->SetType(Type::NUMBER);
+    scratch->SetNumberValue(typed->GetElement(pos));
+    return scratch;
+  }
+};
+
+// One run of an array builtin, shared by the threads working on it.  Each
+// task handles a contiguous range of elements and its results are merged in
+// element order afterwards.
+struct arrayMethodRun {
+  int method;                           // MAP, FILTER, REDUCE or FOR_EACH
+  int line;
+  ASTNode_Function * callback;
+  arrayElements elements;
+  int num_tasks;
+  std::vector<symbolTable *> tables;    // One per thread; 0 is the caller's
+
+  std::vector<tableEntry *> mapped;     // map over an array: one per element
+  typedArray * mapped_typed;            // map over a typed array
+  std::vector<std::vector<int> > kept;  // filter: kept positions, per task
+  std::vector<tableEntry *> partials;   // reduce: result of each task
+  std::vector<char> has_partial;       // Not vector<bool>: tasks write it concurrently
+  std::atomic<bool> aborted;            // A callback hit a fatal error
+
+  int GetStart(int task) const {
+    return (int) ((long long) elements.GetSize() * task / num_tasks);
+  }
+};
+
+// Fold elements [start, end) into acc with the reduce callback.  If have_acc
+// is false the first element is the starting value.
+static tableEntry * ReduceRange(arrayMethodRun & run, symbolTable & table,
+    int start, int end, tableEntry * acc, bool & have_acc)
+{
+  tableEntry * scratch = table.AddTempEntry(Type::NUMBER);
+  tableEntry * index_var = table.AddTempEntry(Type::NUMBER);
+  tableEntry * acc_var = table.AddTempEntry(Type::VOID);
+
+  for (int pos = start; pos < end; pos++) {
+    tableEntry * value = run.elements.GetValue(pos, scratch);
+    if (!have_acc) {
+      CopyValue(acc_var, value);
+      acc = acc_var;
+      have_acc = true;
+      continue;
+    }
+
+    index_var->SetNumberValue(run.elements.GetIndex(pos));
+    tableEntry * args[3] = { acc, value, index_var };
+    acc = run.callback->Invoke(table, args, 3, acc_var, run.line);
+    if (table.GetCompletion() == symbolTable::HALT) break;
+  }
+  return acc;
+}
+
+// Run the map, filter or forEach callback over elements [start, end).
+static void CallbackRange(arrayMethodRun & run, symbolTable & table, int task,
+    int start, int end)
+{
+  tableEntry * scratch = table.AddTempEntry(Type::NUMBER);
+  tableEntry * index_var = table.AddTempEntry(Type::NUMBER);
+  tableEntry * out_var = table.AddTempEntry(Type::VOID);
+
+  for (int pos = start; pos < end; pos++) {
+    // Mapped array elements keep the entry they were returned in.
+    if (run.method == ASTNode_ArrayMethod::MAP && !run.mapped_typed) {
+      out_var = table.AddTempEntry(Type::VOID);
+    }
+
+    index_var->SetNumberValue(run.elements.GetIndex(pos));
+    tableEntry * args[2] = { run.elements.GetValue(pos, scratch), index_var };
+    tableEntry * result = run.callback->Invoke(table, args, 2, out_var, run.line);
+    if (table.GetCompletion() == symbolTable::HALT) break;
+
+    if (run.method == ASTNode_ArrayMethod::MAP) {
+      if (run.mapped_typed) {
+        run.mapped_typed->SetElement(pos, TypedStoreValue(result));
+      }
+      else {
+        if (result && result != out_var) CopyValue(out_var, result);
+        run.mapped[pos] = out_var;
+      }
+    }
+    else if (run.method == ASTNode_ArrayMethod::FILTER) {
+      if (IsTruthy(result)) run.kept[task].push_back(pos);
+    }
+  }
+}
+
+static void ArrayMethodTask(void * data, int task, int thread_id)
+{
+  arrayMethodRun & run = *(arrayMethodRun *) data;
+  symbolTable & table = *run.tables[thread_id];
+  int start = run.GetStart(task);
+  int end = run.GetStart(task + 1);
+
+  // A fatal error cannot unwind the pool's threads, so it is recorded here,
+  // the remaining tasks are skipped and the caller aborts afterwards.
+  if (run.aborted) return;
+  in_parallel_task = true;
+  try {
+    if (run.method == ASTNode_ArrayMethod::REDUCE) {
+      bool have_acc = false;
+      run.partials[task] = ReduceRange(run, table, start, end, NULL, have_acc);
+      run.has_partial[task] = have_acc;
+    }
+    else {
+      CallbackRange(run, table, task, start, end);
+    }
+  }
+  catch (scriptAborted &) {
+    run.aborted = true;
+  }
+  in_parallel_task = false;
+
+  ast_arena.EndChunk();
+}
+
+tableEntry * ASTNode_ArrayMethod::Interpret(symbolTable & table)
+{
+  tableEntry * in_var = GetChild(0)->Interpret(table);
+  if (!in_var || (in_var->GetType() != Type::ARRAY &&
+                  in_var->GetType() != Type::TYPED_ARRAY)) {
+    yyerror2("expected an array", GetLineNum());
+    return NULL;
+  }
+
+  tableEntry * callback = GetChild(1)->Interpret(table);
+  while (callback && callback->GetType() == Type::REFERENCE) {
+    callback = callback->GetReference();
+  }
+  if (!callback || callback->GetType() != Type::FUNCTION) {
+    yyerror2("callback is not a function", GetLineNum());
+    return NULL;
+  }
+
+  arrayMethodRun run;
+  run.method = method;
+  if (method == PARALLEL_MAP) run.method = MAP;
+  else if (method == PARALLEL_FILTER) run.method = FILTER;
+  else if (method == PARALLEL_REDUCE) run.method = REDUCE;
+  run.line = GetLineNum();
+  run.callback = callback->GetFunction();
+  run.mapped_typed = NULL;
+  run.aborted = false;
+
+  run.elements.typed = NULL;
+  if (in_var->GetType() == Type::TYPED_ARRAY) {
+    run.elements.typed = in_var->GetTypedArray();
+  }
+  else {
+    std::map<unsigned int, tableEntry*> * elements = in_var->GetArray();
+    for (std::map<unsigned int, tableEntry*>::iterator it = elements->begin();
+         it != elements->end(); it++) {
+      run.elements.indices.push_back(it->first);
+      run.elements.values.push_back(it->second);
+    }
+  }
+  int size = run.elements.GetSize();
+
+  // Split the elements across the pool only when there are enough of them to
+  // pay for it and the callback is safe to run concurrently.  The pool is the
+  // main script's; workers are parallel already and run these serially.
+  threadPool * pool = NULL;
+  run.num_tasks = 1;
+  if (method != run.method && size >= PARALLEL_MIN && !Workers::InWorker()) {
+    std::set<ASTNode_Function *> checked;
+    if (IsParallelSafe(run.callback, table, checked)) {
+      pool = &threadPool::Get();
+      run.num_tasks = std::min(pool->GetNumThreads() * 4, size / TASK_MIN);
+      if (run.num_tasks < 2) pool = NULL;
+    }
+  }
+  if (!pool) run.num_tasks = 1;
+
+  // Results
+  tableEntry * out_var = NULL;
+  if (run.method == MAP) {
+    out_var = table.AddTempEntry(in_var->GetType());
+    if (run.elements.typed) {
+      out_var->InitializeTypedArray(run.elements.typed->GetKind(), size);
+      run.mapped_typed = out_var->GetTypedArray();
+    }
+    else {
+      out_var->InitializeArray();
+      run.mapped.resize(size);
+    }
+  }
+  run.kept.resize(run.num_tasks);
+  run.partials.resize(run.num_tasks);
+  run.has_partial.resize(run.num_tasks);
+
+  if (run.method == REDUCE && !pool) {
+    bool have_acc = GetNumChildren() > 2;
+    tableEntry * acc = have_acc ? GetChild(2)->Interpret(table) : NULL;
+    acc = ReduceRange(run, table, 0, size, acc, have_acc);
+    if (!have_acc) {
+      yyerror2("reduce of empty array with no initial value", GetLineNum());
+      return NULL;
+    }
+    return acc;
+  }
+
+  tableEntry * initial = NULL;
+  if (run.method == REDUCE && GetNumChildren() > 2) {
+    initial = GetChild(2)->Interpret(table);
+  }
+
+  if (pool) {
+    // A callback that ran out of budget on an earlier call left its table
+    // halted; start each one afresh.
+    run.tables.push_back(&table);
+    for (int i = 1; i < pool->GetNumThreads(); i++) {
+      symbolTable * worker_table = table.GetParallelTable(i);
+      worker_table->SetCompletion(symbolTable::NORMAL);
+      run.tables.push_back(worker_table);
+    }
+
+    table.SetParallel(true);
+    ast_arena.SetParallel(true);
+    pool->Run(run.num_tasks, ArrayMethodTask, &run);
+    ast_arena.SetParallel(false);
+    table.SetParallel(false);
+
+    // A callback that ran out of budget on a worker stops the caller too.
+    for (int i = 1; i < (int) run.tables.size(); i++) {
+      if (run.tables[i]->GetCompletion() == symbolTable::HALT) {
+        table.SetCompletion(symbolTable::HALT);
+      }
+    }
+  }
+  else {
+    run.tables.push_back(&table);
+    ArrayMethodTask(&run, 0, 0);
+  }
+  if (run.aborted) AbortScript();
+  if (table.GetCompletion() == symbolTable::HALT) return NULL;
+
+  if (run.method == MAP) {
+    if (!run.mapped_typed) {
+      for (int pos = 0; pos < size; pos++) {
+        out_var->SetIndex(run.elements.GetIndex(pos), run.mapped[pos]);
+      }
+    }
+    return out_var;
+  }
+
+  if (run.method == FILTER) {
+    int num_kept = 0;
+    for (int task = 0; task < run.num_tasks; task++) num_kept += run.kept[task].size();
+
+    out_var = table.AddTempEntry(in_var->GetType());
+    if (run.elements.typed) {
+      out_var->InitializeTypedArray(run.elements.typed->GetKind(), num_kept);
+    }
+    else {
+      out_var->InitializeArray();
+    }
+
+    int next = 0;
+    for (int task = 0; task < run.num_tasks; task++) {
+      for (int i = 0; i < (int) run.kept[task].size(); i++) {
+        int pos = run.kept[task][i];
+        if (run.elements.typed) {
+          out_var->GetTypedArray()->SetElement(next++, run.elements.typed->GetElement(pos));
+        }
+        else {
+          out_var->SetIndex(next++, run.elements.values[pos]);
+        }
+      }
+    }
+    return out_var;
+  }
+
+  if (run.method == REDUCE) {
+    // Combine the results of the tasks, in order, with the callback; this
+    // matches a serial reduce when the callback is associative.
+    bool have_acc = GetNumChildren() > 2;
+    tableEntry * acc = initial;
+    tableEntry * acc_var = table.AddTempEntry(Type::VOID);
+    tableEntry * index_var = table.AddTempEntry(Type::NUMBER);
+    for (int task = 0; task < run.num_tasks; task++) {
+      if (!run.has_partial[task]) continue;
+      if (!have_acc) {
+        acc = run.partials[task];
+        have_acc = true;
+        continue;
+      }
+      index_var->SetNumberValue(run.elements.GetIndex(run.GetStart(task)));
+      tableEntry * args[3] = { acc, run.partials[task], index_var };
+      acc = run.callback->Invoke(table, args, 3, acc_var, GetLineNum());
+    }
+    if (!have_acc) {
+      yyerror2("reduce of empty array with no initial value", GetLineNum());
+      return NULL;
+    }
+    return acc;
+  }
+
+  return NULL;
+}
@@ -9,34 +9,84 @@
 
 #include "type_info.h"
 #include "symbol_table.h"
+#include "code_cache.h"
+#include "ast_arena.h"
 
-// The base class for all of the others, with useful virtual functions
+// Thrown by AbortScript() to unwind the script being run.
+struct scriptAborted { };
+
+// Set while this thread runs a task of a parallel array builtin.
+extern thread_local bool in_parallel_task;
+
+// The base class for all of the others, with useful virtual functions.
+// Nodes live in ast_arena; children are stored as arena offsets in an array
+// that is itself in the arena, and the whole tree is freed with the arena.
 class ASTNode {
 protected:
   int type;
   int line_num;
-  std::vector<ASTNode *> children;
+  uint32_t child_refs;      // Arena offset of the child offset array
+  uint32_t num_children;
+  uint32_t child_capacity;
+  int result_slot;          // Frame slot for results in a function body, or -1
 
   void SetType(int new_type) { type = new_type; }
-public:
-  ASTNode(int in_type) : type(in_type), line_num(-1) { ; }
-  virtual ~ASTNode() {
-    for (int i = 0; i < (int) children.size(); i++) delete children[i];
+  uint32_t * GetChildRefs() const { return (uint32_t *) ast_arena.FromRef(child_refs); }
+
+  // The entry to put a result of in_type in.  In a function body the node
+  // has a slot of its own in the frame, so a call allocates nothing, and a
+  // recursive call or another thread running the node has its own frame.
+  // Top-level code never runs re-entrantly, so there a node reuses one entry
+  // (cache) for every result and a loop's scalar temporaries do not pile up.
+  // Either way the entry starts out as in_type and keeps the last result's
+  // type after that.
+  tableEntry * ResultEntry(symbolTable & table, tableEntry *& cache, int in_type) {
+    if (result_slot >= 0 && table.GetCallDepth() > 0) {
+      tableEntry * slot = table.GetLocal(result_slot);
+      if (slot->GetType() == Type::VOID) slot->SetType(in_type);
+      return slot;
+    }
+    if (table.GetCallDepth() > 0 || table.InParallel()) return table.AddTempEntry(in_type);
+    if (!cache) cache = table.AddTempEntry(in_type);
+    return cache;
   }
 
-  int GetType() { return type; }
-  int GetLineNum() { return line_num; }
-  ASTNode * GetChild(int id) { return children[id]; }
-  int GetNumChildren() { return children.size(); }
+  // Does the node put its results in ResultEntry()?
+  virtual bool MakesResult() const { return false; }
+public:
+  ASTNode(int in_type)
+    : type(in_type), line_num(-1), child_refs(0), num_children(0), child_capacity(0)
+    , result_slot(-1) { ; }
+  virtual ~ASTNode() { ; }
+
+  static void * operator new(size_t size) { return ast_arena.Allocate(size); }
+  static void operator delete(void * ptr) { ; }
+
+  int GetType() const { return type; }
+  int GetLineNum() const { return line_num; }
+  ASTNode * GetChild(int id) const {
+    return (ASTNode *) ast_arena.FromRef(GetChildRefs()[id]);
+  }
+  int GetNumChildren() const { return num_children; }
 
   void SetLineNum(int _in) { line_num = _in; }
-  void SetChild(int id, ASTNode * in_node) { children[id] = in_node; }
-  void AddChild(ASTNode * in_child) { children.push_back(in_child); }
+  int GetResultSlot() const { return result_slot; }
+  void SetResultSlot(int slot) { result_slot = slot; }
+
+  // Parse time: give each node under this one that makes results a slot in
+  // the frame of the function being declared.
+  void AssignResultSlots(symbolTable & table);
+  void SetChild(int id, ASTNode * in_node) { GetChildRefs()[id] = ast_arena.ToRef(in_node); }
+  void AddChild(ASTNode * in_child);
   void TransferChildren(ASTNode * in_node);
 
   // Interpret a single node and return information about the
   // variable where the results are saved.  Call children recursively.
   virtual tableEntry * Interpret(symbolTable & table) = 0;
+
+  // Write the node kind and constructor fields for the code cache; the line
+  // number and children are written by codeWriter.
+  virtual void SaveFields(codeWriter & out) const = 0;
 };
 
 
@@ -46,6 +96,10 @@ public:
   ASTNode_TempNode(int in_type) : ASTNode(in_type) { ; }
   ~ASTNode_TempNode() { ; }
   tableEntry * Interpret(symbolTable & table) { return NULL; }
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::TEMP);
+    out.WriteInt(type);
+  }
 };
 
 // Blocks of statements, including the overall program
@@ -53,6 +107,9 @@ class ASTNode_Block : public ASTNode {
 public:
   ASTNode_Block() : ASTNode(Type::VOID) { ; }
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BLOCK);
+  }
 };
 
 // Simple variale usage
@@ -65,34 +122,129 @@ public:
 
   tableEntry * GetVarEntry() { return var_entry; }
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::VARIABLE);
+    out.WriteVar(var_entry);
+  }
 };
 
 // Literals for several types
 class ASTNode_Literal : public ASTNode {
 private:
   std::string lexeme;
+  tableEntry * result;  // See ResultEntry(); not used for objects and arrays
+  uint32_t key_atom;    // Atom of an object literal's key, set by InternKeys()
+
+  // An object literal's boilerplate: an object with its keys in order, the
+  // values of constant properties, and NULL for the others.  Made on first
+  // use; NULL if the literal repeats a key.
+  tableEntry * boilerplate;
+  bool boilerplate_built;
+
+  tableEntry * MakeBoilerplate(symbolTable & table);
+  void BuildObject(symbolTable & table, tableEntry * out_var);
+  bool MakesResult() const { return type != Type::OBJECT && type != Type::ARRAY; }
 public:
   ASTNode_Literal(int in_type);
   ASTNode_Literal(int in_type, std::string in_lex);
+  const std::string & GetLexeme() const { return lexeme; }
+
+  // Intern an object literal's keys, once its children are in place, so
+  // running it (possibly on several threads) only reads the atom table.
+  void InternKeys();
+
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::LITERAL);
+    out.WriteInt(type);
+    out.WriteString(lexeme);
+  }
 };
 
 // Used to access the property or index of a given object or array
 class ASTNode_Property : public ASTNode {
 private:
   bool assignment;
+  uint32_t key_atom;  // Atom of a constant key, or atomTable::NONE if computed
+
+  // Typed array elements are unboxed, so reads are handed back in a single
+  // reusable entry and writes are deferred until the assignment commits them.
+  tableEntry * element;
+  bool typed_target;
+  typedArray * store_array;
+  unsigned int store_pos;
+
+  tableEntry * InterpretTyped(symbolTable & table, typedArray * array);
+  bool MakesResult() const { return true; }  // Typed array reads in parallel callbacks
+  std::string KeyString(tableEntry * index) const;
+  unsigned int ArrayIndex(tableEntry * index) const;
 public:
   ASTNode_Property(ASTNode * obj, ASTNode * index, bool assignment);
   tableEntry * Interpret(symbolTable & table);
+
+  // Find the entry a compound assignment should update, and set current to
+  // the value there now (NULL if there is none).
+  tableEntry * Locate(symbolTable & table, tableEntry *& current);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::PROPERTY);
+    out.WriteInt(assignment);
+  }
+
+  // Write a value into the typed array element selected by the last
+  // Interpret; returns false if this node did not select one.
+  bool CommitTypedStore(tableEntry * value);
 };
 
 // Transfer the value of one table entry to another
 class ASTNode_Assign : public ASTNode {
+protected:
+  enum Targets { VARIABLE_TARGET=0, LOCAL_TARGET, OTHER_TARGET };
+  int target_kind;  // What sort of node the target is
+
+  // The entry to write.  A variable's own entry is written, so assigning to
+  // a variable that refers to an object rebinds it rather than overwriting
+  // the object.
+  tableEntry * Target(symbolTable & table);
 public:
   ASTNode_Assign(ASTNode * lhs, ASTNode * rhs);
-  ~ASTNode_Assign() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::ASSIGN);
+  }
+};
+
+// Assignment of a value that type inference proved is a number to a
+// variable: no typed array store or copy to dispatch.
+class ASTNode_NumberAssign : public ASTNode_Assign {
+public:
+  ASTNode_NumberAssign(ASTNode * lhs, ASTNode * rhs) : ASTNode_Assign(lhs, rhs) { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::NUMBER_ASSIGN);
+  }
+};
+
+// Compound assignment ('+=', '&=', ...).  The target is found once and, for
+// numbers and strings, updated in place instead of through a temp result.
+class ASTNode_CompoundAssign : public ASTNode {
+protected:
+  enum Targets { VARIABLE_TARGET=0, LOCAL_TARGET, PROPERTY_TARGET };
+
+  int assign_op;    // Operator token ('+', '&', LSHIFT, ...)
+  int kernel_op;    // Operators::MathOps entry for assign_op, or -1 if bitwise
+  int target_kind;  // What sort of node the target is
+public:
+  ASTNode_CompoundAssign(ASTNode * lhs, ASTNode * rhs, int op);
+
+  int GetOp() const { return assign_op; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::COMPOUND_ASSIGN);
+    out.WriteInt(assign_op);
+  }
 };
 
 // One-input math operations (unary '-')
@@ -100,77 +252,155 @@ class ASTNode_Math1 : public ASTNode {
 protected:
   int math_op;
   bool prefix;
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Math1(ASTNode * in_child, int op, bool pre = true);
   virtual ~ASTNode_Math1() { ; }
 
+  int GetOp() const { return math_op; }
+
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::MATH1);
+    out.WriteInt(math_op);
+    out.WriteInt(prefix);
+  }
 };
 
 // Two-input math operations ('+', '-', '*', '/', '%')
 class ASTNode_Math2 : public ASTNode {
 protected:
   int math_op;
+  int kernel_op;  // Operators::MathOps entry for math_op
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Math2(ASTNode * in1, ASTNode * in2, int op);
   virtual ~ASTNode_Math2() { ; }
 
+  int GetOp() const { return math_op; }
+
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::MATH2);
+    out.WriteInt(math_op);
+  }
 };
 
 // Comparison operators ('<', '>', '<=', '>=', '==', '!=')
 class ASTNode_Comparison : public ASTNode {
 protected:
   int comp_op;
+  int kernel_op;  // Operators::CompareOps entry for comp_op
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Comparison(ASTNode * in1, ASTNode * in2, int op);
   virtual ~ASTNode_Comparison() { ; }
 
+  int GetOp() const { return comp_op; }
+
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::COMPARISON);
+    out.WriteInt(comp_op);
+  }
+};
+
+// Variants of Math2 and Comparison for operands that type inference
+// (type_infer.h) proved are always numbers: the values are used as they are,
+// with no reference following, conversion or kernel lookup.
+class ASTNode_NumberMath2 : public ASTNode_Math2 {
+public:
+  ASTNode_NumberMath2(ASTNode * in1, ASTNode * in2, int op)
+    : ASTNode_Math2(in1, in2, op) { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::NUMBER_MATH2);
+    out.WriteInt(math_op);
+  }
+};
+
+class ASTNode_NumberComparison : public ASTNode_Comparison {
+public:
+  ASTNode_NumberComparison(ASTNode * in1, ASTNode * in2, int op)
+    : ASTNode_Comparison(in1, in2, op) { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::NUMBER_COMPARISON);
+    out.WriteInt(comp_op);
+  }
 };
 
 // One-input bool operations ('!')
 class ASTNode_Bool1 : public ASTNode {
 protected:
   int bool_op;
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Bool1(ASTNode * in, int op);
   virtual ~ASTNode_Bool1() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BOOL1);
+    out.WriteInt(bool_op);
+  }
 };
 
 // Two-input bool operations ('&&' and '||')
 class ASTNode_Bool2 : public ASTNode {
 protected:
   int bool_op;
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Bool2(ASTNode * in1, ASTNode * in2, int op);
   virtual ~ASTNode_Bool2() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BOOL2);
+    out.WriteInt(bool_op);
+  }
 };
 
 // One-input bitwise operations ('~')
 class ASTNode_Bitwise1 : public ASTNode {
 protected:
   int bitwise_op;
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Bitwise1(ASTNode * in, int op);
   virtual ~ASTNode_Bitwise1() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BITWISE1);
+    out.WriteInt(bitwise_op);
+  }
 };
 
 // Two-input bitwise operations ('&', '|', '^', '<<', '>>', '>>>')
 class ASTNode_Bitwise2 : public ASTNode {
 protected:
   int bitwise_op;
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Bitwise2(ASTNode * in1, ASTNode * in2, int op);
   virtual ~ASTNode_Bitwise2() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BITWISE2);
+    out.WriteInt(bitwise_op);
+  }
 };
 
 // If-conditional node
@@ -180,6 +410,9 @@ public:
   virtual ~ASTNode_If() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::IF);
+  }
 };
 
 // While-loop node
@@ -189,6 +422,9 @@ public:
   virtual ~ASTNode_While() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::WHILE);
+  }
 };
 
 // For loop node
@@ -198,6 +434,9 @@ public:
   virtual ~ASTNode_For() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::FOR);
+  }
 };
 
 // For-in loop node
@@ -207,6 +446,9 @@ public:
   virtual ~ASTNode_ForIn() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::FOR_IN);
+  }
 };
 
 // Break node
@@ -216,6 +458,21 @@ public:
   virtual ~ASTNode_Break() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BREAK);
+  }
+};
+
+// Continue node
+class ASTNode_Continue : public ASTNode {
+public:
+  ASTNode_Continue();
+  virtual ~ASTNode_Continue() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::CONTINUE);
+  }
 };
 
 // Prints each child, and then a new line
@@ -225,6 +482,9 @@ public:
   virtual ~ASTNode_Print() {;}
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::PRINT);
+  }
 };
 
 // Deletes a variable and frees memory
@@ -234,42 +494,69 @@ public:
   virtual ~ASTNode_Delete() {;}
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::DELETE);
+  }
 };
 
 // Casts a variable into a number value
 class ASTNode_NumberCast : public ASTNode {
+private:
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_NumberCast(ASTNode * in);
   virtual ~ASTNode_NumberCast() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::NUMBER_CAST);
+  }
 };
 
 // Casts a variable into a boolean value
 class ASTNode_BoolCast : public ASTNode {
+private:
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_BoolCast(ASTNode * in);
   virtual ~ASTNode_BoolCast() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::BOOL_CAST);
+  }
 };
 
 // Casts a variable into a string value
 class ASTNode_StringCast : public ASTNode {
+private:
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_StringCast(ASTNode * in);
   virtual ~ASTNode_StringCast() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::STRING_CAST);
+  }
 };
 
 // Returns the type of a variable as a string
 class ASTNode_TypeOf : public ASTNode {
+private:
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_TypeOf(ASTNode * in);
   virtual ~ASTNode_TypeOf() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::TYPE_OF);
+  }
 };
 
 // Evaluates the expression and returns undefined
@@ -279,15 +566,24 @@ public:
   virtual ~ASTNode_Void() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::VOID);
+  }
 };
 
 // Join array elements into a string
 class ASTNode_Join : public ASTNode {
+private:
+  tableEntry * result;  // See ResultEntry()
+  bool MakesResult() const { return true; }
 public:
   ASTNode_Join(ASTNode * in, ASTNode * sep);
   virtual ~ASTNode_Join() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::JOIN);
+  }
 };
 
 // Adds an element to the end of the array
@@ -297,6 +593,9 @@ public:
   virtual ~ASTNode_Push() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::PUSH);
+  }
 };
 
 // Removes last element of the array
@@ -306,6 +605,287 @@ public:
   virtual ~ASTNode_Pop() { ; }
 
   tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::POP);
+  }
+};
+
+// Creates a zero-filled typed array ('Float64Array(n)', 'Int32Array(n)')
+class ASTNode_TypedArrayNew : public ASTNode {
+protected:
+  int elem_kind;
+public:
+  ASTNode_TypedArrayNew(ASTNode * length, int kind);
+  virtual ~ASTNode_TypedArrayNew() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::TYPED_ARRAY_NEW);
+    out.WriteInt(elem_kind);
+  }
+};
+
+// Bulk typed array methods ('fill', 'sum', 'min', 'max', 'scale', 'add',
+// 'mul', 'dot'); child 0 is the array and the rest are the arguments.
+class ASTNode_TypedArrayMethod : public ASTNode {
+public:
+  enum Methods { FILL=0, SUM, MIN, MAX, SCALE, ADD, MUL, DOT, UNKNOWN };
+
+  // Map a method name to its id (UNKNOWN if there is no such method).
+  static int LookupMethod(const std::string & name);
+  static int GetArgCount(int method);
+
+protected:
+  int method;
+  tableEntry * result;  // See ResultEntry()
+  typedArray * GetArrayArg(tableEntry * in_var);
+  bool MakesResult() const { return method == SUM || method == MIN || method == MAX || method == DOT; }
+public:
+  ASTNode_TypedArrayMethod(ASTNode * in, int method);
+  virtual ~ASTNode_TypedArrayMethod() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::TYPED_ARRAY_METHOD);
+    out.WriteInt(method);
+  }
+};
+
+// 'JSON.parse(text)' and 'JSON.stringify(value)'; child 0 is the argument.
+class ASTNode_Json : public ASTNode {
+public:
+  enum Methods { PARSE=0, STRINGIFY, UNKNOWN };
+
+  static int LookupMethod(const std::string & name);
+
+protected:
+  int method;
+public:
+  ASTNode_Json(ASTNode * in, int method);
+  virtual ~ASTNode_Json() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::JSON);
+    out.WriteInt(method);
+  }
+};
+
+// The worker builtins 'Worker(path)', 'postMessage([worker,] value)',
+// 'receiveMessage([worker])' and 'closeWorker(worker)'; the children are the
+// arguments.  Workers leave out the worker, meaning the main script.
+class ASTNode_Worker : public ASTNode {
+public:
+  enum Functions { START=0, POST, RECEIVE, CLOSE, UNKNOWN };
+
+  // Map a function name to its id (UNKNOWN if it is not a worker builtin).
+  static int LookupFunction(const std::string & name);
+  static bool CheckArgCount(int function, int num_args);
+
+protected:
+  int function;
+  int GetWorkerId(symbolTable & table);
+public:
+  ASTNode_Worker(int function);
+  virtual ~ASTNode_Worker() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::WORKER);
+    out.WriteInt(function);
+  }
+};
+
+// The event loop builtins 'setTimeout(callback, ms[, arg])',
+// 'clearTimeout(timer)', 'readFile(path, callback)' and
+// 'writeFile(path, text[, callback])'; the children are the arguments.  The
+// callbacks run once the script's top level has finished.
+class ASTNode_Async : public ASTNode {
+public:
+  enum Functions { SET_TIMEOUT=0, CLEAR_TIMEOUT, READ_FILE, WRITE_FILE, UNKNOWN };
+
+  // Map a function name to its id (UNKNOWN if it is not an event loop builtin).
+  static int LookupFunction(const std::string & name);
+  static bool CheckArgCount(int function, int num_args);
+
+protected:
+  int function;
+  ASTNode_Function * GetCallback(symbolTable & table, int child);
+  bool GetString(symbolTable & table, int child, std::string & value);
+public:
+  ASTNode_Async(int function);
+  virtual ~ASTNode_Async() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::ASYNC);
+    out.WriteInt(function);
+  }
+};
+
+// The streaming reader builtins 'openFile(path)', 'readLine(file)',
+// 'readChunk(file, size)' and 'closeFile(file)'; the children are the
+// arguments.
+class ASTNode_FileRead : public ASTNode {
+public:
+  enum Functions { OPEN=0, READ_LINE, READ_CHUNK, CLOSE, UNKNOWN };
+
+  // Map a function name to its id (UNKNOWN if it is not a reader builtin).
+  static int LookupFunction(const std::string & name);
+  static bool CheckArgCount(int function, int num_args);
+
+protected:
+  int function;
+public:
+  ASTNode_FileRead(int function);
+  virtual ~ASTNode_FileRead() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::FILE_READ);
+    out.WriteInt(function);
+  }
+};
+
+// 'console.heapSnapshot(path)': write a snapshot of the live heap to path.
+class ASTNode_HeapSnapshot : public ASTNode {
+public:
+  ASTNode_HeapSnapshot(ASTNode * path);
+  virtual ~ASTNode_HeapSnapshot() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::HEAP_SNAPSHOT);
+  }
+};
+
+// Function declaration; child 0 is the body.  Constructing the node binds
+// the function to its variable, so calls work before the declaration runs.
+class ASTNode_Function : public ASTNode {
+private:
+  tableEntry * var_entry;  // Variable that holds the function
+  std::string name;
+  int num_params;          // Parameters occupy the first slots of the frame
+  int frame_size;          // Slots for parameters, locals and call results
+public:
+  ASTNode_Function(tableEntry * in_entry, std::string in_name,
+                   int in_params = 0, int in_frame = 0);
+  virtual ~ASTNode_Function() { ; }
+
+  const std::string & GetName() const { return name; }
+  int GetNumParams() const { return num_params; }
+  int GetFrameSize() const { return frame_size; }
+  void SetNumParams(int in_params) { num_params = in_params; }
+  void SetFrameSize(int in_frame) { frame_size = in_frame; }
+
+  // Run the body in the frame at base, which the caller reserved and filled
+  // with arguments.  A returned primitive is copied into out_var.
+  tableEntry * Run(symbolTable & table, int base, tableEntry * out_var);
+
+  // Call with arguments that are already evaluated (used by builtins).
+  tableEntry * Invoke(symbolTable & table, tableEntry ** args, int num_args,
+                      tableEntry * out_var, int line);
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::FUNCTION);
+    out.WriteVar(var_entry);
+    out.WriteString(name);
+    out.WriteInt(num_params);
+    out.WriteInt(frame_size);
+  }
+};
+
+// A parameter or 'var' of a function, stored in a slot of its activation
+// record rather than in the symbol table
+class ASTNode_LocalVariable : public ASTNode {
+private:
+  int slot;
+  std::string name;
+public:
+  ASTNode_LocalVariable(int in_slot, std::string in_name)
+    : ASTNode(Type::VOID), slot(in_slot), name(in_name) { ; }
+  virtual ~ASTNode_LocalVariable() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  int GetSlot() const { return slot; }
+  tableEntry * GetSlotEntry(symbolTable & table) const { return table.GetLocal(slot); }
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::LOCAL_VARIABLE);
+    out.WriteInt(slot);
+    out.WriteString(name);
+  }
+};
+
+// Function call; the children are the arguments.  The callee is either a
+// local slot or a global variable; a global that was not yet declared when
+// the call was parsed is looked up on the first call and cached.
+class ASTNode_Call : public ASTNode {
+private:
+  std::string callee_name;
+  uint32_t callee_atom;
+  tableEntry * callee_entry;  // Global holding the callee (NULL until resolved)
+  int callee_slot;            // Local holding the callee, or -1 for a global
+  tableEntry * result;        // See ResultEntry()
+
+  ASTNode_Function * ResolveCallee(symbolTable & table);
+  bool MakesResult() const { return true; }
+public:
+  ASTNode_Call(std::string in_name, tableEntry * in_entry, int in_slot);
+  virtual ~ASTNode_Call() { ; }
+
+  // The callee if it is a global function that can be found without running
+  // anything, for checking callbacks before they run on several threads.
+  ASTNode_Function * GetStaticCallee(symbolTable & table);
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::CALL);
+    out.WriteString(callee_name);
+    out.WriteVar(callee_entry);
+    out.WriteInt(callee_slot);
+  }
+};
+
+// Array builtins that take a callback.  Child 0 is the array (or typed
+// array), child 1 the callback and child 2 the initial value for reduce.  The
+// parallel versions split the elements across the thread pool when the
+// callback has no side effects, and otherwise run like the plain ones.
+class ASTNode_ArrayMethod : public ASTNode {
+public:
+  enum Methods { MAP=0, FILTER, REDUCE, FOR_EACH, PARALLEL_MAP, PARALLEL_FILTER,
+                 PARALLEL_REDUCE, UNKNOWN };
+
+  // Map a method name to its id (UNKNOWN if there is no such method).
+  static int LookupMethod(const std::string & name);
+  static bool CheckArgCount(int method, int num_args);
+
+  static const int PARALLEL_MIN = 1024;  // Fewer elements always run serially
+  static const int TASK_MIN = 256;       // Fewest elements worth a task
+
+protected:
+  int method;
+public:
+  ASTNode_ArrayMethod(ASTNode * in, int method);
+  virtual ~ASTNode_ArrayMethod() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::ARRAY_METHOD);
+    out.WriteInt(method);
+  }
+};
+
+// Return from the running function; child 0, if present, is the value
+class ASTNode_Return : public ASTNode {
+public:
+  ASTNode_Return(ASTNode * value);
+  virtual ~ASTNode_Return() { ; }
+
+  tableEntry * Interpret(symbolTable & table);
+  void SaveFields(codeWriter & out) const {
+    out.WriteInt(CodeCache::RETURN);
+  }
 };
 
 #endif
@@ -0,0 +1,108 @@
+#ifndef AST_ARENA_H
+#define AST_ARENA_H
+
+#include <stdint.h>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+
+// Storage for the syntax tree.  The arena is one reserved range of address
+// space that nodes are bump-allocated from, so a program's nodes sit next to
+// each other in the order the parser built them, and nodes can refer to each
+// other by 32-bit offsets from the base.  Nodes are never freed one at a
+// time: Release() drops everything allocated after a mark in one shot.
+class astArena {
+private:
+  char * base;      // Start of the reserved range
+  size_t capacity;  // Bytes reserved
+  size_t top;       // Offset of the next free byte
+  int parallel;     // Parallel batches and workers allocating alongside this thread
+
+  // While parallel, each thread bump-allocates from a chunk of its own.
+  static thread_local char * chunk_next;
+  static thread_local char * chunk_end;
+
+  static const size_t ALIGN = 16;
+  static const size_t PAGE = 4096;
+  static const size_t CHUNK = 16384;
+  static const size_t RETURN_MIN = 1 << 20;  // Smallest release given back to the OS
+
+  void OutOfMemory() {
+    std::cerr << "ERROR: out of memory for the syntax tree" << std::endl;
+    exit(1);
+  }
+
+  void * AllocateShared(size_t size) {
+    if ((size_t) (chunk_end - chunk_next) < size) {
+      size_t chunk = size > CHUNK ? size : CHUNK;
+      size_t start = __atomic_fetch_add(&top, chunk, __ATOMIC_RELAXED);
+      if (start + chunk > capacity) OutOfMemory();
+      chunk_next = base + start;
+      chunk_end = chunk_next + chunk;
+    }
+    void * ptr = chunk_next;
+    chunk_next += size;
+    return ptr;
+  }
+
+public:
+  astArena() : base(NULL), capacity(0), top(ALIGN), parallel(0) {
+    // Offsets are 32 bits, so reserve up to 4GB of address space; pages are
+    // only backed by memory once they are used.
+    for (size_t size = (size_t) 1 << 32; size >= ((size_t) 1 << 26); size /= 2) {
+      void * range = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (range != MAP_FAILED) {
+        base = (char *) range;
+        capacity = size;
+        break;
+      }
+    }
+  }
+
+  void * Allocate(size_t size) {
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if (__atomic_load_n(&parallel, __ATOMIC_RELAXED)) return AllocateShared(size);
+    if (top + size > capacity) OutOfMemory();
+    void * ptr = base + top;
+    top += size;
+    return ptr;
+  }
+
+  // Offset 0 is never handed out, so it stands for NULL.
+  uint32_t ToRef(const void * ptr) const {
+    return ptr ? (uint32_t) ((const char *) ptr - base) : 0;
+  }
+  void * FromRef(uint32_t ref) const { return ref ? base + ref : NULL; }
+
+  uint32_t GetMark() const { return (uint32_t) top; }
+
+  // Free everything allocated since mark.  Large releases hand their pages
+  // back to the OS; small ones are simply reused by the next allocations.
+  void Release(uint32_t mark) {
+    // Other threads may hold chunks past the mark.
+    if (__atomic_load_n(&parallel, __ATOMIC_RELAXED)) return;
+
+    size_t keep = (mark + PAGE - 1) & ~(PAGE - 1);
+    size_t used = (top + PAGE - 1) & ~(PAGE - 1);
+    if (used > keep && used - keep >= RETURN_MIN) {
+      madvise(base + keep, used - keep, MADV_DONTNEED);
+    }
+    top = mark;
+  }
+
+  // Free every node at once.
+  void Reset() { Release(ALIGN); }
+
+  // Switch to per-thread chunks while a parallel batch or a worker runs
+  // (calls nest).  Each thread calls EndChunk() when it finishes its part so
+  // no chunk outlives the batch.
+  void SetParallel(bool in_parallel) {
+    __atomic_add_fetch(&parallel, in_parallel ? 1 : -1, __ATOMIC_RELAXED);
+  }
+  void EndChunk() { chunk_next = chunk_end = NULL; }
+};
+
+extern astArena ast_arena;
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef ATOM_TABLE_H
+#define ATOM_TABLE_H
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Interned identifiers and property names.  Each distinct string is given a
+// small integer id (an atom) the first time it is seen, normally while
+// parsing, so the symbol table and property maps can index and compare by
+// integer.  The hash of every atom is computed once and kept alongside it.
+extern void AbortScript();  // Gives up on the current script (v9.y)
+
+class atomTable {
+public:
+  static const uint32_t NONE = 0xffffffff;    // Returned by Find() for unknown names
+  enum FixedAtoms { EMPTY=0, TEMP, LENGTH };  // "", "__TEMP__" and "length"
+
+private:
+  // The text and hash of each atom live in fixed-size chunks that never move,
+  // so GetName() and GetHash() need no lock even while another thread adds
+  // atoms: the atoms a thread can know of are all in place already.
+  static const uint32_t CHUNK_BITS = 10;
+  static const uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+  static const uint32_t MAX_CHUNKS = 1 << 12;  // Four million atoms
+
+  struct chunk {
+    std::string names[CHUNK_SIZE];  // Text of each atom
+    uint32_t hashes[CHUNK_SIZE];    // Hash of each atom's text
+  };
+
+  chunk * chunks[MAX_CHUNKS];
+  uint32_t count;                 // Atoms so far
+  std::vector<uint32_t> slots;    // Atom + 1 for each used slot, 0 if empty
+
+  // While workers run, Find() and Intern() (which read and grow slots) take
+  // the lock.  Only the main thread changes shared, when no worker is running.
+  bool shared;
+  mutable std::mutex lock;
+
+  // Find the slot holding name, or the empty slot where it would go.
+  uint32_t FindSlot(const std::string & name, uint32_t hash) const {
+    uint32_t mask = (uint32_t) slots.size() - 1;
+    uint32_t slot = hash & mask;
+    while (slots[slot] != 0) {
+      uint32_t atom = slots[slot] - 1;
+      if (GetHash(atom) == hash && GetName(atom) == name) break;
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  // Double the index table (keeping it at most half full) and reinsert.
+  void Grow() {
+    size_t new_size = slots.empty() ? 256 : slots.size() * 2;
+    slots.assign(new_size, 0);
+
+    uint32_t mask = (uint32_t) new_size - 1;
+    for (uint32_t atom = 0; atom < count; atom++) {
+      uint32_t slot = GetHash(atom) & mask;
+      while (slots[slot] != 0) slot = (slot + 1) & mask;
+      slots[slot] = atom + 1;
+    }
+  }
+
+  uint32_t FindLocked(const std::string & name) const {
+    if (slots.empty()) return NONE;
+    uint32_t slot = FindSlot(name, Hash(name));
+    return slots[slot] == 0 ? NONE : slots[slot] - 1;
+  }
+
+  uint32_t InternLocked(const std::string & name) {
+    uint32_t hash = Hash(name);
+    if (!slots.empty()) {
+      uint32_t slot = FindSlot(name, hash);
+      if (slots[slot] != 0) return slots[slot] - 1;
+    }
+
+    uint32_t atom = count;
+    if ((atom >> CHUNK_BITS) >= MAX_CHUNKS) {
+      // Atoms are never freed, so a long-running server fails just the
+      // requests that need new names.
+      std::cerr << "ERROR: too many distinct names" << std::endl;
+      AbortScript();
+    }
+    chunk *& last = chunks[atom >> CHUNK_BITS];
+    if (!last) last = new chunk;
+    last->names[atom & (CHUNK_SIZE - 1)] = name;
+    last->hashes[atom & (CHUNK_SIZE - 1)] = hash;
+    count++;
+
+    if (count * 2 > slots.size()) Grow();
+    else slots[FindSlot(name, hash)] = atom + 1;
+    return atom;
+  }
+
+  atomTable(const atomTable &);
+  atomTable & operator=(const atomTable &);
+
+public:
+  atomTable() : chunks(), count(0), shared(false) {
+    Intern("");
+    Intern("__TEMP__");
+    Intern("length");
+  }
+
+  // FNV-1a; cheap and good enough for identifiers.
+  static uint32_t Hash(const std::string & name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name.size(); i++) {
+      hash ^= (unsigned char) name[i];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  uint32_t GetSize() const {
+    if (!shared) return count;
+    std::lock_guard<std::mutex> hold(lock);
+    return count;
+  }
+  const std::string & GetName(uint32_t atom) const {
+    return chunks[atom >> CHUNK_BITS]->names[atom & (CHUNK_SIZE - 1)];
+  }
+  uint32_t GetHash(uint32_t atom) const {
+    return chunks[atom >> CHUNK_BITS]->hashes[atom & (CHUNK_SIZE - 1)];
+  }
+
+  // The atom for name, or NONE if it was never interned.  Only reads, so
+  // parallel callbacks may call it while no thread is interning.
+  uint32_t Find(const std::string & name) const {
+    if (!shared) return FindLocked(name);
+    std::lock_guard<std::mutex> hold(lock);
+    return FindLocked(name);
+  }
+
+  // The atom for name, adding it if it is new.
+  uint32_t Intern(const std::string & name) {
+    if (!shared) return InternLocked(name);
+    std::lock_guard<std::mutex> hold(lock);
+    return InternLocked(name);
+  }
+
+  // Make Find() and Intern() safe to call from several threads at once.
+  void SetShared(bool in_shared) { shared = in_shared; }
+};
+
+extern atomTable atom_table;
+
+#endif
@@ -0,0 +1,118 @@
+#include "budget.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+  typedef std::chrono::steady_clock budgetClock;
+
+  uint64_t step_limit = 0;                    // 0 if unlimited
+  uint64_t time_limit = 0;                    // Milliseconds; 0 if unlimited
+  budgetClock::time_point deadline;
+
+  std::atomic<uint64_t> steps_taken(0);       // Polls counted by every thread
+  std::atomic<int> stop_reason(Budget::RUNNING);
+  std::atomic<bool> interrupted(false);       // Set by Interrupt(), cleared by Reset()
+  std::atomic<bool> shutting_down(false);     // Set by Shutdown()
+  thread_local int refill = Budget::POLL_INTERVAL;  // What countdown last started from
+
+  void Stop(int reason) {
+    int running = Budget::RUNNING;
+    stop_reason.compare_exchange_strong(running, reason);
+  }
+
+};
+
+// Budget
+
+namespace Budget {
+
+  thread_local int countdown = POLL_INTERVAL;
+
+  bool Expired()
+  {
+    // countdown ran from the last refill down to zero (or below).
+    uint64_t steps = steps_taken.fetch_add(refill - countdown, std::memory_order_relaxed) +
+                     (refill - countdown);
+
+    if (stop_reason.load(std::memory_order_relaxed) == RUNNING) {
+      if (Interrupted()) Stop(INTERRUPTED);
+      else if (step_limit && steps > step_limit) Stop(STEPS);
+      else if (time_limit && budgetClock::now() >= deadline) Stop(TIME);
+    }
+
+    // Once stopped, fail every poll.
+    if (stop_reason.load(std::memory_order_relaxed) != RUNNING) {
+      refill = countdown = 0;
+      return true;
+    }
+
+    // Check again at the first step past the limit.
+    refill = POLL_INTERVAL;
+    if (step_limit && step_limit + 1 - steps < (uint64_t) refill) {
+      refill = (int) (step_limit + 1 - steps);
+    }
+    countdown = refill;
+    return false;
+  }
+
+  void SetStepLimit(uint64_t steps)
+  {
+    step_limit = steps;
+    if (steps && steps + 1 < (uint64_t) countdown) refill = countdown = (int) steps + 1;
+  }
+
+  void SetTimeLimit(uint64_t milliseconds)
+  {
+    time_limit = milliseconds;
+    deadline = budgetClock::now() + std::chrono::milliseconds(milliseconds);
+  }
+
+  void Reset()
+  {
+    steps_taken.store(0, std::memory_order_relaxed);
+    interrupted.store(false, std::memory_order_relaxed);
+    stop_reason.store(RUNNING);
+    refill = countdown = POLL_INTERVAL;
+    SetStepLimit(step_limit);
+    SetTimeLimit(time_limit);
+  }
+
+  void Interrupt()
+  {
+    interrupted.store(true, std::memory_order_relaxed);
+  }
+
+  bool Interrupted()
+  {
+    return interrupted.load(std::memory_order_relaxed) ||
+           shutting_down.load(std::memory_order_relaxed);
+  }
+
+  void Shutdown()
+  {
+    shutting_down.store(true, std::memory_order_relaxed);
+  }
+
+  bool ShuttingDown()
+  {
+    return shutting_down.load(std::memory_order_relaxed);
+  }
+
+  int GetStopReason()
+  {
+    return stop_reason.load(std::memory_order_relaxed);
+  }
+
+  const char * DescribeStop(int reason)
+  {
+    switch (reason) {
+      case STEPS: return "step limit exceeded";
+      case TIME: return "time limit exceeded";
+      case INTERRUPTED: return "interrupted";
+    }
+    return "running";
+  }
+
+};
@@ -0,0 +1,48 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+// Execution budgets for untrusted scripts.  The interpreter polls at every
+// loop iteration and block entry; a poll only decrements a per-thread
+// counter, and every POLL_INTERVAL polls the slow path adds up the steps
+// taken, reads the (vDSO) clock and checks for an Interrupt().  Once the
+// budget runs out every later poll fails, and the script unwinds and stops.
+namespace Budget {
+  enum StopReasons { RUNNING=0, STEPS, TIME, INTERRUPTED };
+
+  const int POLL_INTERVAL = 4096;
+
+  extern thread_local int countdown;  // Polls left before the next slow check
+
+  // Slow path of Poll(): true if the script must stop.
+  bool Expired();
+
+  // True if the script must stop now.
+  inline bool Poll() {
+    return --countdown <= 0 && Expired();
+  }
+
+  // Limits; zero means unlimited.  The time limit counts from this call.
+  void SetStepLimit(uint64_t steps);
+  void SetTimeLimit(uint64_t milliseconds);
+
+  // Give the next script a fresh budget with the same limits, forgetting an
+  // Interrupt() of the last one.  A Shutdown() is never forgotten.
+  void Reset();
+
+  // Ask the running script to stop.  Safe to call from any thread, and from
+  // a signal handler.
+  void Interrupt();
+  bool Interrupted();  // Has the running script been asked to stop?
+
+  // Stop the running script and every later one, for SIGINT and SIGTERM.
+  // Safe to call from a signal handler.
+  void Shutdown();
+  bool ShuttingDown();  // Has Shutdown() been called?
+
+  int GetStopReason();
+  const char * DescribeStop(int reason);
+};
+
+#endif
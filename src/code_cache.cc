@@ -0,0 +1,531 @@
+#include "code_cache.h"
+#include "ast.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cache file layout (native byte order; caches are local to one machine):
+//
+//   header   magic "V9CC", format version, engine stamp and source size
+//   source   the script's text, compared in full before the image is used,
+//            since the 64-bit hash that names the file can collide
+//   vars     count, then (type, preloaded, name) for each variable the tree
+//            refers to; preloaded ones come from a startup snapshot
+//   root     the program, one node record at a time in pre-order
+//
+// A node record is a tag (TAG_NULL, TAG_NODE or TAG_SHARED followed by the id
+// of an earlier node), then the node's kind and fields, its line number, its
+// result slot (see ASTNode::ResultEntry()) and its children.  Shared nodes
+// keep the tree's shape exactly as parsed.
+
+namespace {
+
+  const char MAGIC[4] = { 'V', '9', 'C', 'C' };
+  enum Tags { TAG_NULL=0, TAG_NODE, TAG_SHARED };
+
+  struct cacheHeader {
+    char magic[4];
+    uint32_t format_version;
+    uint64_t engine_stamp;
+    uint64_t source_size;
+  };
+
+  // 64-bit FNV-1a over the source text.
+  uint64_t HashSource(const std::string & source) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < source.size(); i++) {
+      hash ^= (unsigned char) source[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  // Identify this build of the engine by the size and modification time of
+  // the running executable, so rebuilding v9 invalidates every cache entry.
+  uint64_t EngineStamp() {
+    struct stat info;
+    if (stat("/proc/self/exe", &info) != 0) return 0;
+    return ((uint64_t) info.st_size << 32) ^ (uint64_t) info.st_mtime;
+  }
+
+  // The executable does not change under a running process, so look once.
+  const uint64_t engine_stamp = EngineStamp();
+
+  // How many children each node constructor takes; the rest are appended
+  // with AddChild.  Returns -1 for an unknown kind.
+  int ConstructorChildren(int kind) {
+    switch (kind) {
+      case CodeCache::TEMP: case CodeCache::BLOCK: case CodeCache::VARIABLE:
+      case CodeCache::LITERAL: case CodeCache::PRINT: case CodeCache::BREAK:
+      case CodeCache::FUNCTION: case CodeCache::LOCAL_VARIABLE:
+      case CodeCache::CALL: case CodeCache::RETURN: case CodeCache::CONTINUE:
+      case CodeCache::WORKER: case CodeCache::ASYNC: case CodeCache::FILE_READ:
+        return 0;
+      case CodeCache::MATH1: case CodeCache::BOOL1: case CodeCache::BITWISE1:
+      case CodeCache::DELETE: case CodeCache::NUMBER_CAST:
+      case CodeCache::BOOL_CAST: case CodeCache::STRING_CAST:
+      case CodeCache::TYPE_OF: case CodeCache::VOID: case CodeCache::POP:
+      case CodeCache::TYPED_ARRAY_NEW: case CodeCache::TYPED_ARRAY_METHOD:
+      case CodeCache::ARRAY_METHOD: case CodeCache::JSON:
+      case CodeCache::HEAP_SNAPSHOT:
+        return 1;
+      case CodeCache::PROPERTY: case CodeCache::ASSIGN: case CodeCache::MATH2:
+      case CodeCache::COMPARISON: case CodeCache::BOOL2:
+      case CodeCache::BITWISE2: case CodeCache::WHILE: case CodeCache::JOIN:
+      case CodeCache::PUSH: case CodeCache::COMPOUND_ASSIGN:
+      case CodeCache::NUMBER_MATH2: case CodeCache::NUMBER_COMPARISON:
+      case CodeCache::NUMBER_ASSIGN:
+        return 2;
+      case CodeCache::IF: case CodeCache::FOR_IN:
+        return 3;
+      case CodeCache::FOR:
+        return 4;
+    }
+    return -1;
+  }
+
+  std::string CachePath(const std::string & dir, uint64_t hash) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.v9c", (unsigned long long) hash);
+    return dir + "/" + name;
+  }
+
+  // Reads a serialized program back out of a (memory mapped) buffer.  Any
+  // malformed input sets failed, and the caller discards the result.
+  class codeReader {
+  private:
+    const char * pos;
+    const char * end;
+    bool failed;
+    std::vector<tableEntry *> vars;
+    std::vector<ASTNode *> nodes;
+
+  public:
+    codeReader(const char * in_start, const char * in_end)
+      : pos(in_start), end(in_end), failed(false) { ; }
+
+    bool Failed() const { return failed; }
+
+    int32_t ReadInt() {
+      int32_t value = 0;
+      if (end - pos < (long) sizeof(value)) { failed = true; return 0; }
+      memcpy(&value, pos, sizeof(value));
+      pos += sizeof(value);
+      return value;
+    }
+
+    std::string ReadString() {
+      int32_t size = ReadInt();
+      if (size < 0 || end - pos < size) { failed = true; return ""; }
+      std::string value(pos, size);
+      pos += size;
+      return value;
+    }
+
+    void ReadVars(symbolTable & table) {
+      int32_t count = ReadInt();
+      for (int32_t i = 0; i < count && !failed; i++) {
+        int32_t type = ReadInt();
+        int32_t preloaded = ReadInt();
+        std::string name = ReadString();
+        if (!preloaded) {
+          vars.push_back(table.AddEntry(type, name));
+          continue;
+        }
+
+        // The script was parsed against a snapshot's global; without the
+        // same global restored now, the image is unusable.
+        tableEntry * entry = table.LookupPreloaded(name);
+        if (!entry) failed = true;
+        vars.push_back(entry);
+      }
+    }
+
+    // Read a variable id; -1 stands for no variable when allow_null is set.
+    tableEntry * ReadVar(bool allow_null) {
+      int32_t var_id = ReadInt();
+      if (allow_null && var_id == -1) return NULL;
+      if (var_id < 0 || var_id >= (int32_t) vars.size()) {
+        failed = true;
+        return NULL;
+      }
+      return vars[var_id];
+    }
+
+    ASTNode * ReadNode();
+  };
+
+  ASTNode * codeReader::ReadNode()
+  {
+    int32_t tag = ReadInt();
+    if (failed || tag == TAG_NULL) return NULL;
+    if (tag == TAG_SHARED) {
+      int32_t id = ReadInt();
+      if (id < 0 || id >= (int32_t) nodes.size() || !nodes[id]) {
+        failed = true;
+        return NULL;
+      }
+      return nodes[id];
+    }
+    if (tag != TAG_NODE) { failed = true; return NULL; }
+
+    // Reserve this node's id now; the writer numbered nodes in pre-order.
+    int id = nodes.size();
+    nodes.push_back(NULL);
+
+    int32_t kind = ReadInt();
+    int32_t field1 = 0, field2 = 0;
+    std::string text;
+    tableEntry * var = NULL;
+
+    switch (kind) {
+      case CodeCache::LITERAL:
+        field1 = ReadInt();
+        text = ReadString();
+        break;
+      case CodeCache::VARIABLE:
+        var = ReadVar(false);
+        break;
+      case CodeCache::FUNCTION:
+        var = ReadVar(false);
+        text = ReadString();
+        field1 = ReadInt();
+        field2 = ReadInt();
+        break;
+      case CodeCache::LOCAL_VARIABLE:
+        field1 = ReadInt();
+        text = ReadString();
+        break;
+      case CodeCache::CALL:
+        text = ReadString();
+        var = ReadVar(true);
+        field1 = ReadInt();
+        break;
+      case CodeCache::MATH1:
+        field1 = ReadInt();
+        field2 = ReadInt();
+        break;
+      case CodeCache::TEMP: case CodeCache::PROPERTY: case CodeCache::MATH2:
+      case CodeCache::COMPARISON: case CodeCache::BOOL1: case CodeCache::BOOL2:
+      case CodeCache::BITWISE1: case CodeCache::BITWISE2:
+      case CodeCache::TYPED_ARRAY_NEW: case CodeCache::TYPED_ARRAY_METHOD:
+      case CodeCache::ARRAY_METHOD: case CodeCache::JSON:
+      case CodeCache::COMPOUND_ASSIGN: case CodeCache::WORKER:
+      case CodeCache::ASYNC: case CodeCache::FILE_READ:
+      case CodeCache::NUMBER_MATH2: case CodeCache::NUMBER_COMPARISON:
+        field1 = ReadInt();
+        break;
+    }
+
+    int32_t line = ReadInt();
+    int32_t result_slot = ReadInt();
+    int32_t num_children = ReadInt();
+    if (num_children < 0 || num_children > end - pos) failed = true;
+
+    std::vector<ASTNode *> c;
+    for (int32_t i = 0; i < num_children && !failed; i++) c.push_back(ReadNode());
+    if (failed) return NULL;
+
+    // Rebuild the node with the same constructor the parser used.
+    int needed = ConstructorChildren(kind);
+    if (needed < 0 || (int) c.size() < needed ||
+        (kind != CodeCache::TYPED_ARRAY_METHOD && kind != CodeCache::ARRAY_METHOD &&
+         needed > 0 && (int) c.size() != needed) ||
+        ((kind == CodeCache::ASSIGN || kind == CodeCache::COMPOUND_ASSIGN) && !c[0])) {
+      failed = true;
+      return NULL;
+    }
+
+    ASTNode * node = NULL;
+    switch (kind) {
+      case CodeCache::TEMP: node = new ASTNode_TempNode(field1); break;
+      case CodeCache::BLOCK: node = new ASTNode_Block(); break;
+      case CodeCache::VARIABLE: node = new ASTNode_Variable(var); break;
+      case CodeCache::LITERAL: node = new ASTNode_Literal(field1, text); break;
+      case CodeCache::PRINT: node = new ASTNode_Print(NULL); break;
+      case CodeCache::BREAK: node = new ASTNode_Break(); break;
+      case CodeCache::CONTINUE: node = new ASTNode_Continue(); break;
+      case CodeCache::PROPERTY: node = new ASTNode_Property(c[0], c[1], field1); break;
+      case CodeCache::ASSIGN: node = new ASTNode_Assign(c[0], c[1]); break;
+      case CodeCache::NUMBER_ASSIGN: node = new ASTNode_NumberAssign(c[0], c[1]); break;
+      case CodeCache::COMPOUND_ASSIGN: node = new ASTNode_CompoundAssign(c[0], c[1], field1); break;
+      case CodeCache::MATH1: node = new ASTNode_Math1(c[0], field1, field2); break;
+      case CodeCache::MATH2: node = new ASTNode_Math2(c[0], c[1], field1); break;
+      case CodeCache::COMPARISON: node = new ASTNode_Comparison(c[0], c[1], field1); break;
+      case CodeCache::NUMBER_MATH2: node = new ASTNode_NumberMath2(c[0], c[1], field1); break;
+      case CodeCache::NUMBER_COMPARISON: node = new ASTNode_NumberComparison(c[0], c[1], field1); break;
+      case CodeCache::BOOL1: node = new ASTNode_Bool1(c[0], field1); break;
+      case CodeCache::BOOL2: node = new ASTNode_Bool2(c[0], c[1], field1); break;
+      case CodeCache::BITWISE1: node = new ASTNode_Bitwise1(c[0], field1); break;
+      case CodeCache::BITWISE2: node = new ASTNode_Bitwise2(c[0], c[1], field1); break;
+      case CodeCache::IF: node = new ASTNode_If(c[0], c[1], c[2]); break;
+      case CodeCache::WHILE: node = new ASTNode_While(c[0], c[1]); break;
+      case CodeCache::FOR: node = new ASTNode_For(c[0], c[1], c[2], c[3]); break;
+      case CodeCache::FOR_IN: node = new ASTNode_ForIn(c[0], c[1], c[2]); break;
+      case CodeCache::DELETE: node = new ASTNode_Delete(c[0]); break;
+      case CodeCache::NUMBER_CAST: node = new ASTNode_NumberCast(c[0]); break;
+      case CodeCache::BOOL_CAST: node = new ASTNode_BoolCast(c[0]); break;
+      case CodeCache::STRING_CAST: node = new ASTNode_StringCast(c[0]); break;
+      case CodeCache::TYPE_OF: node = new ASTNode_TypeOf(c[0]); break;
+      case CodeCache::VOID: node = new ASTNode_Void(c[0]); break;
+      case CodeCache::JOIN: node = new ASTNode_Join(c[0], c[1]); break;
+      case CodeCache::PUSH: node = new ASTNode_Push(c[0], c[1]); break;
+      case CodeCache::POP: node = new ASTNode_Pop(c[0]); break;
+      case CodeCache::TYPED_ARRAY_NEW: node = new ASTNode_TypedArrayNew(c[0], field1); break;
+      case CodeCache::TYPED_ARRAY_METHOD: node = new ASTNode_TypedArrayMethod(c[0], field1); break;
+      case CodeCache::ARRAY_METHOD: node = new ASTNode_ArrayMethod(c[0], field1); break;
+      case CodeCache::JSON: node = new ASTNode_Json(c[0], field1); break;
+      case CodeCache::HEAP_SNAPSHOT: node = new ASTNode_HeapSnapshot(c[0]); break;
+      case CodeCache::WORKER: node = new ASTNode_Worker(field1); break;
+      case CodeCache::ASYNC: node = new ASTNode_Async(field1); break;
+      case CodeCache::FILE_READ: node = new ASTNode_FileRead(field1); break;
+      case CodeCache::FUNCTION: node = new ASTNode_Function(var, text, field1, field2); break;
+      case CodeCache::LOCAL_VARIABLE: node = new ASTNode_LocalVariable(field1, text); break;
+      case CodeCache::CALL: node = new ASTNode_Call(text, var, field1); break;
+      case CodeCache::RETURN: node = new ASTNode_Return(NULL); break;
+    }
+
+    // Variable-length child lists (blocks, prints, object literals, the
+    // arguments of calls and of worker, event loop and reader builtins, function
+    // bodies) are appended after construction.
+    for (size_t i = needed; i < c.size(); i++) node->AddChild(c[i]);
+    if (kind == CodeCache::LITERAL && field1 == Type::OBJECT) {
+      ((ASTNode_Literal *) node)->InternKeys();
+    }
+
+    node->SetLineNum(line);
+    node->SetResultSlot(result_slot);
+    nodes[id] = node;
+    return node;
+  }
+
+};
+
+// codeWriter
+
+void codeWriter::WriteVar(const tableEntry * var)
+{
+  if (!var) {
+    WriteInt(-1);
+    return;
+  }
+
+  std::map<const tableEntry *, uint32_t>::iterator it = var_ids.find(var);
+  if (it != var_ids.end()) {
+    WriteInt(it->second);
+    return;
+  }
+
+  uint32_t id = vars.size();
+  var_ids[var] = id;
+  vars.push_back(var);
+  WriteInt(id);
+}
+
+void codeWriter::WriteNode(const ASTNode * node)
+{
+  if (!node) {
+    WriteInt(TAG_NULL);
+    return;
+  }
+
+  std::map<const ASTNode *, uint32_t>::iterator it = node_ids.find(node);
+  if (it != node_ids.end()) {
+    WriteInt(TAG_SHARED);
+    WriteInt(it->second);
+    return;
+  }
+
+  uint32_t id = node_ids.size();
+  node_ids[node] = id;
+
+  WriteInt(TAG_NODE);
+  node->SaveFields(*this);
+  WriteInt(node->GetLineNum());
+  WriteInt(node->GetResultSlot());
+  WriteInt(node->GetNumChildren());
+  for (int i = 0; i < node->GetNumChildren(); i++) WriteNode(node->GetChild(i));
+}
+
+// Helpers shared by the disk and in-memory tiers
+
+namespace {
+
+  // Images kept by Remember(), most recently used first, and their index by
+  // source hash.  Each image holds its source text, so a colliding hash is
+  // only a miss.
+  struct rememberedImage {
+    uint64_t hash;
+    std::string image;
+  };
+  std::list<rememberedImage> remembered;
+  std::unordered_map<uint64_t, std::list<rememberedImage>::iterator> remembered_index;
+  size_t memory_limit = CodeCache::DEFAULT_MEMORY_LIMIT;
+
+  // Serialize program, header and all, into one cache image.
+  std::string BuildImage(const std::string & source, const ASTNode * program) {
+    codeWriter writer;
+    writer.WriteNode(program);
+
+    // The variable table goes ahead of the nodes so the reader can create
+    // every entry before it meets a reference to one.
+    codeWriter vars;
+    const std::vector<const tableEntry *> & entries = writer.GetVars();
+    vars.WriteInt(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      vars.WriteInt(entries[i]->GetType());
+      vars.WriteInt(entries[i]->GetScope() == symbolTable::PRELOADED);
+      vars.WriteString(entries[i]->GetName());
+    }
+
+    cacheHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.format_version = CodeCache::FORMAT_VERSION;
+    header.engine_stamp = engine_stamp;
+    header.source_size = source.size();
+
+    std::string image((const char *) &header, sizeof(header));
+    image += source;
+    image += vars.GetBody();
+    image += writer.GetBody();
+    return image;
+  }
+
+  // Rebuild the program in an image of this source text, creating its
+  // variables in table.  Returns NULL if the image is stale or damaged.
+  ASTNode * ReadImage(const char * start, size_t size, const std::string & source,
+                      symbolTable & table) {
+    if (size < sizeof(cacheHeader)) return NULL;
+    cacheHeader header;
+    memcpy(&header, start, sizeof(header));
+
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.format_version != CodeCache::FORMAT_VERSION ||
+        header.engine_stamp != engine_stamp ||
+        header.source_size != source.size() ||
+        size - sizeof(header) < source.size() ||
+        memcmp(start + sizeof(header), source.data(), source.size()) != 0) {
+      return NULL;
+    }
+
+    uint32_t mark = ast_arena.GetMark();
+    codeReader reader(start + sizeof(header) + source.size(), start + size);
+    reader.ReadVars(table);
+    ASTNode * program = reader.ReadNode();
+
+    // A damaged image is a cache miss; the parse will replace it.  (Any
+    // variables already created for it are simply never referenced.)
+    if (reader.Failed()) {
+      ast_arena.Release(mark);
+      return NULL;
+    }
+    return program;
+  }
+
+};
+
+// CodeCache
+
+namespace CodeCache {
+
+  ASTNode * Load(const std::string & dir, const std::string & source,
+                 symbolTable & table)
+  {
+    std::string path = CachePath(dir, HashSource(source));
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(cacheHeader)) {
+      close(fd);
+      return NULL;
+    }
+
+    void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    ASTNode * program = ReadImage((const char *) data, info.st_size, source, table);
+    munmap(data, info.st_size);
+    return program;
+  }
+
+  bool Save(const std::string & dir, const std::string & source,
+            const ASTNode * program)
+  {
+    std::string image = BuildImage(source, program);
+
+    // Write to a temporary file and rename it into place, so a concurrent
+    // run never maps a half-written cache file.
+    mkdir(dir.c_str(), 0755);
+    std::string path = CachePath(dir, HashSource(source));
+    std::string temp_path = path + ".tmp." + std::to_string((long long) getpid());
+    FILE * file = fopen(temp_path.c_str(), "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+      unlink(temp_path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void Remember(const std::string & source, const ASTNode * program)
+  {
+    if (memory_limit == 0) return;
+    uint64_t hash = HashSource(source);
+    std::unordered_map<uint64_t, std::list<rememberedImage>::iterator>::iterator it =
+      remembered_index.find(hash);
+    if (it != remembered_index.end()) {
+      remembered.erase(it->second);
+      remembered_index.erase(it);
+    }
+
+    rememberedImage entry;
+    entry.hash = hash;
+    entry.image = BuildImage(source, program);
+    remembered.push_front(entry);
+    remembered_index[hash] = remembered.begin();
+
+    // Drop the least recently used programs.
+    while (remembered.size() > memory_limit) {
+      Trace::Instant("CodeCache evict", "cache");
+      remembered_index.erase(remembered.back().hash);
+      remembered.pop_back();
+    }
+  }
+
+  ASTNode * Recall(const std::string & source, symbolTable & table)
+  {
+    std::unordered_map<uint64_t, std::list<rememberedImage>::iterator>::iterator it =
+      remembered_index.find(HashSource(source));
+    if (it == remembered_index.end()) return NULL;
+
+    // Each run's nodes and variables are freed when it ends, so the program
+    // is rebuilt from the image every time; only the parse is saved.
+    remembered.splice(remembered.begin(), remembered, it->second);
+    const std::string & image = it->second->image;
+    return ReadImage(image.data(), image.size(), source, table);
+  }
+
+  void SetMemoryLimit(size_t programs)
+  {
+    memory_limit = programs;
+    while (remembered.size() > memory_limit) {
+      remembered_index.erase(remembered.back().hash);
+      remembered.pop_back();
+    }
+  }
+
+};
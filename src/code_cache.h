@@ -0,0 +1,71 @@
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class ASTNode;
+class tableEntry;
+class symbolTable;
+
+// The code cache stores the parsed and resolved AST of a script in a compact
+// binary form, so later runs of the same source can skip lexing and parsing.
+namespace CodeCache {
+  // Bump whenever the node kinds or their saved fields change.
+  const uint32_t FORMAT_VERSION = 15;
+
+  // Every node class that can appear in a parsed program.
+  enum NodeKinds { TEMP=0, BLOCK, VARIABLE, LITERAL, PROPERTY, ASSIGN, MATH1,
+                   MATH2, COMPARISON, BOOL1, BOOL2, BITWISE1, BITWISE2, IF,
+                   WHILE, FOR, FOR_IN, BREAK, PRINT, DELETE, NUMBER_CAST,
+                   BOOL_CAST, STRING_CAST, TYPE_OF, VOID, JOIN, PUSH, POP,
+                   TYPED_ARRAY_NEW, TYPED_ARRAY_METHOD, FUNCTION,
+                   LOCAL_VARIABLE, CALL, RETURN, CONTINUE, ARRAY_METHOD,
+                   JSON, HEAP_SNAPSHOT, COMPOUND_ASSIGN, WORKER,
+                   ASYNC, FILE_READ, NUMBER_MATH2, NUMBER_COMPARISON,
+                   NUMBER_ASSIGN };
+
+  // Load the program cached for this source text from dir, creating its
+  // variables in table.  Returns NULL if there is no usable cache entry.
+  ASTNode * Load(const std::string & dir, const std::string & source,
+                 symbolTable & table);
+
+  // Save a freshly parsed program for this source text into dir.
+  bool Save(const std::string & dir, const std::string & source,
+            const ASTNode * program);
+
+  // The same, kept in memory, so a batch or server that runs a script more
+  // than once parses it only once.  Only the most recently used programs are
+  // kept, up to the memory limit (zero keeps none).
+  const size_t DEFAULT_MEMORY_LIMIT = 256;
+  void Remember(const std::string & source, const ASTNode * program);
+  ASTNode * Recall(const std::string & source, symbolTable & table);
+  void SetMemoryLimit(size_t programs);
+};
+
+// Serializes a program.  Each node writes its own kind and constructor
+// fields (ASTNode::SaveFields); the writer handles children, shared nodes
+// and the variables the tree refers to.
+class codeWriter {
+private:
+  std::string body;                                 // Serialized nodes
+  std::map<const ASTNode *, uint32_t> node_ids;     // Nodes already written
+  std::map<const tableEntry *, uint32_t> var_ids;   // Variables already seen
+  std::vector<const tableEntry *> vars;             // Variables in id order
+
+public:
+  void WriteInt(int32_t value) { body.append((const char *) &value, sizeof(value)); }
+  void WriteString(const std::string & value) {
+    WriteInt((int32_t) value.size());
+    body.append(value);
+  }
+  void WriteVar(const tableEntry * var);  // var may be NULL
+  void WriteNode(const ASTNode * node);
+
+  const std::string & GetBody() const { return body; }
+  const std::vector<const tableEntry *> & GetVars() const { return vars; }
+};
+
+#endif
@@ -0,0 +1,346 @@
+#include "event_loop.h"
+#include "ast.h"
+#include "budget.h"
+#include "symbol_table.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+  typedef std::chrono::steady_clock loopClock;
+
+  const int IO_THREADS = 4;            // Operations that can block at once
+  const int POLL_MS = 50;              // Longest wait between checks of the budget
+  const double MAX_DELAY = 1e12;       // Milliseconds; longer timers wait this long
+  const size_t READ_SIZE = 65536;
+
+  class eventLoop;
+
+  // A file operation, filled in with its result by the I/O thread that runs it.
+  struct ioJob {
+    std::shared_ptr<eventLoop> owner;
+    uint64_t generation;               // The owner's generation when it started
+    bool write;
+    std::string path;
+    std::string text;                  // What to write, or what was read
+    std::string error;                 // Empty on success
+    ASTNode_Function * callback;
+    int line;
+  };
+
+  struct timer {
+    ASTNode_Function * callback;
+    tableEntry * arg;
+    int line;
+  };
+
+  // The timers and operations of one script thread.  Only that thread uses
+  // it, except that I/O threads add to finished and signal event_fd.
+  class eventLoop {
+  public:
+    int epoll_fd;
+    int event_fd;                      // Readable once an operation has finished
+
+    std::mutex lock;
+    std::vector<ioJob *> finished;     // Guarded by lock
+    uint64_t generation;               // Bumped (under lock) by Reset()
+
+    int in_flight;                     // Operations of this generation not yet handled
+    int next_timer;
+    std::map<int, timer> timers;       // Pending timers by id
+    std::multimap<loopClock::time_point, int> due;  // Timer ids by due time, in order set
+
+    eventLoop() : generation(0), in_flight(0), next_timer(1) {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.fd = event_fd;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event);
+    }
+    ~eventLoop() {
+      close(event_fd);
+      close(epoll_fd);
+    }
+
+    bool Pending() const { return in_flight > 0 || !timers.empty(); }
+
+    // Called on the I/O thread that ran job.  A job orphaned by Reset() is
+    // dropped here, so it never keeps its loop alive.
+    void Finish(ioJob * job) {
+      bool current;
+      {
+        std::lock_guard<std::mutex> hold(lock);
+        current = job->generation == generation;
+        if (current) finished.push_back(job);
+      }
+      if (!current) {
+        delete job;
+        return;
+      }
+      uint64_t one = 1;
+      ssize_t written = write(event_fd, &one, sizeof(one));
+      (void) written;
+    }
+
+    // Take the finished operations, if any.
+    void TakeFinished(std::vector<ioJob *> & jobs) {
+      uint64_t count;
+      ssize_t got = read(event_fd, &count, sizeof(count));
+      (void) got;
+      std::lock_guard<std::mutex> hold(lock);
+      jobs.swap(finished);
+    }
+  };
+
+  thread_local std::shared_ptr<eventLoop> current_loop;  // Made on first use
+
+  eventLoop & CurrentLoop() {
+    if (!current_loop) current_loop = std::make_shared<eventLoop>();
+    return *current_loop;
+  }
+
+  std::string Describe(const std::string & action, const std::string & path, int err) {
+    return "cannot " + action + " '" + path + "': " + std::generic_category().message(err);
+  }
+
+  void ReadWhole(ioJob & job) {
+    int fd = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      job.error = Describe("read", job.path, errno);
+      return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) job.text.reserve(info.st_size);
+
+    char buffer[READ_SIZE];
+    while (true) {
+      ssize_t got = read(fd, buffer, sizeof(buffer));
+      if (got < 0 && errno == EINTR) continue;
+      if (got < 0) job.error = Describe("read", job.path, errno);
+      if (got <= 0) break;
+      job.text.append(buffer, got);
+    }
+    close(fd);
+  }
+
+  void WriteWhole(ioJob & job) {
+    int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      job.error = Describe("write", job.path, errno);
+      return;
+    }
+    size_t done = 0;
+    while (done < job.text.size()) {
+      ssize_t put = write(fd, job.text.data() + done, job.text.size() - done);
+      if (put < 0 && errno == EINTR) continue;
+      if (put < 0) {
+        job.error = Describe("write", job.path, errno);
+        break;
+      }
+      done += put;
+    }
+    if (close(fd) != 0 && job.error == "") job.error = Describe("write", job.path, errno);
+  }
+
+  // The I/O threads, shared by every loop.  Like the thread pool, they are
+  // started on first use and never stopped or destroyed: they stay parked
+  // until the process exits.
+  struct ioPool {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<ioJob *> queue;
+  };
+  ioPool * io_pool = NULL;
+  std::once_flag io_pool_started;
+
+  void IoThread() {
+    while (true) {
+      ioJob * job;
+      {
+        std::unique_lock<std::mutex> hold(io_pool->lock);
+        while (io_pool->queue.empty()) io_pool->ready.wait(hold);
+        job = io_pool->queue.front();
+        io_pool->queue.pop_front();
+      }
+      if (job->write) WriteWhole(*job);
+      else ReadWhole(*job);
+
+      // Hold the loop, which its thread may give up once the job is handed over.
+      std::shared_ptr<eventLoop> owner = job->owner;
+      owner->Finish(job);
+    }
+  }
+
+  void StartIoThreads() {
+    io_pool = new ioPool;
+    for (int i = 0; i < IO_THREADS; i++) std::thread(IoThread).detach();
+  }
+
+  void Submit(ioJob * job) {
+    eventLoop & loop = CurrentLoop();
+    job->owner = current_loop;
+    job->generation = loop.generation;
+    loop.in_flight++;
+
+    std::call_once(io_pool_started, StartIoThreads);
+    std::lock_guard<std::mutex> hold(io_pool->lock);
+    io_pool->queue.push_back(job);
+    io_pool->ready.notify_one();
+  }
+
+  // Call the callback of a finished operation.
+  void Dispatch(ioJob & job, symbolTable & table, tableEntry * out_var) {
+    if (!job.callback) return;
+
+    bool failed = job.error != "";
+    tableEntry * args[2];
+    args[0] = table.AddTempEntry(failed ? Type::STRING : Type::NLL);
+    if (failed) args[0]->SetStringValue(job.error);
+    int num_args = 1;
+    if (!job.write) {
+      args[1] = table.AddTempEntry(failed ? Type::NLL : Type::STRING);
+      if (!failed) args[1]->SetStringValue(std::move(job.text));
+      num_args = 2;
+    }
+    job.callback->Invoke(table, args, num_args, out_var, job.line);
+  }
+
+  // Milliseconds until the first timer is due, at most POLL_MS.
+  int TimeToWait(eventLoop & loop) {
+    if (loop.due.empty()) return POLL_MS;
+    loopClock::duration left = loop.due.begin()->first - loopClock::now();
+    if (left <= loopClock::duration::zero()) return 0;
+    // Round up, so the timer is due when the wait ends.
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1;
+    return ms < POLL_MS ? (int) ms : POLL_MS;
+  }
+
+};
+
+// EventLoop
+
+namespace EventLoop {
+
+  int SetTimeout(ASTNode_Function * callback, tableEntry * arg, double delay, int line)
+  {
+    eventLoop & loop = CurrentLoop();
+    if (!(delay > 0)) delay = 0;
+    if (delay > MAX_DELAY) delay = MAX_DELAY;
+
+    timer fresh;
+    fresh.callback = callback;
+    fresh.arg = arg;
+    fresh.line = line;
+    int id = loop.next_timer++;
+    loop.timers[id] = fresh;
+    loopClock::time_point when = loopClock::now() +
+        std::chrono::duration_cast<loopClock::duration>(std::chrono::duration<double, std::milli>(delay));
+    loop.due.insert(std::make_pair(when, id));
+    return id;
+  }
+
+  void ClearTimeout(int id)
+  {
+    // Its entry in due is skipped when it comes up.
+    if (current_loop) current_loop->timers.erase(id);
+  }
+
+  void ReadFile(const std::string & path, ASTNode_Function * callback, int line)
+  {
+    ioJob * job = new ioJob;
+    job->write = false;
+    job->path = path;
+    job->callback = callback;
+    job->line = line;
+    Submit(job);
+  }
+
+  void WriteFile(const std::string & path, const std::string & text,
+                 ASTNode_Function * callback, int line)
+  {
+    ioJob * job = new ioJob;
+    job->write = true;
+    job->path = path;
+    job->text = text;
+    job->callback = callback;
+    job->line = line;
+    Submit(job);
+  }
+
+  void Run(symbolTable & table)
+  {
+    if (!current_loop) return;
+    eventLoop & loop = *current_loop;
+
+    tableEntry * out_var = NULL;
+    std::vector<ioJob *> jobs;
+    while (loop.Pending()) {
+      // Waiting takes no steps, so check the clock and for Ctrl-C here.
+      if (table.GetCompletion() == symbolTable::HALT || Budget::Expired()) break;
+      if (!out_var) out_var = table.AddTempEntry(Type::VOID);
+
+      epoll_event event;
+      if (epoll_wait(loop.epoll_fd, &event, 1, TimeToWait(loop)) > 0) {
+        loop.TakeFinished(jobs);
+        for (size_t i = 0; i < jobs.size(); i++) {
+          loop.in_flight--;
+          if (table.GetCompletion() != symbolTable::HALT) Dispatch(*jobs[i], table, out_var);
+          delete jobs[i];
+        }
+        jobs.clear();
+      }
+
+      // Timers set by these callbacks wait for the next pass.
+      loopClock::time_point now = loopClock::now();
+      while (!loop.due.empty() && loop.due.begin()->first <= now &&
+             table.GetCompletion() != symbolTable::HALT) {
+        int id = loop.due.begin()->second;
+        loop.due.erase(loop.due.begin());
+        std::map<int, timer>::iterator found = loop.timers.find(id);
+        if (found == loop.timers.end()) continue;
+
+        timer fired = found->second;
+        loop.timers.erase(found);
+        fired.callback->Invoke(table, &fired.arg, fired.arg ? 1 : 0, out_var, fired.line);
+      }
+    }
+
+    // Anything left was cut off by the budget.
+    Reset();
+  }
+
+  void Reset()
+  {
+    if (!current_loop) return;
+    eventLoop & loop = *current_loop;
+
+    std::vector<ioJob *> orphans;
+    {
+      std::lock_guard<std::mutex> hold(loop.lock);
+      loop.generation++;
+      orphans.swap(loop.finished);
+    }
+    for (size_t i = 0; i < orphans.size(); i++) delete orphans[i];
+
+    loop.in_flight = 0;
+    loop.next_timer = 1;
+    loop.timers.clear();
+    loop.due.clear();
+  }
+
+};
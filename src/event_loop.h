@@ -0,0 +1,46 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <string>
+
+class ASTNode_Function;
+class symbolTable;
+class tableEntry;
+
+// The event loop.  Timers and file operations started by a script only
+// schedule their callbacks; once the script's top level has finished, Run()
+// waits on an epoll set for due timers and finished operations and calls
+// each callback on the script's own thread, until nothing is pending.
+//
+// Files are read and written by a small pool of I/O threads with ordinary
+// blocking calls, so operations overlap with the script and with each other,
+// and pipes and FIFOs work as well as regular files.  A finished operation
+// wakes its loop through an eventfd.  The main script and each worker have a
+// loop of their own.
+namespace EventLoop {
+  // Call callback(arg), or callback() if arg is NULL, once delay milliseconds
+  // have passed; returns the timer's id (from 1).
+  int SetTimeout(ASTNode_Function * callback, tableEntry * arg, double delay, int line);
+
+  // Cancel a timer that has not fired yet.
+  void ClearTimeout(int id);
+
+  // Read the whole file at path, then call callback(error, text).  On
+  // success error is null; otherwise it says what went wrong and text is null.
+  void ReadFile(const std::string & path, ASTNode_Function * callback, int line);
+
+  // Replace the contents of the file at path with text, then call
+  // callback(error) if there is one.
+  void WriteFile(const std::string & path, const std::string & text,
+                 ASTNode_Function * callback, int line);
+
+  // Run callbacks as their timers come due and their operations finish,
+  // until none are pending or the script is stopped.
+  void Run(symbolTable & table);
+
+  // Forget every pending timer and operation, as when a script is aborted.
+  // Operations already running still finish, but their callbacks are dropped.
+  void Reset();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "file_reader.h"
+#include "symbol_table.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+  const size_t BUFFER_SIZE = 1 << 20;  // Grows only for a longer line or chunk
+
+  struct reader {
+    int fd;
+    std::string path;
+    std::vector<char> buffer;
+    size_t begin, end;                 // The unread bytes are buffer[begin, end)
+    bool at_eof;
+    tableEntry * text;                 // Returned by every read, or NULL before the first
+
+    reader(int in_fd, const std::string & in_path)
+      : fd(in_fd), path(in_path), buffer(BUFFER_SIZE), begin(0), end(0)
+      , at_eof(false), text(NULL) { ; }
+    ~reader() { close(fd); }
+
+    // Read more of the file after the unread bytes, moving them to the front
+    // of the buffer (or growing it, if they fill it).  False on an error.
+    bool Fill(std::string & error) {
+      if (begin > 0) {
+        memmove(&buffer[0], &buffer[begin], end - begin);
+        end -= begin;
+        begin = 0;
+      }
+      if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+
+      while (true) {
+        ssize_t got = read(fd, &buffer[end], buffer.size() - end);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+          error = "cannot read '" + path + "': " + std::generic_category().message(errno);
+          at_eof = true;
+          return false;
+        }
+        if (got == 0) at_eof = true;
+        end += got;
+        return true;
+      }
+    }
+
+    // Hand back length bytes from begin in text, reusing its buffer.
+    tableEntry * Take(size_t length, size_t skip, symbolTable & table) {
+      if (!text || text->GetType() != Type::STRING) {
+        text = table.AddTempEntry(Type::STRING);
+        text->SetStringValue("");
+      }
+      text->AssignStringValue(&buffer[begin], length);
+      begin += length + skip;
+      return text;
+    }
+  };
+
+  thread_local std::vector<reader *> readers;  // Open handles by id - 1; NULL once closed
+
+  reader * GetReader(int id, std::string & error) {
+    if (id < 1 || id > (int) readers.size() || !readers[id - 1]) {
+      error = "no such file handle";
+      return NULL;
+    }
+    return readers[id - 1];
+  }
+
+};
+
+// FileReader
+
+namespace FileReader {
+
+  int Open(const std::string & path, std::string & error)
+  {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      error = "cannot open '" + path + "': " + std::generic_category().message(errno);
+      return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    readers.push_back(new reader(fd, path));
+    return (int) readers.size();
+  }
+
+  tableEntry * ReadLine(int id, symbolTable & table, std::string & error)
+  {
+    reader * in = GetReader(id, error);
+    if (!in) return NULL;
+
+    size_t scanned = 0;  // Bytes already known to hold no line ending
+    while (true) {
+      char * start = &in->buffer[in->begin];
+      size_t available = in->end - in->begin;
+      char * newline = (char *) memchr(start + scanned, '\n', available - scanned);
+      if (newline) {
+        size_t length = newline - start;
+        bool crlf = length > 0 && newline[-1] == '\r';
+        return in->Take(length - crlf, 1 + crlf, table);
+      }
+
+      // The last line may have no line ending.
+      if (in->at_eof) return available ? in->Take(available, 0, table) : NULL;
+      scanned = available;
+      if (!in->Fill(error)) return NULL;
+    }
+  }
+
+  tableEntry * ReadChunk(int id, size_t size, symbolTable & table, std::string & error)
+  {
+    reader * in = GetReader(id, error);
+    if (!in) return NULL;
+
+    while (in->end - in->begin < size && !in->at_eof) {
+      if (!in->Fill(error)) return NULL;
+    }
+    size_t available = in->end - in->begin;
+    if (!available) return NULL;
+    return in->Take(available < size ? available : size, 0, table);
+  }
+
+  bool Close(int id, std::string & error)
+  {
+    reader * in = GetReader(id, error);
+    if (!in) return false;
+    delete in;
+    readers[id - 1] = NULL;
+    return true;
+  }
+
+  void CloseAll()
+  {
+    for (size_t i = 0; i < readers.size(); i++) delete readers[i];
+    readers.clear();
+  }
+
+};
@@ -0,0 +1,37 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <string>
+
+class tableEntry;
+class symbolTable;
+
+// Streaming readers for large input files.  openFile(path) gives a handle;
+// readLine and readChunk then return the file's lines (without their line
+// endings) or fixed-size chunks one at a time, and null at the end.
+//
+// Each reader reads the file through one large buffer, refilled with read()
+// as it is used up, and finds line endings with memchr, so memory stays the
+// same however large the file is.  The string it returns is its own entry,
+// overwritten in place by the next line or chunk: nothing is allocated per
+// line.  Assigning it to a variable copies it (into that variable's buffer).
+//
+// Handles belong to the thread that opened them and are closed when its
+// script ends.
+namespace FileReader {
+  // Open the file at path; returns its handle (from 1), or 0 and sets error.
+  int Open(const std::string & path, std::string & error);
+
+  // The next line of handle id, or of at most size bytes, in an entry of
+  // table's that the next read reuses.  Returns NULL at the end of the file,
+  // and also sets error if reading failed or id is not open.
+  tableEntry * ReadLine(int id, symbolTable & table, std::string & error);
+  tableEntry * ReadChunk(int id, size_t size, symbolTable & table, std::string & error);
+
+  bool Close(int id, std::string & error);
+
+  // Close every handle this thread has open.
+  void CloseAll();
+};
+
+#endif
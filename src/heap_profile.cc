@@ -0,0 +1,415 @@
+#include "heap_profile.h"
+#include "symbol_table.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+  struct siteStats {
+    uint64_t count;
+    uint64_t bytes;
+    siteStats() : count(0), bytes(0) { ; }
+  };
+
+  std::mutex lock;                                           // Guards the two maps below
+  std::map<int, siteStats> line_stats;                       // Everything allocated, by line
+  std::unordered_map<const tableEntry *, int> entry_lines;   // Line that created each entry
+
+  // Bytes of one element of an array's std::map (the tree node and its links).
+  const size_t ARRAY_NODE_BYTES =
+    4 * sizeof(void *) + sizeof(std::pair<const unsigned int, tableEntry *>);
+
+  // A variable or stack slot the walk starts from.
+  struct heapRoot {
+    std::string name;
+    const char * kind;
+    const tableEntry * entry;
+  };
+
+  // The reachable graph, numbered in the order values are found, under a
+  // virtual root (node 0) whose children are the roots.
+  class heapGraph {
+  private:
+    symbolTable & table;
+    std::unordered_map<const tableEntry *, int> ids;
+
+  public:
+    std::vector<const tableEntry *> nodes;     // nodes[0] is the virtual root
+    std::vector<std::vector<int> > edges;      // Successors of each node
+    std::vector<std::vector<int> > preds;      // Predecessors of each node
+    std::vector<int> postorder;                // Nodes in depth-first postorder
+    std::vector<int> idom;                     // Immediate dominator of each node
+    std::vector<uint64_t> shallow, retained;
+
+    heapGraph(symbolTable & in_table) : table(in_table) { ; }
+
+    int GetId(const tableEntry * entry) const {
+      std::unordered_map<const tableEntry *, int>::const_iterator it = ids.find(entry);
+      return it == ids.end() ? -1 : it->second;
+    }
+
+    static void Successors(const tableEntry * entry, std::vector<const tableEntry *> & out) {
+      switch (entry->GetType()) {
+        case Type::REFERENCE:
+          if (entry->GetReference()) out.push_back(entry->GetReference());
+          break;
+        case Type::OBJECT: {
+          const propertyMap * props = entry->GetPropertyMap();
+          if (!props) break;
+          for (int i = 0; i < props->GetSize(); i++) {
+            if (props->GetEntry(i).value) out.push_back(props->GetEntry(i).value);
+          }
+          break;
+        }
+        case Type::ARRAY: {
+          const std::map<unsigned int, tableEntry *> * elements = entry->GetArray();
+          if (!elements) break;
+          std::map<unsigned int, tableEntry *>::const_iterator it;
+          for (it = elements->begin(); it != elements->end(); it++) {
+            if (it->second) out.push_back(it->second);
+          }
+          break;
+        }
+      }
+    }
+
+    uint64_t ShallowSize(const tableEntry * entry) const {
+      // Call stack slots are preallocated; only what they point to counts.
+      uint64_t bytes = table.OnStack(entry) ? 0 : sizeof(tableEntry);
+      switch (entry->GetType()) {
+        case Type::STRING:
+          bytes += sizeof(std::string) + entry->GetStringValue().capacity();
+          break;
+        case Type::OBJECT:
+          if (entry->GetPropertyMap()) bytes += entry->GetPropertyMap()->GetBytes();
+          break;
+        case Type::ARRAY:
+          if (entry->GetArray()) {
+            bytes += sizeof(*entry->GetArray()) +
+                     entry->GetArray()->size() * ARRAY_NODE_BYTES;
+          }
+          break;
+        case Type::TYPED_ARRAY:
+          if (entry->GetTypedArray()) bytes += entry->GetTypedArray()->GetBytes();
+          break;
+      }
+      return bytes;
+    }
+
+    // Number every node reachable from the roots and record its edges.
+    void Build(const std::vector<heapRoot> & roots) {
+      nodes.push_back(NULL);
+      edges.push_back(std::vector<int>());
+
+      std::vector<const tableEntry *> next;
+      std::vector<std::pair<int, size_t> > stack;  // Node and its next edge
+      for (size_t i = 0; i < roots.size(); i++) {
+        int id = Visit(roots[i].entry);  // May grow edges
+        edges[0].push_back(id);
+      }
+
+      // Iterative DFS, so deep lists cannot overflow the C++ stack.
+      stack.push_back(std::make_pair(0, (size_t) 0));
+      std::vector<bool> expanded(nodes.size(), false);
+      expanded[0] = true;
+      while (!stack.empty()) {
+        int node = stack.back().first;
+        size_t edge = stack.back().second;
+        if (edge == edges[node].size()) {
+          postorder.push_back(node);
+          stack.pop_back();
+          continue;
+        }
+        stack.back().second++;
+
+        int child = edges[node][edge];
+        if (expanded[child]) continue;
+        expanded[child] = true;
+
+        next.clear();
+        Successors(nodes[child], next);
+        for (size_t i = 0; i < next.size(); i++) {
+          int id = Visit(next[i]);  // May grow edges
+          edges[child].push_back(id);
+          if (expanded.size() < nodes.size()) expanded.resize(nodes.size(), false);
+        }
+        stack.push_back(std::make_pair(child, (size_t) 0));
+      }
+
+      preds.resize(nodes.size());
+      for (int node = 0; node < (int) nodes.size(); node++) {
+        for (size_t i = 0; i < edges[node].size(); i++) preds[edges[node][i]].push_back(node);
+      }
+    }
+
+    int Visit(const tableEntry * entry) {
+      std::unordered_map<const tableEntry *, int>::iterator it = ids.find(entry);
+      if (it != ids.end()) return it->second;
+      int id = (int) nodes.size();
+      ids[entry] = id;
+      nodes.push_back(entry);
+      edges.push_back(std::vector<int>());
+      return id;
+    }
+
+    // Dominators by the iterative algorithm of Cooper, Harvey and Kennedy;
+    // a node's retained size is what would be freed without it.
+    void ComputeRetained() {
+      int num_nodes = (int) nodes.size();
+      std::vector<int> order(num_nodes);  // Postorder position of each node
+      for (int i = 0; i < num_nodes; i++) order[postorder[i]] = i;
+
+      idom.assign(num_nodes, -1);
+      idom[0] = 0;
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for (int i = num_nodes - 2; i >= 0; i--) {  // Reverse postorder, skipping the root
+          int node = postorder[i];
+          int new_idom = -1;
+          for (size_t p = 0; p < preds[node].size(); p++) {
+            int pred = preds[node][p];
+            if (idom[pred] == -1) continue;
+            if (new_idom == -1) { new_idom = pred; continue; }
+
+            // Walk both up the dominator tree until they meet.
+            int a = pred, b = new_idom;
+            while (a != b) {
+              while (order[a] < order[b]) a = idom[a];
+              while (order[b] < order[a]) b = idom[b];
+            }
+            new_idom = a;
+          }
+          if (idom[node] != new_idom) {
+            idom[node] = new_idom;
+            changed = true;
+          }
+        }
+      }
+
+      shallow.assign(num_nodes, 0);
+      for (int node = 1; node < num_nodes; node++) shallow[node] = ShallowSize(nodes[node]);
+      retained = shallow;
+      for (int i = 0; i < num_nodes - 1; i++) {
+        int node = postorder[i];
+        retained[idom[node]] += retained[node];
+      }
+    }
+  };
+
+  void CollectRoots(symbolTable & table, std::vector<heapRoot> & roots) {
+    for (int scope = 0; scope <= table.GetCurScope(); scope++) {
+      const std::vector<tableEntry *> & vars = table.GetScopeVars(scope);
+      for (size_t i = 0; i < vars.size(); i++) {
+        heapRoot root = { vars[i]->GetName(), "variable", vars[i] };
+        roots.push_back(root);
+      }
+    }
+    for (int slot = 0; slot < table.GetStackTop(); slot++) {
+      heapRoot root = { "", "stack", table.GetSlot(slot) };
+      roots.push_back(root);
+    }
+    if (table.GetReturnValue()) {
+      heapRoot root = { "", "return", table.GetReturnValue() };
+      roots.push_back(root);
+    }
+  }
+
+  int EntryLine(const tableEntry * entry) {
+    std::unordered_map<const tableEntry *, int>::const_iterator it = entry_lines.find(entry);
+    return it == entry_lines.end() ? 0 : it->second;
+  }
+
+  struct typeStats {
+    uint64_t count;
+    uint64_t shallow;
+    uint64_t retained;  // Of the nodes not already kept alive by one of the same type
+    typeStats() : count(0), shallow(0), retained(0) { ; }
+  };
+
+  bool RetainedFirst(const std::pair<uint64_t, int> & a, const std::pair<uint64_t, int> & b) {
+    return a.first > b.first;
+  }
+
+};
+
+// HeapProfile
+
+namespace HeapProfile {
+
+  thread_local bool tracking = false;
+  thread_local int current_line = 0;
+
+  void Allocated(const tableEntry * entry, size_t bytes)
+  {
+    int line = current_line;
+    std::lock_guard<std::mutex> guard(lock);
+    siteStats & stats = line_stats[line];
+    stats.count++;
+    stats.bytes += bytes;
+    if (entry) entry_lines[entry] = line;
+  }
+
+  void Freed(const tableEntry * entry)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    entry_lines.erase(entry);
+  }
+
+  bool WriteSnapshot(const std::string & path, symbolTable & table,
+                     std::string & error)
+  {
+    std::ofstream out(path.c_str());
+    if (!out) {
+      error = "cannot write " + path;
+      return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::vector<heapRoot> roots;
+    CollectRoots(table, roots);
+    heapGraph graph(table);
+    graph.Build(roots);
+    graph.ComputeRetained();
+    int num_nodes = (int) graph.nodes.size();
+
+    // Per-type totals.  A type's retained size counts each subtree once,
+    // at the outermost node of that type.
+    std::vector<int> type_above(num_nodes, 0);  // Bit per type among a node's dominators
+    std::vector<typeStats> types(Type::FUNCTION + 1);
+    std::map<int, typeStats> sites;             // Live values by allocating line
+    uint64_t total_bytes = 0;
+    for (int i = num_nodes - 2; i >= 0; i--) {
+      int node = graph.postorder[i];
+      int parent = graph.idom[node];
+      int type = graph.nodes[node]->GetType();
+      if (parent != 0) {
+        type_above[node] = type_above[parent] | (1 << graph.nodes[parent]->GetType());
+      }
+
+      typeStats & stats = types[type];
+      stats.count++;
+      stats.shallow += graph.shallow[node];
+      if (!(type_above[node] & (1 << type))) stats.retained += graph.retained[node];
+
+      typeStats & site = sites[EntryLine(graph.nodes[node])];
+      site.count++;
+      site.shallow += graph.shallow[node];
+      total_bytes += graph.shallow[node];
+    }
+
+    // Temporaries nothing refers to any more; the interpreter never frees them.
+    uint64_t garbage_count = 0, garbage_bytes = 0;
+    const std::list<tableEntry *> & temps = table.GetTemps();
+    for (std::list<tableEntry *>::const_iterator it = temps.begin(); it != temps.end(); it++) {
+      if (graph.GetId(*it) >= 0) continue;
+      garbage_count++;
+      garbage_bytes += graph.ShallowSize(*it);
+    }
+
+    out << "{\n  \"totals\": {\"live_values\": " << num_nodes - 1
+        << ", \"live_bytes\": " << total_bytes
+        << ", \"unreachable_temps\": " << garbage_count
+        << ", \"unreachable_bytes\": " << garbage_bytes << "},\n";
+
+    out << "  \"types\": [";
+    bool first = true;
+    for (int type = 0; type < (int) types.size(); type++) {
+      if (types[type].count == 0) continue;
+      out << (first ? "\n" : ",\n") << "    {\"type\": \"" << Type::AsString(type)
+          << "\", \"count\": " << types[type].count
+          << ", \"shallow_bytes\": " << types[type].shallow
+          << ", \"retained_bytes\": " << types[type].retained << "}";
+      first = false;
+    }
+    out << "\n  ],\n";
+
+    // Roots, largest first.
+    std::vector<std::pair<uint64_t, int> > by_size;
+    for (size_t i = 0; i < roots.size(); i++) {
+      int id = graph.GetId(roots[i].entry);
+      uint64_t bytes = graph.idom[id] == 0 ? graph.retained[id] : 0;
+      by_size.push_back(std::make_pair(bytes, (int) i));
+    }
+    std::stable_sort(by_size.begin(), by_size.end(), RetainedFirst);
+    out << "  \"roots\": [";
+    for (size_t i = 0; i < by_size.size(); i++) {
+      const heapRoot & root = roots[by_size[i].second];
+      out << (i ? ",\n" : "\n") << "    {\"name\": \"" << root.name
+          << "\", \"kind\": \"" << root.kind
+          << "\", \"node\": " << graph.GetId(root.entry)
+          << ", \"retained_bytes\": " << by_size[i].first << "}";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"sites\": [";
+    first = true;
+    for (std::map<int, typeStats>::iterator it = sites.begin(); it != sites.end(); it++) {
+      out << (first ? "\n" : ",\n") << "    {\"line\": " << it->first
+          << ", \"count\": " << it->second.count
+          << ", \"shallow_bytes\": " << it->second.shallow << "}";
+      first = false;
+    }
+    out << "\n  ],\n";
+
+    out << "  \"nodes\": [";
+    for (int node = 1; node < num_nodes; node++) {
+      out << (node > 1 ? ",\n" : "\n") << "    {\"id\": " << node
+          << ", \"type\": \"" << Type::AsString(graph.nodes[node]->GetType())
+          << "\", \"line\": " << EntryLine(graph.nodes[node])
+          << ", \"shallow_bytes\": " << graph.shallow[node]
+          << ", \"retained_bytes\": " << graph.retained[node]
+          << ", \"edges\": [";
+      for (size_t i = 0; i < graph.edges[node].size(); i++) {
+        out << (i ? ", " : "") << graph.edges[node][i];
+      }
+      out << "]}";
+    }
+    out << "\n  ]\n}\n";
+
+    if (!out) {
+      error = "cannot write " + path;
+      return false;
+    }
+    return true;
+  }
+
+  void ReportAllocations(std::ostream & out)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::vector<std::pair<uint64_t, int> > by_bytes;
+    uint64_t total = 0;
+    for (std::map<int, siteStats>::iterator it = line_stats.begin(); it != line_stats.end(); it++) {
+      by_bytes.push_back(std::make_pair(it->second.bytes, it->first));
+      total += it->second.bytes;
+    }
+    std::stable_sort(by_bytes.begin(), by_bytes.end(), RetainedFirst);
+
+    out << "Allocations by line (" << total << " bytes in total):" << std::endl;
+    for (size_t i = 0; i < by_bytes.size(); i++) {
+      const siteStats & stats = line_stats[by_bytes[i].second];
+      out << "  ";
+      if (by_bytes[i].second == 0) out << "parse time";
+      else out << "line " << by_bytes[i].second;
+      out << ": " << stats.bytes << " bytes in " << stats.count << " allocations"
+          << std::endl;
+    }
+  }
+
+  void Reset()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    line_stats.clear();
+    entry_lines.clear();
+    current_line = 0;
+  }
+
+};
@@ -0,0 +1,41 @@
+#ifndef HEAP_PROFILE_H
+#define HEAP_PROFILE_H
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+class tableEntry;
+class symbolTable;
+
+// Heap snapshots and allocation-site tracking.  While tracking is on, every
+// table entry and value payload (string, object, array) records the source
+// line of the statement that created it.  A snapshot walks the values
+// reachable from the variables and the call stack and reports what is alive,
+// how much memory each value keeps alive, and where it was allocated.
+namespace HeapProfile {
+  extern thread_local bool tracking;    // Recording allocations (workers never do)?
+  extern thread_local int current_line; // Line of the statement being run
+
+  inline void SetLine(int line) {
+    if (tracking && line >= 0) current_line = line;
+  }
+
+  // Record an allocation of bytes on the current line; entry is the table
+  // entry created, or NULL for a payload.  Only call these while tracking.
+  void Allocated(const tableEntry * entry, size_t bytes);
+  void Freed(const tableEntry * entry);
+
+  // Write a JSON snapshot of the live values in table to path.  Returns
+  // false and sets error if the file cannot be written.
+  bool WriteSnapshot(const std::string & path, symbolTable & table,
+                     std::string & error);
+
+  // Print the bytes and allocations per source line, largest first.
+  void ReportAllocations(std::ostream & out);
+
+  // Forget everything recorded so far, before the next script in a batch.
+  void Reset();
+};
+
+#endif
@@ -0,0 +1,722 @@
+#include "json.h"
+#include "symbol_table.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V9_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  // Character classes of one 64-byte block of text, one bit per byte.
+  struct blockMasks {
+    uint64_t quote;      // "
+    uint64_t backslash;  // backslash
+    uint64_t op;         // { } [ ] : ,
+    uint64_t space;      // JSON whitespace
+  };
+
+  // The scanning kernels, picked once for the CPU like the typed array ones.
+  struct jsonKernels {
+    const char * name;
+
+    // Classify the 64 bytes at in.
+    void (*classify)(const unsigned char * in, blockMasks & masks);
+
+    // Length of the leading run of in that needs no escaping: the distance to
+    // the first quote, backslash or control character (or n if there is none).
+    size_t (*plain_run)(const unsigned char * in, size_t n);
+  };
+
+  // Scalar kernels
+
+  void ClassifyScalar(const unsigned char * in, blockMasks & masks) {
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for (int i = 0; i < 64; i++) {
+      uint64_t bit = (uint64_t) 1 << i;
+      switch (in[i]) {
+        case '"': masks.quote |= bit; break;
+        case '\\': masks.backslash |= bit; break;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+          masks.op |= bit;
+          break;
+        case ' ': case '\t': case '\n': case '\r':
+          masks.space |= bit;
+          break;
+      }
+    }
+  }
+
+  size_t PlainRunScalar(const unsigned char * in, size_t n) {
+    size_t i = 0;
+    while (i < n && in[i] != '"' && in[i] != '\\' && in[i] >= 0x20) i++;
+    return i;
+  }
+
+  const jsonKernels scalar_kernels = { "scalar", ClassifyScalar, PlainRunScalar };
+
+#ifdef V9_X86_KERNELS
+
+  // SSE2 kernels (always present on x86-64).  '[' and ']' are '{' and '}'
+  // with bit 5 cleared, so OR-ing in 0x20 lets one compare catch both.
+
+  __attribute__((target("sse2")))
+  void ClassifySSE2(const unsigned char * in, blockMasks & masks) {
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for (int i = 0; i < 64; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+      __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                     _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+      __m128i space = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+
+      masks.quote |= (uint64_t) (uint16_t)
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+      masks.backslash |= (uint64_t) (uint16_t)
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+      masks.op |= (uint64_t) (uint16_t) _mm_movemask_epi8(op) << i;
+      masks.space |= (uint64_t) (uint16_t) _mm_movemask_epi8(space) << i;
+    }
+  }
+
+  __attribute__((target("sse2")))
+  size_t PlainRunSSE2(const unsigned char * in, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f)));
+      int mask = _mm_movemask_epi8(special);
+      if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + PlainRunScalar(in + i, n - i);
+  }
+
+  const jsonKernels sse2_kernels = { "sse2", ClassifySSE2, PlainRunSSE2 };
+
+  // AVX2 kernels.
+
+  __attribute__((target("avx2")))
+  void ClassifyAVX2(const unsigned char * in, blockMasks & masks) {
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for (int i = 0; i < 64; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+      __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+
+      __m256i op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                        _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+      __m256i space = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+
+      masks.quote |= (uint64_t) (uint32_t)
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+      masks.backslash |= (uint64_t) (uint32_t)
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+      masks.op |= (uint64_t) (uint32_t) _mm256_movemask_epi8(op) << i;
+      masks.space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+    }
+  }
+
+  __attribute__((target("avx2")))
+  size_t PlainRunAVX2(const unsigned char * in, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+      __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)),
+                          _mm256_set1_epi8(0x1f)));
+      uint32_t mask = (uint32_t) _mm256_movemask_epi8(special);
+      if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + PlainRunSSE2(in + i, n - i);
+  }
+
+  const jsonKernels avx2_kernels = { "avx2", ClassifyAVX2, PlainRunAVX2 };
+
+#endif
+
+  // Pick the widest kernels this CPU supports; V9_SIMD caps the choice just
+  // as it does for typed arrays.
+  const jsonKernels * SelectKernels() {
+    const char * cap = getenv("V9_SIMD");
+    std::string limit = cap ? cap : "";
+    if (limit == "scalar") return &scalar_kernels;
+#ifdef V9_X86_KERNELS
+    __builtin_cpu_init();
+    if (limit != "sse2" && __builtin_cpu_supports("avx2")) return &avx2_kernels;
+    if (__builtin_cpu_supports("sse2")) return &sse2_kernels;
+#endif
+    return &scalar_kernels;
+  }
+
+  const jsonKernels & Kernels() {
+    static const jsonKernels * active = SelectKernels();
+    return *active;
+  }
+
+  // Bits of the characters escaped by a backslash.  A backslash escapes the
+  // next character unless it is itself escaped, so odd-length runs of
+  // backslashes escape what follows them; prev_escaped carries a pending
+  // escape into the next block.
+  uint64_t FindEscaped(uint64_t backslash, uint64_t & prev_escaped) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~prev_escaped;
+    uint64_t follows_escape = (backslash << 1) | prev_escaped;
+
+    // Runs that start on an odd bit end up flipped by the carry of the add.
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_starts;
+    prev_escaped = __builtin_add_overflow(odd_starts, backslash, &even_starts);
+    uint64_t invert_mask = even_starts << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+  }
+
+  // Bit i of the result is the XOR of bits 0..i of in.
+  uint64_t PrefixXor(uint64_t in) {
+    in ^= in << 1;
+    in ^= in << 2;
+    in ^= in << 4;
+    in ^= in << 8;
+    in ^= in << 16;
+    in ^= in << 32;
+    return in;
+  }
+
+  // Stage one: find the position of every structural character, which is
+  // any bracket, colon or comma outside a string, the opening quote of each
+  // string, and the first byte of every other value.  Returns false if the
+  // text ends inside a string.
+  bool FindStructurals(const std::string & text, std::vector<uint32_t> & out) {
+    const jsonKernels & kernels = Kernels();
+    const unsigned char * in = (const unsigned char *) text.data();
+    size_t len = text.size();
+    uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+
+    out.reserve(len / 8 + 16);
+    for (size_t block = 0; block < len; block += 64) {
+      blockMasks masks;
+      if (len - block >= 64) {
+        kernels.classify(in + block, masks);
+      }
+      else {
+        unsigned char tail[64];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, in + block, len - block);
+        kernels.classify(tail, masks);
+      }
+
+      // Strings run from an opening quote up to (not including) the closing one.
+      uint64_t quote = masks.quote & ~FindEscaped(masks.backslash, prev_escaped);
+      uint64_t in_string = PrefixXor(quote) ^ prev_in_string;
+      prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
+
+      uint64_t scalar = ~(masks.op | masks.space | quote) & ~in_string;
+      uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+      prev_scalar = scalar >> 63;
+
+      uint64_t structurals = (masks.op & ~in_string) | (quote & in_string) | scalar_start;
+      while (structurals) {
+        out.push_back((uint32_t) (block + __builtin_ctzll(structurals)));
+        structurals &= structurals - 1;
+      }
+    }
+    return prev_in_string == 0;
+  }
+
+  bool IsDelimiter(char c) {
+    switch (c) {
+      case '\0': case ' ': case '\t': case '\n': case '\r':
+      case '{': case '}': case '[': case ']': case ':': case ',':
+        return true;
+    }
+    return false;
+  }
+
+  int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  void AppendUtf8(std::string & out, uint32_t code) {
+    if (code < 0x80) {
+      out += (char) code;
+    }
+    else if (code < 0x800) {
+      out += (char) (0xc0 | (code >> 6));
+      out += (char) (0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000) {
+      out += (char) (0xe0 | (code >> 12));
+      out += (char) (0x80 | ((code >> 6) & 0x3f));
+      out += (char) (0x80 | (code & 0x3f));
+    }
+    else {
+      out += (char) (0xf0 | (code >> 18));
+      out += (char) (0x80 | ((code >> 12) & 0x3f));
+      out += (char) (0x80 | ((code >> 6) & 0x3f));
+      out += (char) (0x80 | (code & 0x3f));
+    }
+  }
+
+  // Stage two: build values by walking the structural index.
+  class jsonBuilder {
+  private:
+    static const int MAX_DEPTH = 1000;
+
+    const std::string & text;
+    const std::vector<uint32_t> & index;
+    size_t pos;                          // Next entry of index
+    symbolTable & table;
+
+    char Peek() const { return pos < index.size() ? text[index[pos]] : '\0'; }
+    size_t PeekPos() const { return pos < index.size() ? index[pos] : text.size(); }
+
+    tableEntry * Fail(const std::string & msg, size_t at) {
+      if (error == "") {
+        std::stringstream ss;
+        ss << msg << " at position " << at;
+        error = ss.str();
+      }
+      return NULL;
+    }
+
+    bool ParseString(size_t start, std::string & out);
+    tableEntry * ParseScalar(size_t start);
+
+  public:
+    std::string error;
+
+    jsonBuilder(const std::string & in_text, const std::vector<uint32_t> & in_index,
+                symbolTable & in_table)
+      : text(in_text), index(in_index), pos(0), table(in_table) { ; }
+
+    bool AtEnd() const { return pos == index.size(); }
+    tableEntry * ParseValue(int depth);
+    tableEntry * ParseDocument();
+  };
+
+  bool jsonBuilder::ParseString(size_t start, std::string & out)
+  {
+    const unsigned char * in = (const unsigned char *) text.data();
+    size_t len = text.size();
+    size_t p = start + 1;
+    out.clear();
+
+    while (true) {
+      size_t run = Kernels().plain_run(in + p, len - p);
+      out.append((const char *) in + p, run);
+      p += run;
+
+      if (p >= len) { Fail("unterminated string", start); return false; }
+      if (in[p] == '"') return true;
+      if (in[p] < 0x20) { Fail("control character in string", p); return false; }
+
+      // A backslash escape
+      if (++p >= len) { Fail("unterminated string", start); return false; }
+      switch (in[p]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          uint32_t code = 0;
+          for (int i = 1; i <= 4; i++) {
+            int digit = (p + i < len) ? HexValue(in[p + i]) : -1;
+            if (digit < 0) { Fail("bad unicode escape", p - 1); return false; }
+            code = code * 16 + digit;
+          }
+          p += 4;
+
+          // A high surrogate followed by an escaped low one is one character.
+          if (code >= 0xd800 && code < 0xdc00 && p + 6 < len &&
+              in[p + 1] == '\\' && in[p + 2] == 'u') {
+            uint32_t low = 0;
+            int i = 3;
+            for (; i <= 6; i++) {
+              int digit = HexValue(in[p + i]);
+              if (digit < 0) break;
+              low = low * 16 + digit;
+            }
+            if (i > 6 && low >= 0xdc00 && low < 0xe000) {
+              code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+              p += 6;
+            }
+          }
+          AppendUtf8(out, code);
+          break;
+        }
+        default:
+          Fail("bad escape in string", p - 1);
+          return false;
+      }
+      p++;
+    }
+  }
+
+  tableEntry * jsonBuilder::ParseScalar(size_t start)
+  {
+    const char * s = text.c_str() + start;
+
+    if (strncmp(s, "true", 4) == 0 && IsDelimiter(s[4])) {
+      tableEntry * out_var = table.AddTempEntry(Type::BOOL);
+      out_var->SetBoolValue(true);
+      return out_var;
+    }
+    if (strncmp(s, "false", 5) == 0 && IsDelimiter(s[5])) {
+      tableEntry * out_var = table.AddTempEntry(Type::BOOL);
+      out_var->SetBoolValue(false);
+      return out_var;
+    }
+    if (strncmp(s, "null", 4) == 0 && IsDelimiter(s[4])) {
+      return table.AddTempEntry(Type::NLL);
+    }
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    const char * p = s;
+    if (*p == '-') p++;
+    if (*p == '0') p++;
+    else if (*p >= '1' && *p <= '9') { while (*p >= '0' && *p <= '9') p++; }
+    else return Fail("unexpected character", start);
+    if (*p == '.') {
+      p++;
+      if (!(*p >= '0' && *p <= '9')) return Fail("bad number", start);
+      while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+      p++;
+      if (*p == '+' || *p == '-') p++;
+      if (!(*p >= '0' && *p <= '9')) return Fail("bad number", start);
+      while (*p >= '0' && *p <= '9') p++;
+    }
+    if (!IsDelimiter(*p)) return Fail("bad number", start);
+
+    tableEntry * out_var = table.AddTempEntry(Type::NUMBER);
+    out_var->SetNumberValue(strtod(s, NULL));
+    return out_var;
+  }
+
+  tableEntry * jsonBuilder::ParseValue(int depth)
+  {
+    if (depth > MAX_DEPTH) return Fail("too deeply nested", PeekPos());
+    if (pos >= index.size()) return Fail("unexpected end of input", text.size());
+
+    size_t start = index[pos++];
+    char c = text[start];
+
+    if (c == '{') {
+      tableEntry * obj = table.AddTempEntry(Type::OBJECT);
+      obj->InitializeObject();
+      if (Peek() == '}') { pos++; return obj; }
+
+      std::string key;
+      while (true) {
+        if (Peek() != '"') return Fail("expected a property name", PeekPos());
+        if (!ParseString(index[pos++], key)) return NULL;
+        if (Peek() != ':') return Fail("expected ':'", PeekPos());
+        pos++;
+
+        tableEntry * value = ParseValue(depth + 1);
+        if (!value) return NULL;
+        obj->SetProperty(atom_table.Intern(key), value);
+
+        char next = Peek();
+        if (next == '}') { pos++; return obj; }
+        if (next != ',') return Fail("expected ',' or '}'", PeekPos());
+        pos++;
+      }
+    }
+
+    if (c == '[') {
+      tableEntry * arr = table.AddTempEntry(Type::ARRAY);
+      arr->InitializeArray();
+      if (Peek() == ']') { pos++; return arr; }
+
+      std::map<unsigned int, tableEntry*> * elements = arr->GetArray();
+      for (unsigned int count = 0; ; count++) {
+        tableEntry * value = ParseValue(depth + 1);
+        if (!value) return NULL;
+        elements->insert(elements->end(), std::make_pair(count, value));
+
+        char next = Peek();
+        if (next == ']') { pos++; return arr; }
+        if (next != ',') return Fail("expected ',' or ']'", PeekPos());
+        pos++;
+      }
+    }
+
+    if (c == '"') {
+      std::string value;
+      if (!ParseString(start, value)) return NULL;
+      tableEntry * out_var = table.AddTempEntry(Type::STRING);
+      out_var->SetStringValue(value);
+      return out_var;
+    }
+
+    if (c == '}' || c == ']' || c == ':' || c == ',') {
+      return Fail(std::string("unexpected '") + c + "'", start);
+    }
+    return ParseScalar(start);
+  }
+
+  tableEntry * jsonBuilder::ParseDocument()
+  {
+    tableEntry * value = ParseValue(0);
+    if (value && !AtEnd()) return Fail("unexpected data after the value", PeekPos());
+    return value;
+  }
+
+  // Serialization
+
+  tableEntry * Resolve(tableEntry * value) {
+    while (value && value->GetType() == Type::REFERENCE) value = value->GetReference();
+    return value;
+  }
+
+  // Values JSON leaves out of objects (and writes as null in arrays)
+  bool IsUndefined(tableEntry * value) {
+    return !value || value->GetType() == Type::VOID || value->GetType() == Type::FUNCTION;
+  }
+
+  void AppendString(std::string & out, const std::string & value) {
+    const unsigned char * in = (const unsigned char *) value.data();
+    size_t len = value.size();
+    out += '"';
+    for (size_t i = 0; i < len; ) {
+      size_t run = Kernels().plain_run(in + i, len - i);
+      out.append((const char *) in + i, run);
+      i += run;
+      if (i >= len) break;
+
+      unsigned char c = in[i++];
+      switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default: {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        }
+      }
+    }
+    out += '"';
+  }
+
+  // Write the shortest decimal that reads back as the same number, laid out
+  // the way JavaScript prints numbers.
+  void AppendNumber(std::string & out, double value) {
+    if (!std::isfinite(value)) { out += "null"; return; }
+
+    char buf[40];
+    if (value == std::floor(value) && std::fabs(value) < 1e21) {
+      snprintf(buf, sizeof(buf), "%.0f", value == 0 ? 0.0 : value);
+      out += buf;
+      return;
+    }
+
+    // Shortest significand first ("d.ddde+x"), then its digits and exponent
+    for (int precision = 14; precision <= 16; precision++) {
+      snprintf(buf, sizeof(buf), "%.*e", precision, value);
+      double back = strtod(buf, NULL);
+      if (back == value) break;
+    }
+    char * exp = strchr(buf, 'e');
+    int point = atoi(exp + 1) + 1;  // Digits before the decimal point
+    std::string digits;
+    for (char * p = buf; p < exp; p++) {
+      if (*p >= '0' && *p <= '9') digits += *p;
+    }
+    while (digits.size() > 1 && digits[digits.size() - 1] == '0') {
+      digits.erase(digits.size() - 1);
+    }
+
+    if (value < 0) out += '-';
+    int num_digits = (int) digits.size();
+    if (point > 0 && point <= 21) {
+      if (num_digits <= point) {
+        out += digits;
+        out.append(point - num_digits, '0');
+      }
+      else {
+        out.append(digits, 0, point);
+        out += '.';
+        out.append(digits, point, std::string::npos);
+      }
+    }
+    else if (point <= 0 && point > -6) {
+      out += "0.";
+      out.append(-point, '0');
+      out += digits;
+    }
+    else {
+      out += digits[0];
+      if (num_digits > 1) {
+        out += '.';
+        out.append(digits, 1, std::string::npos);
+      }
+      snprintf(buf, sizeof(buf), "e%c%d", point > 0 ? '+' : '-', std::abs(point - 1));
+      out += buf;
+    }
+  }
+
+  class jsonWriter {
+  private:
+    std::string & out;
+    std::vector<const tableEntry *> open;  // Objects and arrays being written
+
+  public:
+    std::string error;
+
+    jsonWriter(std::string & in_out) : out(in_out) { ; }
+
+    bool Write(tableEntry * value);
+  };
+
+  bool jsonWriter::Write(tableEntry * value)
+  {
+    value = Resolve(value);
+    switch (value->GetType()) {
+      case Type::NUMBER: AppendNumber(out, value->GetNumberValue()); return true;
+      case Type::BOOL: out += value->GetBoolValue() ? "true" : "false"; return true;
+      case Type::STRING: AppendString(out, value->GetStringValue()); return true;
+      case Type::OBJECT: case Type::ARRAY: break;
+      case Type::TYPED_ARRAY: {
+        typedArray * array = value->GetTypedArray();
+        out += '[';
+        for (unsigned int i = 0; i < array->GetLength(); i++) {
+          if (i > 0) out += ',';
+          AppendNumber(out, array->GetElement(i));
+        }
+        out += ']';
+        return true;
+      }
+      default: out += "null"; return true;
+    }
+
+    for (size_t i = 0; i < open.size(); i++) {
+      if (open[i] == value) {
+        error = "cyclic structure";
+        return false;
+      }
+    }
+    open.push_back(value);
+
+    if (value->GetType() == Type::OBJECT) {
+      propertyMap * pm = value->GetPropertyMap();
+      bool first = true;
+      out += '{';
+      for (int i = 0; i < pm->GetSize(); i++) {
+        tableEntry * prop = Resolve(pm->GetEntry(i).value);
+        if (IsUndefined(prop)) continue;
+        if (!first) out += ',';
+        first = false;
+        AppendString(out, atom_table.GetName(pm->GetEntry(i).atom));
+        out += ':';
+        if (!Write(prop)) return false;
+      }
+      out += '}';
+    }
+    else {
+      // Arrays are dense in JSON; missing elements are written as null.
+      std::map<unsigned int, tableEntry*> * elements = value->GetArray();
+      unsigned int next = 0;
+      out += '[';
+      for (std::map<unsigned int, tableEntry*>::iterator it = elements->begin();
+           it != elements->end(); it++) {
+        for (; next < it->first; next++) out += next > 0 ? ",null" : "null";
+        if (next > 0) out += ',';
+        next = it->first + 1;
+
+        tableEntry * element = Resolve(it->second);
+        if (IsUndefined(element)) out += "null";
+        else if (!Write(element)) return false;
+      }
+      out += ']';
+    }
+
+    open.pop_back();
+    return true;
+  }
+
+};
+
+// Json
+
+namespace Json {
+
+  tableEntry * Parse(const std::string & text, symbolTable & table,
+                     std::string & error)
+  {
+    if (text.size() >= 0xffffffffu) {
+      error = "document too large";
+      return NULL;
+    }
+
+    std::vector<uint32_t> index;
+    if (!FindStructurals(text, index)) {
+      error = "unterminated string";
+      return NULL;
+    }
+
+    jsonBuilder builder(text, index, table);
+    tableEntry * value = builder.ParseDocument();
+    if (!value) error = builder.error;
+    return value;
+  }
+
+  bool Stringify(tableEntry * value, std::string & out, std::string & error)
+  {
+    value = Resolve(value);
+    if (IsUndefined(value)) return false;
+
+    jsonWriter writer(out);
+    if (!writer.Write(value)) {
+      error = writer.error;
+      return false;
+    }
+    return true;
+  }
+
+  const char * ScannerName()
+  {
+    return Kernels().name;
+  }
+
+};
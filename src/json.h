@@ -0,0 +1,26 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+
+class tableEntry;
+class symbolTable;
+
+// Native JSON.parse / JSON.stringify.  Parsing first runs a SIMD pass over the
+// text that finds every structural character outside of strings, then builds
+// objects and arrays straight from that index.  Stringify appends everything
+// to a single growable buffer.
+namespace Json {
+  // Parse text into a new value.  Returns NULL and sets error on bad input.
+  tableEntry * Parse(const std::string & text, symbolTable & table,
+                     std::string & error);
+
+  // Serialize value into out.  Returns false if there is nothing to write
+  // (undefined or a function at the top level), and sets error on cycles.
+  bool Stringify(tableEntry * value, std::string & out, std::string & error);
+
+  // Name of the scanner the CPU supports ("scalar", "sse2" or "avx2").
+  const char * ScannerName();
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "lex_scan.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V9_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  struct scanKernels {
+    const char * name;
+
+    // Length of the leading whitespace run, counting its newlines.
+    size_t (*skip_space)(const unsigned char * in, size_t n, int & newlines);
+
+    // Distance to the first a or b (n if there is neither).
+    size_t (*find_either)(const unsigned char * in, size_t n, unsigned char a,
+                          unsigned char b);
+  };
+
+  // Scalar kernels
+
+  size_t SkipSpaceScalar(const unsigned char * in, size_t n, int & newlines) {
+    size_t i = 0;
+    for (; i < n; i++) {
+      unsigned char c = in[i];
+      if (c == '\n') newlines++;
+      else if (c != ' ' && c != '\t' && c != '\r') break;
+    }
+    return i;
+  }
+
+  size_t FindEitherScalar(const unsigned char * in, size_t n, unsigned char a,
+                          unsigned char b) {
+    size_t i = 0;
+    while (i < n && in[i] != a && in[i] != b) i++;
+    return i;
+  }
+
+  const scanKernels scalar_kernels = { "scalar", SkipSpaceScalar, FindEitherScalar };
+
+#ifdef V9_X86_KERNELS
+
+  // SSE2 kernels (always present on x86-64)
+
+  __attribute__((target("sse2")))
+  size_t SkipSpaceSSE2(const unsigned char * in, size_t n, int & newlines) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+      __m128i space = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), newline));
+
+      unsigned int lines = (unsigned int) _mm_movemask_epi8(newline);
+      unsigned int other = ~(unsigned int) _mm_movemask_epi8(space) & 0xffff;
+      if (other) {
+        unsigned int end = __builtin_ctz(other);
+        newlines += __builtin_popcount(lines & ((1u << end) - 1));
+        return i + end;
+      }
+      newlines += __builtin_popcount(lines);
+    }
+    return i + SkipSpaceScalar(in + i, n - i, newlines);
+  }
+
+  __attribute__((target("sse2")))
+  size_t FindEitherSSE2(const unsigned char * in, size_t n, unsigned char a,
+                        unsigned char b) {
+    __m128i va = _mm_set1_epi8((char) a), vb = _mm_set1_epi8((char) b);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                                _mm_cmpeq_epi8(v, vb)));
+      if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + FindEitherScalar(in + i, n - i, a, b);
+  }
+
+  const scanKernels sse2_kernels = { "sse2", SkipSpaceSSE2, FindEitherSSE2 };
+
+  // AVX2 kernels
+
+  __attribute__((target("avx2,popcnt")))
+  size_t SkipSpaceAVX2(const unsigned char * in, size_t n, int & newlines) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+      __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+      __m256i space = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), newline));
+
+      uint32_t lines = (uint32_t) _mm256_movemask_epi8(newline);
+      uint32_t other = ~(uint32_t) _mm256_movemask_epi8(space);
+      if (other) {
+        uint32_t end = __builtin_ctz(other);
+        newlines += __builtin_popcount(lines & (uint32_t) ((1ull << end) - 1));
+        return i + end;
+      }
+      newlines += __builtin_popcount(lines);
+    }
+    return i + SkipSpaceSSE2(in + i, n - i, newlines);
+  }
+
+  __attribute__((target("avx2")))
+  size_t FindEitherAVX2(const unsigned char * in, size_t n, unsigned char a,
+                        unsigned char b) {
+    __m256i va = _mm256_set1_epi8((char) a), vb = _mm256_set1_epi8((char) b);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+      uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+      if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + FindEitherSSE2(in + i, n - i, a, b);
+  }
+
+  const scanKernels avx2_kernels = { "avx2", SkipSpaceAVX2, FindEitherAVX2 };
+
+#endif
+
+  // Pick the widest kernels this CPU supports; V9_SIMD caps the choice just
+  // as it does for typed arrays.
+  const scanKernels * SelectKernels() {
+    const char * cap = getenv("V9_SIMD");
+    std::string limit = cap ? cap : "";
+    if (limit == "scalar") return &scalar_kernels;
+#ifdef V9_X86_KERNELS
+    __builtin_cpu_init();
+    if (limit != "sse2" && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("popcnt")) {
+      return &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) return &sse2_kernels;
+#endif
+    return &scalar_kernels;
+  }
+
+  const scanKernels & Kernels() {
+    static const scanKernels * active = SelectKernels();
+    return *active;
+  }
+
+};
+
+// LexScan
+
+namespace LexScan {
+
+  size_t SkipSpace(const char * in, size_t n, int & newlines)
+  {
+    return Kernels().skip_space((const unsigned char *) in, n, newlines);
+  }
+
+  size_t LineLength(const char * in, size_t n)
+  {
+    // memchr is already vectorized by the C library.
+    const char * end = (const char *) memchr(in, '\n', n);
+    return end ? (size_t) (end - in) : n;
+  }
+
+  size_t StringLength(const char * in, size_t n)
+  {
+    const unsigned char * text = (const unsigned char *) in;
+    unsigned char quote = text[0];
+    size_t pos = 1;
+
+    while (true) {
+      pos += Kernels().find_either(text + pos, n - pos, quote, '\\');
+      if (pos >= n) return 0;
+      if (text[pos] == quote) return pos + 1;
+
+      // A backslash escapes any one character but a newline.
+      if (pos + 1 >= n || text[pos + 1] == '\n') return 0;
+      pos += 2;
+    }
+  }
+
+  const char * KernelName()
+  {
+    return Kernels().name;
+  }
+
+};
@@ -0,0 +1,27 @@
+#ifndef LEX_SCAN_H
+#define LEX_SCAN_H
+
+#include <cstddef>
+
+// Bulk scanning for the lexer.  Flex steps its DFA once per byte, which is
+// slow for long runs of whitespace, comments and string literals; these find
+// where such runs end 16 or 32 bytes at a time.  Each takes the text from the
+// start of the run and the number of bytes left in the input.
+namespace LexScan {
+  // Length of the run of spaces, tabs, carriage returns and newlines at in,
+  // adding the number of newlines in it to newlines.
+  size_t SkipSpace(const char * in, size_t n, int & newlines);
+
+  // Length of the line at in, not counting its newline.
+  size_t LineLength(const char * in, size_t n);
+
+  // Length of the string literal at in (which starts with its quote),
+  // including both quotes.  Returns 0 if the literal is not closed, or a
+  // backslash is followed by a newline.
+  size_t StringLength(const char * in, size_t n);
+
+  // Name of the kernels the CPU supports ("scalar", "sse2" or "avx2").
+  const char * KernelName();
+};
+
+#endif
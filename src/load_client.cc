@@ -0,0 +1,155 @@
+// v9-load: a load generator for `v9 --serve`.  Several connections each send
+// the same request over and over, one at a time, and the latency of every
+// request is recorded.  Prints the request rate and latency percentiles.
+
+#include "server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock loadClock;
+
+  // What one connection did.
+  struct connectionResult {
+    std::vector<double> latencies;  // Microseconds, one per answered request
+    int failed;                     // Requests answered with an error
+    std::string error;              // Why the connection broke, if it did
+    std::string first_output;       // Output of the first request
+  };
+
+  void RunConnection(const std::string & socket_path, const Server::request * req,
+                     int num_requests, connectionResult * result) {
+    result->failed = 0;
+    int fd = Server::Connect(socket_path, result->error);
+    if (fd < 0) return;
+
+    for (int i = 0; i < num_requests; i++) {
+      bool ok = false;
+      std::string output;
+      loadClock::time_point start = loadClock::now();
+      if (!Server::Call(fd, *req, ok, output)) {
+        result->error = "connection closed by the server";
+        break;
+      }
+      std::chrono::duration<double, std::micro> elapsed = loadClock::now() - start;
+      result->latencies.push_back(elapsed.count());
+      if (!ok) result->failed++;
+      if (i == 0) result->first_output = output;
+    }
+    close(fd);
+  }
+
+  double Percentile(const std::vector<double> & sorted, double fraction) {
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t) (fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+  }
+
+  void Usage(const char * program) {
+    std::cerr << "Format: " << program << " --socket=PATH [flags] script.js" << std::endl;
+    std::cerr << "  --requests=N  :  Requests to send in all (default 10000)" << std::endl;
+    std::cerr << "  --connections=N  :  Connections sending at once (default 1)" << std::endl;
+    std::cerr << "  --bind=NAME=JSON  :  Set global NAME to JSON for every request" << std::endl;
+    std::cerr << "  --inline  :  Send the script's text instead of its path" << std::endl;
+    std::cerr << "  --show  :  Print the output of the first request" << std::endl;
+    exit(1);
+  }
+
+  int PositiveNumber(const std::string & arg) {
+    int value = atoi(arg.substr(arg.find('=') + 1).c_str());
+    if (value <= 0) {
+      std::cerr << "ERROR: " << arg.substr(0, arg.find('=')) << " needs a positive number" << std::endl;
+      exit(1);
+    }
+    return value;
+  }
+
+};
+
+int main(int argc, char * argv[])
+{
+  std::string socket_path;
+  std::string script_path;
+  int num_requests = 10000;
+  int num_connections = 1;
+  bool send_inline = false;
+  bool show = false;
+  Server::request req;
+
+  for (int arg_id = 1; arg_id < argc; arg_id++) {
+    std::string cur_arg(argv[arg_id]);
+    if (cur_arg.compare(0, 9, "--socket=") == 0) socket_path = cur_arg.substr(9);
+    else if (cur_arg.compare(0, 11, "--requests=") == 0) num_requests = PositiveNumber(cur_arg);
+    else if (cur_arg.compare(0, 14, "--connections=") == 0) num_connections = PositiveNumber(cur_arg);
+    else if (cur_arg.compare(0, 7, "--bind=") == 0) {
+      size_t equals = cur_arg.find('=', 7);
+      if (equals == std::string::npos) Usage(argv[0]);
+      req.bindings.push_back(std::make_pair(cur_arg.substr(7, equals - 7), cur_arg.substr(equals + 1)));
+    }
+    else if (cur_arg == "--inline") send_inline = true;
+    else if (cur_arg == "--show") show = true;
+    else if (cur_arg[0] == '-' || script_path != "") Usage(argv[0]);
+    else script_path = cur_arg;
+  }
+  if (socket_path == "" || script_path == "") Usage(argv[0]);
+
+  if (send_inline) {
+    std::ifstream script(script_path.c_str());
+    if (!script) {
+      std::cerr << "Error opening " << script_path << std::endl;
+      exit(1);
+    }
+    std::stringstream text;
+    text << script.rdbuf();
+    req.source = text.str();
+  }
+  else {
+    // The server resolves the path itself, so make it absolute.
+    char * full_path = realpath(script_path.c_str(), NULL);
+    if (!full_path) {
+      std::cerr << "Error opening " << script_path << std::endl;
+      exit(1);
+    }
+    req.path = full_path;
+    free(full_path);
+  }
+
+  // Spread the requests over the connections.
+  std::vector<connectionResult> results(num_connections);
+  std::vector<std::thread> threads;
+  loadClock::time_point start = loadClock::now();
+  for (int i = 0; i < num_connections; i++) {
+    int share = num_requests / num_connections + (i < num_requests % num_connections ? 1 : 0);
+    threads.push_back(std::thread(RunConnection, socket_path, &req, share, &results[i]));
+  }
+  for (int i = 0; i < num_connections; i++) threads[i].join();
+  std::chrono::duration<double> elapsed = loadClock::now() - start;
+
+  std::vector<double> latencies;
+  int failed = 0;
+  for (int i = 0; i < num_connections; i++) {
+    latencies.insert(latencies.end(), results[i].latencies.begin(), results[i].latencies.end());
+    failed += results[i].failed;
+    if (results[i].error != "") {
+      std::cerr << "ERROR: connection " << i << ": " << results[i].error << std::endl;
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  if (show) std::cout << results[0].first_output;
+  std::cout << latencies.size() << " requests (" << failed << " failed) over "
+            << num_connections << " connections in " << elapsed.count() << " s: "
+            << latencies.size() / elapsed.count() << " requests/s" << std::endl;
+  std::cout << "latency (us): p50 " << Percentile(latencies, 0.50)
+            << ", p99 " << Percentile(latencies, 0.99)
+            << ", max " << (latencies.empty() ? 0.0 : latencies.back()) << std::endl;
+  return latencies.size() == (size_t) num_requests && failed == 0 ? 0 : 1;
+}
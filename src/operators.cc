@@ -0,0 +1,245 @@
+#include "operators.h"
+#include "ast.h"
+#include "v9-parser.tab.hh"
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+  using namespace Operators;
+
+  // Conversions specialized on the operand's type.  The type is a template
+  // argument, so each kernel keeps only the one case it needs.
+
+  template <int T> inline double NumberOf(tableEntry * value) {
+    switch (T) {
+      case Type::NUMBER: return value->GetNumberValue();
+      case Type::BOOL: return value->GetBoolValue() ? 1 : 0;
+      case Type::STRING: return atof(value->GetStringValue().c_str());
+      case Type::NLL: return 0;
+    }
+    return NAN;
+  }
+
+  template <int T> inline std::string StringOf(tableEntry * value) {
+    if (T == Type::STRING) return value->GetStringValue();
+    return ToString(value);
+  }
+
+  template <int OP> inline double Arithmetic(double a, double b) {
+    switch (OP) {
+      case ADD: return a + b;
+      case SUB: return a - b;
+      case MUL: return a * b;
+      case DIV: return a / b;
+    }
+    return fmod(a, b);
+  }
+
+  // '+' concatenates if either side is a string; everything else is numeric.
+  template <int OP, int A, int B>
+  void MathKernel(tableEntry * out, tableEntry * a, tableEntry * b) {
+    if (OP == ADD && (A == Type::STRING || B == Type::STRING)) {
+      std::string text = StringOf<A>(a) + StringOf<B>(b);
+      if (out->GetType() == Type::STRING) {
+        out->AssignStringValue(text.data(), text.size());  // A reused result
+        return;
+      }
+      out->SetType(Type::STRING);
+      out->SetStringValue(std::move(text));
+      return;
+    }
+    out->SetType(Type::NUMBER);
+    out->SetNumberValue(Arithmetic<OP>(NumberOf<A>(a), NumberOf<B>(b)));
+  }
+
+  // '===': same type and value.  Objects, arrays and functions are equal
+  // only to themselves.
+  template <int A, int B> inline bool StrictEquals(tableEntry * a, tableEntry * b) {
+    if (A != B) return false;
+    switch (A) {
+      case Type::VOID: case Type::NLL: return true;
+      case Type::NUMBER: return a->GetNumberValue() == b->GetNumberValue();
+      case Type::BOOL: return a->GetBoolValue() == b->GetBoolValue();
+      case Type::STRING: return a->GetStringValue() == b->GetStringValue();
+      case Type::OBJECT: return a->GetPropertyMap() == b->GetPropertyMap();
+      case Type::ARRAY: return a->GetArray() == b->GetArray();
+      case Type::TYPED_ARRAY: return a->GetTypedArray() == b->GetTypedArray();
+      case Type::FUNCTION: return a->GetFunction() == b->GetFunction();
+    }
+    return a == b;
+  }
+
+  template <int T> struct typeClass {
+    static const bool nullish = (T == Type::VOID || T == Type::NLL);
+    static const bool primitive = (T == Type::NUMBER || T == Type::BOOL ||
+                                   T == Type::STRING);
+  };
+
+  // '==': null and undefined equal each other, and mixed primitives are
+  // compared as numbers.
+  template <int A, int B> inline bool LooseEquals(tableEntry * a, tableEntry * b) {
+    if (A == B) return StrictEquals<A, B>(a, b);
+    if (typeClass<A>::nullish || typeClass<B>::nullish) {
+      return typeClass<A>::nullish && typeClass<B>::nullish;
+    }
+    if (typeClass<A>::primitive && typeClass<B>::primitive) {
+      return NumberOf<A>(a) == NumberOf<B>(b);
+    }
+    return false;
+  }
+
+  // '<' and friends: strings compare by characters, anything else as
+  // numbers (where NaN makes every comparison false).
+  template <int OP, int A, int B> inline bool Relational(tableEntry * a, tableEntry * b) {
+    if (A == Type::STRING && B == Type::STRING) {
+      int order = a->GetStringValue().compare(b->GetStringValue());
+      switch (OP) {
+        case LESS: return order < 0;
+        case LTE: return order <= 0;
+        case GTR: return order > 0;
+      }
+      return order >= 0;
+    }
+
+    double x = NumberOf<A>(a), y = NumberOf<B>(b);
+    switch (OP) {
+      case LESS: return x < y;
+      case LTE: return x <= y;
+      case GTR: return x > y;
+    }
+    return x >= y;
+  }
+
+  template <int OP, int A, int B>
+  bool CompareKernel(tableEntry * a, tableEntry * b) {
+    switch (OP) {
+      case EQU: return LooseEquals<A, B>(a, b);
+      case NEQU: return !LooseEquals<A, B>(a, b);
+      case SEQU: return StrictEquals<A, B>(a, b);
+      case SNEQU: return !StrictEquals<A, B>(a, b);
+    }
+    return Relational<OP, A, B>(a, b);
+  }
+
+  // Compile-time lists 0..N-1, built by halves to keep template recursion
+  // shallow (C++11 has no std::make_integer_sequence).
+  template <int... I> struct indexList { typedef indexList type; };
+
+  template <class A, class B> struct joinIndexes;
+  template <int... I, int... J> struct joinIndexes<indexList<I...>, indexList<J...> >
+    : indexList<I..., (int) sizeof...(I) + J...> { };
+
+  template <int N> struct makeIndexes
+    : joinIndexes<typename makeIndexes<N / 2>::type,
+                  typename makeIndexes<N - N / 2>::type> { };
+  template <> struct makeIndexes<0> : indexList<> { };
+  template <> struct makeIndexes<1> : indexList<0> { };
+
+  // Entry I of a table is the kernel for [op][type of a][type of b].
+  template <int I> struct kernelIndex {
+    static const int op = I / (NUM_TYPES * NUM_TYPES);
+    static const int a = (I / NUM_TYPES) % NUM_TYPES;
+    static const int b = I % NUM_TYPES;
+  };
+
+  template <class LIST> struct kernelTables;
+  template <int... I> struct kernelTables<indexList<I...> > {
+    static const mathKernel math[];
+    static const compareKernel compare[];
+  };
+
+  template <int... I>
+  const mathKernel kernelTables<indexList<I...> >::math[] = {
+    &MathKernel<kernelIndex<I>::op, kernelIndex<I>::a, kernelIndex<I>::b>...
+  };
+
+  template <int... I>
+  const compareKernel kernelTables<indexList<I...> >::compare[] = {
+    &CompareKernel<kernelIndex<I>::op, kernelIndex<I>::a, kernelIndex<I>::b>...
+  };
+
+  typedef kernelTables<makeIndexes<NUM_MATH_OPS * NUM_TYPES * NUM_TYPES>::type> mathTables;
+  typedef kernelTables<makeIndexes<NUM_COMPARE_OPS * NUM_TYPES * NUM_TYPES>::type> compareTables;
+
+};
+
+// Operators
+
+namespace Operators {
+
+  const mathKernel * const math_kernels = mathTables::math;
+  const compareKernel * const compare_kernels = compareTables::compare;
+
+  int MathOp(int token)
+  {
+    switch (token) {
+      case '+': return ADD;
+      case '-': return SUB;
+      case '*': return MUL;
+      case '/': return DIV;
+      case '%': return MOD;
+    }
+    return -1;
+  }
+
+  int CompareOp(int token)
+  {
+    switch (token) {
+      case COMP_EQU: return EQU;
+      case COMP_NEQU: return NEQU;
+      case COMP_SEQU: return SEQU;
+      case COMP_SNEQU: return SNEQU;
+      case COMP_LESS: return LESS;
+      case COMP_LTE: return LTE;
+      case COMP_GTR: return GTR;
+      case COMP_GTE: return GTE;
+    }
+    return -1;
+  }
+
+  std::string ToString(tableEntry * value)
+  {
+    value = Operand(value);
+    if (!value) return "undefined";
+
+    std::stringstream ss;
+    switch (value->GetType()) {
+      case Type::VOID: return "undefined";
+      case Type::STRING: return value->GetStringValue();
+      case Type::NUMBER: ss << value->GetNumberValue(); break;
+      case Type::BOOL: return value->GetBoolValue() ? "true" : "false";
+      case Type::NLL: return "null";
+      case Type::FUNCTION:
+        ss << "function " << value->GetFunction()->GetName() << "() { [code] }";
+        break;
+      case Type::TYPED_ARRAY: {
+        typedArray * array = value->GetTypedArray();
+        for (unsigned int i = 0; i < array->GetLength(); i++) {
+          if (i > 0) ss << ",";
+          ss << array->GetElement(i);
+        }
+        break;
+      }
+    }
+    return ss.str();
+  }
+
+  double ToNumber(tableEntry * value)
+  {
+    value = Operand(value);
+    if (!value) return NAN;
+
+    switch (value->GetType()) {
+      case Type::NUMBER: return NumberOf<Type::NUMBER>(value);
+      case Type::BOOL: return NumberOf<Type::BOOL>(value);
+      case Type::STRING: return NumberOf<Type::STRING>(value);
+      case Type::NLL: return NumberOf<Type::NLL>(value);
+    }
+    return NAN;
+  }
+
+};
@@ -0,0 +1,53 @@
+#ifndef OPERATORS_H
+#define OPERATORS_H
+
+#include "symbol_table.h"
+
+#include <string>
+
+// Binary operators.  Each operator has a table of kernels indexed by the
+// types of its two operands, generated from templates when the program is
+// compiled, so running one is a single indirect call and every pair of
+// types has a defined result (following JavaScript's conversion rules).
+namespace Operators {
+  enum MathOps { ADD=0, SUB, MUL, DIV, MOD, NUM_MATH_OPS };
+  enum CompareOps { EQU=0, NEQU, SEQU, SNEQU, LESS, LTE, GTR, GTE, NUM_COMPARE_OPS };
+  const int NUM_TYPES = Type::FUNCTION + 1;
+
+  typedef void (*mathKernel)(tableEntry * out, tableEntry * a, tableEntry * b);
+  typedef bool (*compareKernel)(tableEntry * a, tableEntry * b);
+
+  // Indexed by [op][type of a][type of b]
+  extern const mathKernel * const math_kernels;
+  extern const compareKernel * const compare_kernels;
+
+  // Map an operator token ('+', COMP_LESS, ...) to its table, or -1.
+  int MathOp(int token);
+  int CompareOp(int token);
+
+  // The conversions the operators use, also behind String() and Number().
+  std::string ToString(tableEntry * value);
+  double ToNumber(tableEntry * value);
+
+  // Operands are followed through references, and a missing one (NULL) is
+  // undefined.
+  inline tableEntry * Operand(tableEntry * value) {
+    while (value && value->GetType() == Type::REFERENCE) value = value->GetReference();
+    return value;
+  }
+  inline int KernelIndex(int op, tableEntry * a, tableEntry * b) {
+    int type_a = a ? a->GetType() : (int) Type::VOID;
+    int type_b = b ? b->GetType() : (int) Type::VOID;
+    return (op * NUM_TYPES + type_a) * NUM_TYPES + type_b;
+  }
+
+  // Store a op b in out (as a number or a string).
+  inline void Math(int op, tableEntry * out, tableEntry * a, tableEntry * b) {
+    math_kernels[KernelIndex(op, a, b)](out, a, b);
+  }
+  inline bool Compare(int op, tableEntry * a, tableEntry * b) {
+    return compare_kernels[KernelIndex(op, a, b)](a, b);
+  }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PROPERTY_MAP_H
+#define PROPERTY_MAP_H
+
+#include "atom_table.h"
+
+#include <stdint.h>
+#include <vector>
+
+class tableEntry;
+
+// The property store of an object.  Entries live in a dense vector in
+// insertion order (the order for-in visits them), and an open-addressed
+// index table of entry positions makes lookups O(1).  Keys are atoms, so
+// probing compares integers and uses the hash the atom table already has.
+class propertyMap {
+public:
+  struct Entry {
+    uint32_t atom;
+    tableEntry * value;
+  };
+
+private:
+  std::vector<Entry> entries;   // Properties in insertion order
+  std::vector<uint32_t> slots;  // Entry position + 1 for each used slot, 0 if empty
+
+  // Find the slot holding atom, or the empty slot where it would go.
+  uint32_t FindSlot(uint32_t atom) const {
+    uint32_t mask = (uint32_t) slots.size() - 1;
+    uint32_t slot = atom_table.GetHash(atom) & mask;
+    while (slots[slot] != 0 && entries[slots[slot] - 1].atom != atom) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  // Double the index table (keeping it at most half full) and reinsert.
+  void Grow() {
+    size_t new_size = slots.empty() ? 8 : slots.size() * 2;
+    slots.assign(new_size, 0);
+
+    uint32_t mask = (uint32_t) new_size - 1;
+    for (uint32_t i = 0; i < (uint32_t) entries.size(); i++) {
+      uint32_t slot = atom_table.GetHash(entries[i].atom) & mask;
+      while (slots[slot] != 0) slot = (slot + 1) & mask;
+      slots[slot] = i + 1;
+    }
+  }
+
+public:
+  propertyMap() { ; }
+
+  int GetSize() const { return (int) entries.size(); }
+  size_t GetBytes() const {
+    return sizeof(*this) + entries.capacity() * sizeof(Entry) +
+           slots.capacity() * sizeof(uint32_t);
+  }
+  const Entry & GetEntry(int pos) const { return entries[pos]; }
+
+  // Return the value stored under atom, or NULL if there is none.
+  tableEntry * Get(uint32_t atom) const {
+    if (entries.empty()) return NULL;
+    uint32_t slot = FindSlot(atom);
+    if (slots[slot] == 0) return NULL;
+    return entries[slots[slot] - 1].value;
+  }
+
+  // Replace the value at position pos (in insertion order).
+  void SetValue(int pos, tableEntry * value) { entries[pos].value = value; }
+
+  // Store value under atom, keeping the original position of existing keys.
+  void Set(uint32_t atom, tableEntry * value) {
+    if (!slots.empty()) {
+      uint32_t slot = FindSlot(atom);
+      if (slots[slot] != 0) {
+        entries[slots[slot] - 1].value = value;
+        return;
+      }
+    }
+
+    Entry entry;
+    entry.atom = atom;
+    entry.value = value;
+    entries.push_back(entry);
+
+    if (entries.size() * 2 > slots.size()) Grow();
+    else slots[FindSlot(atom)] = (uint32_t) entries.size();
+  }
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "server.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+  const size_t MAX_FIELD_SIZE = 64 << 20;  // Largest script or binding accepted
+  const size_t READ_SIZE = 65536;
+
+  enum ParseResults { PARSE_INCOMPLETE=0, PARSE_DONE, PARSE_BAD };
+
+  // One client connection and the bytes it has sent that are not yet used.
+  struct connection {
+    int fd;
+    std::string pending;
+  };
+
+  // Split a field header into its words.
+  std::vector<std::string> SplitWords(const std::string & line) {
+    std::vector<std::string> words;
+    size_t start = 0;
+    while (start < line.size()) {
+      size_t end = line.find(' ', start);
+      if (end == std::string::npos) end = line.size();
+      if (end > start) words.push_back(line.substr(start, end - start));
+      start = end + 1;
+    }
+    return words;
+  }
+
+  // Read "<size>"; false unless it is a number no larger than max_size.
+  bool ParseSize(const std::string & word, size_t max_size, size_t & size) {
+    char * end = NULL;
+    unsigned long long value = strtoull(word.c_str(), &end, 10);
+    if (word == "" || *end != '\0' || value > max_size) return false;
+    size = (size_t) value;
+    return true;
+  }
+
+  // Parse the request that starts at pos in buffer into req.  On PARSE_DONE,
+  // end is where it finished.
+  int ParseRequest(const std::string & buffer, size_t pos, Server::request & req,
+                   size_t & end) {
+    while (true) {
+      size_t line_end = buffer.find('\n', pos);
+      if (line_end == std::string::npos) {
+        return buffer.size() - pos > 256 ? PARSE_BAD : PARSE_INCOMPLETE;
+      }
+      std::vector<std::string> words = SplitWords(buffer.substr(pos, line_end - pos));
+      pos = line_end + 1;
+
+      if (words.size() == 1 && words[0] == "run") {
+        if (req.path == "" && req.source == "") return PARSE_BAD;
+        end = pos;
+        return PARSE_DONE;
+      }
+
+      size_t size = 0;
+      if (words.size() < 2 || !ParseSize(words.back(), MAX_FIELD_SIZE, size)) {
+        return PARSE_BAD;
+      }
+      if (buffer.size() - pos < size) return PARSE_INCOMPLETE;
+      std::string value = buffer.substr(pos, size);
+      pos += size;
+
+      if (words[0] == "path" && words.size() == 2) req.path = value;
+      else if (words[0] == "source" && words.size() == 2) req.source = value;
+      else if (words[0] == "bind" && words.size() == 3) {
+        req.bindings.push_back(std::make_pair(words[1], value));
+      }
+      else return PARSE_BAD;
+    }
+  }
+
+  std::string FieldHeader(const std::string & key, size_t size) {
+    return key + " " + std::to_string((unsigned long long) size) + "\n";
+  }
+
+  // Write all of data, without dying of SIGPIPE if the peer has gone.
+  bool WriteAll(int fd, const std::string & data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t count = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR) continue;
+      if (count <= 0) return false;
+      done += count;
+    }
+    return true;
+  }
+
+  // Read more bytes into buffer; false at end of file or on an error.
+  bool ReadSome(int fd, std::string & buffer) {
+    char chunk[READ_SIZE];
+    ssize_t count;
+    do {
+      count = recv(fd, chunk, sizeof(chunk), 0);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) return false;
+    buffer.append(chunk, count);
+    return true;
+  }
+
+  // Fill in a socket address for path; false if path is too long.
+  bool SocketAddress(const std::string & path, sockaddr_un & address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+  }
+
+  // Run every complete request a client has sent.  Returns false if the
+  // connection should be closed.
+  bool AnswerRequests(connection & client, Server::handler run) {
+    size_t start = 0;
+    bool keep = true;
+    while (keep) {
+      Server::request req;
+      size_t end = 0;
+      int result = ParseRequest(client.pending, start, req, end);
+      if (result == PARSE_INCOMPLETE) break;
+      if (result == PARSE_BAD) {
+        std::string message = "malformed request\n";
+        WriteAll(client.fd, FieldHeader("error", message.size()) + message);
+        return false;
+      }
+
+      std::string output;
+      bool ok = run(req, output);
+      keep = WriteAll(client.fd, FieldHeader(ok ? "ok" : "error", output.size()) + output);
+      start = end;
+    }
+    client.pending.erase(0, start);
+    return keep;
+  }
+
+};
+
+// Server
+
+namespace Server {
+
+  bool Serve(const std::string & path, handler run, stopCheck stopping,
+             std::string & error)
+  {
+    sockaddr_un address;
+    if (!SocketAddress(path, address)) {
+      error = "socket path is too long";
+      return false;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+      error = strerror(errno);
+      return false;
+    }
+
+    // A socket file left by an earlier server that did not shut down would
+    // make bind() fail.
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+      error = strerror(errno);
+      close(listener);
+      return false;
+    }
+
+    std::vector<connection> clients;
+    while (!stopping()) {
+      std::vector<pollfd> waiting(clients.size() + 1);
+      waiting[0].fd = listener;
+      waiting[0].events = POLLIN;
+      for (size_t i = 0; i < clients.size(); i++) {
+        waiting[i + 1].fd = clients[i].fd;
+        waiting[i + 1].events = POLLIN;
+      }
+
+      if (poll(waiting.data(), waiting.size(), -1) < 0) {
+        if (errno == EINTR) continue;
+        error = strerror(errno);
+        break;
+      }
+
+      // Serve the clients that were ready before taking on new ones.
+      for (size_t i = clients.size(); i-- > 0; ) {
+        if (!waiting[i + 1].revents) continue;
+        if (!ReadSome(clients[i].fd, clients[i].pending) || !AnswerRequests(clients[i], run)) {
+          close(clients[i].fd);
+          clients.erase(clients.begin() + i);
+        }
+        if (stopping()) break;
+      }
+
+      if (waiting[0].revents & POLLIN) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) {
+          connection client;
+          client.fd = fd;
+          clients.push_back(client);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) close(clients[i].fd);
+    close(listener);
+    unlink(path.c_str());
+    return error == "";
+  }
+
+  int Connect(const std::string & path, std::string & error)
+  {
+    sockaddr_un address;
+    if (!SocketAddress(path, address)) {
+      error = "socket path is too long";
+      return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) != 0) {
+      error = strerror(errno);
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  bool Call(int fd, const request & req, bool & ok, std::string & output)
+  {
+    std::string message;
+    if (req.path != "") message += FieldHeader("path", req.path.size()) + req.path;
+    else message += FieldHeader("source", req.source.size()) + req.source;
+    for (size_t i = 0; i < req.bindings.size(); i++) {
+      message += FieldHeader("bind " + req.bindings[i].first, req.bindings[i].second.size());
+      message += req.bindings[i].second;
+    }
+    message += "run\n";
+    if (!WriteAll(fd, message)) return false;
+
+    // The answer is one header line and then its body.
+    std::string reply;
+    size_t line_end;
+    while ((line_end = reply.find('\n')) == std::string::npos) {
+      if (!ReadSome(fd, reply)) return false;
+    }
+    std::vector<std::string> words = SplitWords(reply.substr(0, line_end));
+    size_t size = 0;
+    if (words.size() != 2 || !ParseSize(words[1], (size_t) -1, size)) return false;
+    while (reply.size() - line_end - 1 < size) {
+      if (!ReadSome(fd, reply)) return false;
+    }
+
+    ok = words[0] == "ok";
+    output = reply.substr(line_end + 1, size);
+    return true;
+  }
+
+};
@@ -0,0 +1,45 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// The --serve protocol.  A client connects to a Unix domain socket and sends
+// requests, each a run of fields and then "run":
+//
+//   path <size>\n<script path>          run the script in this file, or
+//   source <size>\n<script text>        run this source text
+//   bind <name> <size>\n<JSON text>     set global <name> first (repeatable)
+//   run\n
+//
+// and gets back "ok <size>\n" or "error <size>\n" followed by everything the
+// script printed.  A connection may carry any number of requests; the server
+// answers them one at a time, in the order they arrive.
+namespace Server {
+  struct request {
+    std::string path;      // Script to run, or empty to run source
+    std::string source;
+    std::vector<std::pair<std::string, std::string> > bindings;  // Name, JSON
+  };
+
+  // Runs a request; returns false if the script failed.  output gets
+  // everything it printed.
+  typedef bool (*handler)(const request & req, std::string & output);
+  // True once the server should shut down.
+  typedef bool (*stopCheck)();
+
+  // Answer requests on a socket at path with run until stopping() turns true
+  // (it is checked after every request and whenever a signal arrives).
+  // Returns false and sets error if the socket cannot be set up.
+  bool Serve(const std::string & path, handler run, stopCheck stopping,
+             std::string & error);
+
+  // Client side, for load generators and tests.  Connect returns a socket,
+  // or -1 and sets error; Call sends one request and waits for its answer,
+  // returning false if the connection failed.
+  int Connect(const std::string & path, std::string & error);
+  bool Call(int fd, const request & req, bool & ok, std::string & output);
+};
+
+#endif
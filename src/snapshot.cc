@@ -0,0 +1,466 @@
+#include "snapshot.h"
+#include "operators.h"
+#include "symbol_table.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  const char MAGIC[4] = { 'V', '9', 'S', 'N' };
+  const size_t DATA_ALIGN = 8;
+
+  struct snapshotHeader {
+    char magic[4];
+    uint32_t format_version;
+    uint32_t num_names;
+    uint32_t num_globals;
+    uint32_t num_values;
+    uint32_t num_links;
+    uint64_t strings_size;
+    uint64_t data_size;
+  };
+
+  struct nameRecord {
+    uint64_t offset;  // In the string pool
+    uint64_t length;
+  };
+
+  struct globalRecord {
+    uint32_t name;
+    uint32_t value;
+  };
+
+  struct valueRecord {
+    int32_t type;
+    int32_t kind;     // BOOL: the value; TYPED_ARRAY: the element kind
+    double number;    // NUMBER
+    uint32_t count;   // OBJECT, ARRAY: links; TYPED_ARRAY: elements
+    uint64_t start;   // OBJECT, ARRAY: first link; STRING: offset in strings;
+                      // TYPED_ARRAY: offset in data
+    uint64_t length;  // STRING: bytes
+  };
+
+  struct linkRecord {
+    uint32_t key;     // OBJECT: name of the property; ARRAY: index of the element
+    uint32_t value;
+  };
+
+  // Where each section of a checked snapshot starts.
+  struct snapshotView {
+    const snapshotHeader * header;
+    const nameRecord * names;
+    const globalRecord * globals;
+    const valueRecord * values;
+    const linkRecord * links;
+    const char * strings;
+    const char * data;
+  };
+
+  // The mapped snapshot, kept for the life of the process so each script in
+  // a batch restores from it.
+  const char * mapped = NULL;
+  snapshotView view;
+
+  size_t AlignData(size_t offset) {
+    return (offset + DATA_ALIGN - 1) & ~(DATA_ALIGN - 1);
+  }
+
+  size_t TypedElementBytes(int kind) {
+    return kind == typedArray::FLOAT64 ? sizeof(double) : sizeof(int32_t);
+  }
+
+  // Builds a snapshot of the values reachable from the globals.  Values are
+  // numbered in the order they are found; seen maps each entry already
+  // numbered to its record, so shared values stay shared and cycles end.
+  class snapshotWriter {
+  private:
+    std::vector<nameRecord> names;
+    std::map<uint32_t, uint32_t> name_ids;  // Atom to name record
+    std::vector<globalRecord> globals;
+    std::vector<valueRecord> values;
+    std::vector<linkRecord> links;
+    std::string strings;
+    std::string data;
+    std::map<tableEntry *, uint32_t> seen;
+
+    uint32_t AddName(uint32_t atom) {
+      std::map<uint32_t, uint32_t>::iterator it = name_ids.find(atom);
+      if (it != name_ids.end()) return it->second;
+
+      const std::string & name = atom_table.GetName(atom);
+      nameRecord record;
+      record.offset = strings.size();
+      record.length = name.size();
+      strings += name;
+      names.push_back(record);
+      name_ids[atom] = names.size() - 1;
+      return names.size() - 1;
+    }
+
+  public:
+    // Number value and everything it refers to.  Returns false and sets
+    // error if it holds a function.
+    bool AddValue(tableEntry * value, uint32_t & id, std::string & error) {
+      value = Operators::Operand(value);
+      std::map<tableEntry *, uint32_t>::iterator it = seen.find(value);
+      if (value && it != seen.end()) {
+        id = it->second;
+        return true;
+      }
+
+      valueRecord record;
+      memset(&record, 0, sizeof(record));
+      record.type = value ? value->GetType() : (int) Type::VOID;
+      id = values.size();
+      values.push_back(record);
+      if (!value) return true;
+      seen[value] = id;
+
+      std::vector<linkRecord> own_links;
+      switch (record.type) {
+        case Type::NUMBER:
+          record.number = value->GetNumberValue();
+          break;
+        case Type::BOOL:
+          record.kind = value->GetBoolValue();
+          break;
+        case Type::STRING:
+          record.start = strings.size();
+          record.length = value->GetStringValue().size();
+          strings += value->GetStringValue();
+          break;
+        case Type::TYPED_ARRAY: {
+          typedArray * array = value->GetTypedArray();
+          size_t bytes = array->GetLength() * TypedElementBytes(array->GetKind());
+          data.resize(AlignData(data.size()));
+          record.kind = array->GetKind();
+          record.count = array->GetLength();
+          record.start = data.size();
+          data.append((const char *) array->GetFloat64Data(), bytes);
+          break;
+        }
+        case Type::OBJECT: {
+          propertyMap * props = value->GetPropertyMap();
+          for (int i = 0; i < props->GetSize(); i++) {
+            linkRecord link;
+            link.key = AddName(props->GetEntry(i).atom);
+            if (!AddValue(props->GetEntry(i).value, link.value, error)) return false;
+            own_links.push_back(link);
+          }
+          break;
+        }
+        case Type::ARRAY: {
+          std::map<unsigned int, tableEntry *> * elements = value->GetArray();
+          for (std::map<unsigned int, tableEntry *>::iterator element = elements->begin();
+               element != elements->end(); element++) {
+            linkRecord link;
+            link.key = element->first;
+            if (!AddValue(element->second, link.value, error)) return false;
+            own_links.push_back(link);
+          }
+          break;
+        }
+        case Type::FUNCTION:
+          error = "functions cannot be saved in a snapshot";
+          return false;
+      }
+
+      // Children were numbered (and their links written) first, so this
+      // container's links go in one run after theirs.
+      if (record.type == Type::OBJECT || record.type == Type::ARRAY) {
+        record.start = links.size();
+        record.count = own_links.size();
+        links.insert(links.end(), own_links.begin(), own_links.end());
+      }
+      values[id] = record;
+      return true;
+    }
+
+    bool AddGlobal(tableEntry * var, std::string & error) {
+      globalRecord record;
+      record.name = AddName(var->GetAtom());
+      if (!AddValue(var, record.value, error)) {
+        error += " (in '" + var->GetName() + "')";
+        return false;
+      }
+      globals.push_back(record);
+      return true;
+    }
+
+    std::string BuildImage() const {
+      snapshotHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.format_version = Snapshot::FORMAT_VERSION;
+      header.num_names = names.size();
+      header.num_globals = globals.size();
+      header.num_values = values.size();
+      header.num_links = links.size();
+      header.strings_size = strings.size();
+      header.data_size = data.size();
+
+      std::string image((const char *) &header, sizeof(header));
+      image.append((const char *) names.data(), names.size() * sizeof(nameRecord));
+      image.append((const char *) globals.data(), globals.size() * sizeof(globalRecord));
+      image.append((const char *) values.data(), values.size() * sizeof(valueRecord));
+      image.append((const char *) links.data(), links.size() * sizeof(linkRecord));
+      image += strings;
+      image.resize(AlignData(image.size()));
+      image += data;
+      return image;
+    }
+  };
+
+  // Find the sections of a snapshot image and check that every index and
+  // offset in it stays inside the image.
+  bool CheckImage(const char * start, size_t size, snapshotView & out) {
+    if (size < sizeof(snapshotHeader)) return false;
+    const snapshotHeader * header = (const snapshotHeader *) start;
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header->format_version != Snapshot::FORMAT_VERSION) {
+      return false;
+    }
+
+    uint64_t pos = sizeof(snapshotHeader);
+    uint64_t names_at = pos;
+    pos += (uint64_t) header->num_names * sizeof(nameRecord);
+    uint64_t globals_at = pos;
+    pos += (uint64_t) header->num_globals * sizeof(globalRecord);
+    uint64_t values_at = pos;
+    pos += (uint64_t) header->num_values * sizeof(valueRecord);
+    uint64_t links_at = pos;
+    pos += (uint64_t) header->num_links * sizeof(linkRecord);
+    uint64_t strings_at = pos;
+    if (header->strings_size > size || pos + header->strings_size > size) return false;
+    pos = AlignData(pos + header->strings_size);
+    uint64_t data_at = pos;
+    if (header->data_size > size || pos + header->data_size != size) return false;
+
+    out.header = header;
+    out.names = (const nameRecord *) (start + names_at);
+    out.globals = (const globalRecord *) (start + globals_at);
+    out.values = (const valueRecord *) (start + values_at);
+    out.links = (const linkRecord *) (start + links_at);
+    out.strings = start + strings_at;
+    out.data = start + data_at;
+
+    for (uint32_t i = 0; i < header->num_names; i++) {
+      const nameRecord & name = out.names[i];
+      if (name.offset > header->strings_size ||
+          name.length > header->strings_size - name.offset) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header->num_globals; i++) {
+      if (out.globals[i].name >= header->num_names ||
+          out.globals[i].value >= header->num_values) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < header->num_values; i++) {
+      const valueRecord & value = out.values[i];
+      switch (value.type) {
+        case Type::VOID: case Type::NUMBER: case Type::BOOL: case Type::NLL:
+          break;
+        case Type::STRING:
+          if (value.start > header->strings_size ||
+              value.length > header->strings_size - value.start) {
+            return false;
+          }
+          break;
+        case Type::TYPED_ARRAY:
+          if ((value.kind != typedArray::FLOAT64 && value.kind != typedArray::INT32) ||
+              value.start % DATA_ALIGN != 0 || value.start > header->data_size ||
+              (uint64_t) value.count * TypedElementBytes(value.kind) >
+                header->data_size - value.start) {
+            return false;
+          }
+          break;
+        case Type::OBJECT: case Type::ARRAY:
+          if (value.start > header->num_links ||
+              value.count > header->num_links - value.start) {
+            return false;
+          }
+          for (uint32_t j = 0; j < value.count; j++) {
+            const linkRecord & link = out.links[value.start + j];
+            if (link.value >= header->num_values) return false;
+            if (value.type == Type::OBJECT && link.key >= header->num_names) return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+    return true;
+  }
+
+  std::string Name(uint32_t id) {
+    const nameRecord & name = view.names[id];
+    return std::string(view.strings + name.offset, name.length);
+  }
+
+};
+
+// Snapshot
+
+namespace Snapshot {
+
+  bool Write(const std::string & path, symbolTable & table,
+             std::vector<std::string> & skipped, std::string & error)
+  {
+    // The globals are the variables still visible at the top level.
+    snapshotWriter writer;
+    const std::vector<tableEntry *> & vars = table.GetScopeVars(0);
+    for (size_t i = 0; i < vars.size(); i++) {
+      tableEntry * var = vars[i];
+      if (table.Lookup(var->GetAtom()) != var) continue;  // Shadowed
+      tableEntry * value = Operators::Operand(var);
+      if (value && value->GetType() == Type::FUNCTION) {
+        skipped.push_back(var->GetName());
+        continue;
+      }
+      if (!writer.AddGlobal(var, error)) return false;
+    }
+
+    // Write to a temporary file and rename it into place, so a run starting
+    // meanwhile never maps a half-written snapshot.
+    std::string image = writer.BuildImage();
+    std::string temp_path = path + ".tmp." + std::to_string((long long) getpid());
+    FILE * file = fopen(temp_path.c_str(), "wb");
+    if (!file) {
+      error = "cannot write '" + path + "': " + strerror(errno);
+      return false;
+    }
+    bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+      error = "cannot write '" + path + "': " + strerror(errno);
+      unlink(temp_path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool Open(const std::string & path, std::string & error)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error = "cannot read '" + path + "': " + strerror(errno);
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(snapshotHeader)) {
+      close(fd);
+      error = "'" + path + "' is not a snapshot";
+      return false;
+    }
+
+    void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      error = "cannot map '" + path + "': " + strerror(errno);
+      return false;
+    }
+    if (!CheckImage((const char *) data, info.st_size, view)) {
+      munmap(data, info.st_size);
+      error = "'" + path + "' is not a snapshot from this version of v9, or is damaged";
+      return false;
+    }
+
+    mapped = (const char *) data;
+    return true;
+  }
+
+  bool IsOpen()
+  {
+    return mapped != NULL;
+  }
+
+  int Restore(symbolTable & table)
+  {
+    if (!mapped) return 0;
+    const snapshotHeader * header = view.header;
+
+    // Keys are interned once, however many objects use them.
+    std::vector<uint32_t> atoms(header->num_names);
+    for (uint32_t i = 0; i < header->num_names; i++) atoms[i] = atom_table.Intern(Name(i));
+
+    // Create every value first, then link the containers, so links can
+    // point forwards and around cycles.
+    std::vector<tableEntry *> entries(header->num_values);
+    for (uint32_t i = 0; i < header->num_values; i++) {
+      const valueRecord & record = view.values[i];
+      tableEntry * entry = entries[i] = table.AddTempEntry(record.type);
+      switch (record.type) {
+        case Type::NUMBER: entry->SetNumberValue(record.number); break;
+        case Type::BOOL: entry->SetBoolValue(record.kind != 0); break;
+        case Type::STRING:
+          entry->SetStringValue(std::string(view.strings + record.start, record.length));
+          break;
+        case Type::TYPED_ARRAY:
+          entry->InitializeTypedArray(record.kind, record.count);
+          memcpy(entry->GetTypedArray()->GetFloat64Data(), view.data + record.start,
+                 record.count * TypedElementBytes(record.kind));
+          break;
+        case Type::OBJECT: entry->InitializeObject(); break;
+        case Type::ARRAY: entry->InitializeArray(); break;
+      }
+    }
+
+    for (uint32_t i = 0; i < header->num_values; i++) {
+      const valueRecord & record = view.values[i];
+      const linkRecord * links = view.links + record.start;
+      if (record.type == Type::OBJECT) {
+        for (uint32_t j = 0; j < record.count; j++) {
+          entries[i]->SetProperty(atoms[links[j].key], entries[links[j].value]);
+        }
+      }
+      else if (record.type == Type::ARRAY) {
+        std::map<unsigned int, tableEntry *> * elements = entries[i]->GetArray();
+        for (uint32_t j = 0; j < record.count; j++) {
+          elements->insert(elements->end(), std::make_pair(links[j].key, entries[links[j].value]));
+        }
+      }
+    }
+
+    // Containers are shared by reference, as assignment shares them;
+    // anything else is copied into the global.
+    for (uint32_t i = 0; i < header->num_globals; i++) {
+      const globalRecord & global = view.globals[i];
+      tableEntry * value = entries[global.value];
+      tableEntry * var = table.AddPreloaded(Type::VOID, Name(global.name));
+      switch (value->GetType()) {
+        case Type::OBJECT: case Type::ARRAY: case Type::TYPED_ARRAY:
+          var->SetType(Type::REFERENCE);
+          var->SetReference(value);
+          break;
+        case Type::STRING:
+          var->SetType(Type::STRING);
+          var->SetStringValue(value->GetStringValue());
+          break;
+        case Type::NUMBER:
+          var->SetType(Type::NUMBER);
+          var->SetNumberValue(value->GetNumberValue());
+          break;
+        case Type::BOOL:
+          var->SetType(Type::BOOL);
+          var->SetBoolValue(value->GetBoolValue());
+          break;
+        default:
+          var->SetType(value->GetType());
+          break;
+      }
+    }
+    return header->num_globals;
+  }
+
+};
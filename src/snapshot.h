@@ -0,0 +1,50 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class symbolTable;
+
+// Startup snapshots.  --make-snapshot runs a prelude script and saves its
+// global scope: each global's value and every object, array, typed array
+// and string it refers to, with shared values kept shared.  --snapshot maps
+// the file and declares those globals again before each script is parsed,
+// so the script can use them as if it had run the prelude itself.
+//
+// The file is a header followed by arrays of fixed-size records and two
+// pools, all addressed by index or offset, so it is read in place from the
+// mapping with no parsing step:
+//
+//   names    (offset, length) of each global name and property key
+//   globals  (name, value) for each global
+//   values   one record per value: its type and number, or where its string,
+//            links or typed array data are
+//   links    (key, value) for each property or element, a run per container
+//   strings  the bytes of every name and string value
+//   data     typed array elements, 8-byte aligned
+//
+// Functions are not saved: globals that hold one are skipped, and a
+// function anywhere else is an error.
+namespace Snapshot {
+  // Bump whenever the layout of the file changes.
+  const uint32_t FORMAT_VERSION = 2;
+
+  // Write the globals of table to path.  The names of globals skipped
+  // because they hold functions are added to skipped.  Returns false and
+  // sets error if the snapshot cannot be written.
+  bool Write(const std::string & path, symbolTable & table,
+             std::vector<std::string> & skipped, std::string & error);
+
+  // Map the snapshot at path and check it, for Restore().  Returns false and
+  // sets error if it cannot be read or is damaged.
+  bool Open(const std::string & path, std::string & error);
+  bool IsOpen();
+
+  // Declare the open snapshot's globals in table, with their values.
+  // Returns the number of globals restored.
+  int Restore(symbolTable & table);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+// An unbounded single-producer, single-consumer queue.  Items are stored in
+// fixed-size segments linked in order: the producer fills the last segment
+// and links a new one when it is full, and the consumer frees each segment
+// once it has read past it.  Neither side ever takes a lock; the producer
+// publishes each item with a release store of its count, which the consumer
+// reads with an acquire load.  Push() must only be called by one thread and
+// Pop() by one (possibly different) thread.
+template <typename T>
+class spscQueue {
+private:
+  static const size_t SEGMENT_SIZE = 256;
+
+  struct segment {
+    T items[SEGMENT_SIZE];
+    std::atomic<segment *> next;
+    segment() : next(NULL) { ; }
+  };
+
+  // A full cache line of padding after each side keeps the two sides, and
+  // whatever follows the queue, off each other's lines.  Padding rather than
+  // alignas, since a C++11 new ignores alignments beyond the default.
+  static const size_t CACHE_LINE = 64;
+
+  std::atomic<uint64_t> pushed;  // Items published so far
+  segment * write_segment;       // Producer only
+  size_t write_pos;
+  char write_pad[CACHE_LINE];
+
+  uint64_t popped;               // Consumer only
+  segment * read_segment;
+  size_t read_pos;
+  char read_pad[CACHE_LINE];
+
+  spscQueue(const spscQueue &);
+  spscQueue & operator=(const spscQueue &);
+
+public:
+  spscQueue() : pushed(0), write_pos(0), popped(0), read_pos(0) {
+    write_segment = read_segment = new segment;
+  }
+  ~spscQueue() {
+    while (read_segment) {
+      segment * next = read_segment->next.load(std::memory_order_relaxed);
+      delete read_segment;
+      read_segment = next;
+    }
+  }
+
+  void Push(const T & item) {
+    if (write_pos == SEGMENT_SIZE) {
+      segment * fresh = new segment;
+      write_segment->next.store(fresh, std::memory_order_release);
+      write_segment = fresh;
+      write_pos = 0;
+    }
+    write_segment->items[write_pos++] = item;
+    pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Take the oldest item; false if the queue is empty.
+  bool Pop(T & item) {
+    if (popped == pushed.load(std::memory_order_acquire)) return false;
+    if (read_pos == SEGMENT_SIZE) {
+      // The producer linked the next segment before publishing its first item.
+      segment * next = read_segment->next.load(std::memory_order_acquire);
+      delete read_segment;
+      read_segment = next;
+      read_pos = 0;
+    }
+    item = read_segment->items[read_pos++];
+    popped++;
+    return true;
+  }
+};
+
+#endif
@@ -3,36 +3,147 @@
 
 #include "type_info.h"
 #include "table_entry.h"
+#include "trace.h"
 
 #include <list>
+#include <new>
+#include <utility>
 
 // Interacted with by the rest of the code to look up information about variables
 class symbolTable {
+public:
+  // How the statement that just ran finished; anything but NORMAL unwinds
+  // the enclosing blocks and loops up to whatever handles it.  Nothing
+  // handles HALT (the execution budget ran out), so it ends the program.
+  enum Completions { NORMAL=0, BREAK, CONTINUE, RETURN, HALT };
+
 private:
-  std::map<std::string, tableEntry *> tbl_map;          // A map of active variables
+  // A function local, resolved at parse time to a slot in the function's frame
+  struct localVar {
+    uint32_t name;  // Atom
+    int slot;
+    int scope;
+  };
+
+  std::vector<tableEntry *> tbl_map;                    // Active variable for each atom, or NULL
   std::vector<std::vector<tableEntry *> *> scope_info;  // Variables declared in each scope
   std::vector<tableEntry *> var_archive;                // Variables that are out of scope
   std::list<tableEntry *> temp_list;                    // List of temporary table entries
   int cur_scope;                                        // Current scope level
 
-public:
-  symbolTable() : cur_scope(0) {
-    scope_info.push_back(new std::vector<tableEntry *>);
-  }
-  ~symbolTable() {
-    // Clean up all variable entries
+  bool in_function;                // Parsing a function body?
+  std::vector<localVar> locals;    // Visible locals of that function, innermost last
+  int frame_size;                  // Slots used so far by that function's frame
+
+  tableEntry * call_stack;         // Activation records of the running functions
+  int stack_size;                  // Number of slots in call_stack
+  int stack_built;                 // Slots constructed so far; see ReserveFrame()
+  int frame_base;                  // First slot of the running function's frame
+  int stack_top;                   // First unused slot
+  int call_depth;                  // Number of frames entered
+
+  int completion;                  // Completion of the last statement run
+  tableEntry * return_value;       // Value of a pending return
+
+  bool parallel;                   // Running a callback on several threads at once?
+  std::vector<symbolTable *> parallel_tables;  // See GetParallelTable()
+
+  // Delete every variable and temporary entry and their values, leaving no
+  // scopes.
+  void FreeEntries() {
     while (cur_scope >= 0) DecScope();
-    for (int i = 0; i < (int) var_archive.size(); i++) delete var_archive[i];
+    for (int i = 0; i < (int) var_archive.size(); i++) {
+      var_archive[i]->FreeValue();
+      delete var_archive[i];
+    }
+    var_archive.clear();
 
-    // Clean up temporary entries
     for (std::list<tableEntry *>::iterator it = temp_list.begin();
          it != temp_list.end(); it++) {
+      (*it)->FreeValue();
       delete *it;
     }
+    temp_list.clear();
   }
 
-  int GetSize() const { return (int) tbl_map.size(); }
+public:
+  static const int CALL_STACK_SLOTS = 1 << 18;
+  static const int MAX_CALL_DEPTH = 10000;  // Keeps the interpreter's own stack in bounds
+
+  symbolTable()
+    : cur_scope(0), in_function(false), frame_size(0), call_stack(NULL)
+    , stack_size(0), stack_built(0), frame_base(0), stack_top(0), call_depth(0)
+    , completion(NORMAL), return_value(NULL), parallel(false)
+  {
+    scope_info.push_back(new std::vector<tableEntry *>);
+  }
+  ~symbolTable() {
+    Trace::timestamp start = Trace::enabled ? Trace::Now() : 0;
+    FreeEntries();
+    for (int i = 0; i < stack_built; i++) {
+      call_stack[i].FreeValue();
+      call_stack[i].~tableEntry();
+    }
+    ::operator delete(call_stack);
+    for (int i = 0; i < (int) parallel_tables.size(); i++) delete parallel_tables[i];
+    Trace::LongSpan("~symbolTable", "teardown", start);
+  }
+
+  // Start over with an empty global scope, as for a new script.  The call
+  // stack is kept for reuse.
+  void Reset() {
+    FreeEntries();
+    scope_info.push_back(new std::vector<tableEntry *>);
+    cur_scope = 0;
+    in_function = false;
+    locals.clear();
+    frame_size = 0;
+    frame_base = stack_top = call_depth = 0;
+    completion = NORMAL;
+    return_value = NULL;
+    parallel = false;
+    for (int i = 0; i < (int) parallel_tables.size(); i++) {
+      parallel_tables[i]->Reset();
+      parallel_tables[i]->SetParallel(true);
+    }
+  }
+
+  // Trade every variable, temporary and frame with other, so the parser,
+  // which declares into the global table, can fill in a worker's table.
+  void Swap(symbolTable & other) {
+    tbl_map.swap(other.tbl_map);
+    scope_info.swap(other.scope_info);
+    var_archive.swap(other.var_archive);
+    temp_list.swap(other.temp_list);
+    std::swap(cur_scope, other.cur_scope);
+    std::swap(in_function, other.in_function);
+    locals.swap(other.locals);
+    std::swap(frame_size, other.frame_size);
+    std::swap(call_stack, other.call_stack);
+    std::swap(stack_size, other.stack_size);
+    std::swap(stack_built, other.stack_built);
+    std::swap(frame_base, other.frame_base);
+    std::swap(stack_top, other.stack_top);
+    std::swap(call_depth, other.call_depth);
+    std::swap(completion, other.completion);
+    std::swap(return_value, other.return_value);
+    std::swap(parallel, other.parallel);
+    parallel_tables.swap(other.parallel_tables);
+  }
+
+  // Take over every temporary entry of other (the values of a message, say),
+  // so they now live and die with this table.
+  void AdoptTemps(symbolTable & other) {
+    temp_list.splice(temp_list.end(), other.temp_list);
+  }
+
+  int GetSize() const {
+    int size = 0;
+    for (int i = 0; i < (int) tbl_map.size(); i++) if (tbl_map[i]) size++;
+    return size;
+  }
   int GetCurScope() const { return cur_scope; }
+  const std::list<tableEntry *> & GetTemps() const { return temp_list; }
   const std::vector<tableEntry *> & GetScopeVars(int scope) {
     if (scope < 0 || scope >= (int) scope_info.size()) {
       std::cerr << "Internal Compiler Error: Requesting vars from scope #" << scope
@@ -55,58 +166,191 @@ public:
     for (int i = 0; i < (int) old_scope->size(); i++) {
       tableEntry * old_entry = (*old_scope)[i];
 
-      // If this entry is shadowing another, make shadowed version active again.
-      if (old_entry->GetNext() != NULL) {
-        tbl_map[old_entry->GetName()] = old_entry->GetNext();
-      }
-
-      // Otherwise just remove it from being an active variable name.
-      else {
-        tbl_map.erase(old_entry->GetName());
-      }
+      // If this entry is shadowing another, make shadowed version active
+      // again; otherwise the name is no longer active.
+      tbl_map[old_entry->GetAtom()] = old_entry->GetNext();
     }
 
     delete old_scope;
     cur_scope--;
+
+    // Locals declared in the old scope are no longer visible (their slots
+    // stay reserved in the frame).
+    while (!locals.empty() && locals.back().scope > cur_scope) locals.pop_back();
   }
 
   // Lookup will find an entry and return it.  If that entry is not in the table, it will return NULL
-  tableEntry * Lookup(std::string in_name) {
-    if (tbl_map.find(in_name) == tbl_map.end()) return NULL;
-    return tbl_map[in_name];
+  tableEntry * Lookup(uint32_t atom) const {
+    return atom < tbl_map.size() ? tbl_map[atom] : NULL;
+  }
+  tableEntry * Lookup(const std::string & in_name) const {
+    uint32_t atom = atom_table.Find(in_name);
+    return atom == atomTable::NONE ? NULL : Lookup(atom);
   }
 
   // Determine if a variable has been declared in the current scope.
-  bool InCurScope(std::string in_name) {
-    if (tbl_map.find(in_name) == tbl_map.end()) return false;
-    return tbl_map[in_name]->GetScope() == cur_scope;
+  bool InCurScope(const std::string & in_name) const {
+    tableEntry * entry = Lookup(in_name);
+    return entry && entry->GetScope() == cur_scope;
   }
 
   // Insert an entry into the symbol table.
-  tableEntry * AddEntry(int in_type, std::string in_name) {
+  tableEntry * AddEntry(int in_type, const std::string & in_name) {
     // Create the new entry for this variable.
-    tableEntry * new_entry = new tableEntry(in_type, in_name);
+    uint32_t atom = atom_table.Intern(in_name);
+    tableEntry * new_entry = new tableEntry(in_type, atom);
 
     // If an old entry exists by this name, shadow it.
-    tableEntry * old_entry = Lookup(in_name);
+    tableEntry * old_entry = Lookup(atom);
     if (old_entry) new_entry->SetNext(old_entry);
 
     // Save the information for the new entry.
-    tbl_map[in_name] = new_entry;
+    if (atom >= tbl_map.size()) tbl_map.resize(atom_table.GetSize(), NULL);
+    tbl_map[atom] = new_entry;
     scope_info[cur_scope]->push_back(new_entry);
+    if (HeapProfile::tracking) HeapProfile::Allocated(new_entry, sizeof(tableEntry));
+    return new_entry;
+  }
+
+  // Scope of the globals restored from a startup snapshot.  A script's own
+  // 'var' of the same name shadows one rather than redeclaring it.
+  static const int PRELOADED = -2;
+
+  // Insert a global restored from a snapshot, before the script is parsed.
+  tableEntry * AddPreloaded(int in_type, const std::string & in_name) {
+    tableEntry * new_entry = AddEntry(in_type, in_name);
+    new_entry->SetScope(PRELOADED);
     return new_entry;
   }
 
+  // The restored global by this name, even if the script shadows it.
+  tableEntry * LookupPreloaded(const std::string & in_name) const {
+    tableEntry * entry = Lookup(in_name);
+    while (entry && entry->GetScope() != PRELOADED) entry = entry->GetNext();
+    return entry;
+  }
+
   // Insert a temp variable entry into the symbol table.
   tableEntry * AddTempEntry(int in_type) {
     tableEntry * new_entry = new tableEntry(in_type);
     temp_list.push_back(new_entry);
+    if (HeapProfile::tracking) HeapProfile::Allocated(new_entry, sizeof(tableEntry));
     return new_entry;
   }
 
   void RemoveEntry(tableEntry * del_var) {
+    // Call stack slots belong to their frame, not to the table.
+    if (OnStack(del_var)) return;
+    if (HeapProfile::tracking) HeapProfile::Freed(del_var);
     delete del_var;
   }
+
+  // Parse time: track the locals of a function declaration.  Parameters and
+  // 'var' declarations in the body each get a slot in its frame, as do the
+  // results of calls, operators and literals in the body.
+  void BeginFunction() {
+    in_function = true;
+    locals.clear();
+    frame_size = 0;
+  }
+  // Finish the function and return the size of its frame.
+  int EndFunction() {
+    in_function = false;
+    locals.clear();
+    return frame_size;
+  }
+  bool InFunction() const { return in_function; }
+  int GetFrameSize() const { return frame_size; }
+
+  int AddLocal(const std::string & in_name) {
+    localVar local;
+    local.name = atom_table.Intern(in_name);
+    local.slot = frame_size++;
+    local.scope = cur_scope;
+    locals.push_back(local);
+    return local.slot;
+  }
+  int AddResultSlot() { return frame_size++; }
+
+  // Find the frame slot of a visible local, or -1 if there is none.
+  int LookupLocal(const std::string & in_name) const {
+    uint32_t atom = atom_table.Find(in_name);
+    for (int i = (int) locals.size() - 1; i >= 0; i--) {
+      if (locals[i].name == atom) return locals[i].slot;
+    }
+    return -1;
+  }
+  bool LocalInCurScope(const std::string & in_name) const {
+    uint32_t atom = atom_table.Find(in_name);
+    for (int i = (int) locals.size() - 1; i >= 0 && locals[i].scope == cur_scope; i--) {
+      if (locals[i].name == atom) return true;
+    }
+    return false;
+  }
+
+  // Run time: activation records are contiguous runs of slots on one stack,
+  // so a call never allocates.  ReserveFrame claims a cleared frame on top
+  // of the stack (returning its base, or -1 on overflow), freeing any string
+  // a slot still holds from an earlier call; EnterFrame makes it current and
+  // returns the caller's base for LeaveFrame to restore.  Slots are built the
+  // first time the stack grows over them, so the pages of the stack beyond
+  // the deepest call so far are never touched.
+  int ReserveFrame(int size) {
+    if (!call_stack) {
+      call_stack = (tableEntry *) ::operator new(sizeof(tableEntry) * CALL_STACK_SLOTS);
+      stack_size = CALL_STACK_SLOTS;
+    }
+    if (stack_top + size > stack_size || call_depth >= MAX_CALL_DEPTH) return -1;
+
+    int base = stack_top;
+    for (; stack_built < base + size; stack_built++) new (call_stack + stack_built) tableEntry();
+    for (int i = base; i < base + size; i++) {
+      call_stack[i].FreeValue();
+      call_stack[i].SetType(Type::VOID);
+    }
+    stack_top += size;
+    return base;
+  }
+  int EnterFrame(int base) {
+    int old_base = frame_base;
+    frame_base = base;
+    call_depth++;
+    return old_base;
+  }
+  void LeaveFrame(int old_base, int base) {
+    frame_base = old_base;
+    stack_top = base;
+    call_depth--;
+  }
+  tableEntry * GetSlot(int index) { return call_stack + index; }
+  int GetCallDepth() const { return call_depth; }
+  int GetStackTop() const { return stack_top; }
+  tableEntry * GetLocal(int slot) { return call_stack + frame_base + slot; }
+  bool OnStack(const tableEntry * entry) const {
+    return call_stack && entry >= call_stack && entry < call_stack + stack_size;
+  }
+
+  int GetCompletion() const { return completion; }
+  void SetCompletion(int in_completion) { completion = in_completion; }
+  tableEntry * GetReturnValue() const { return return_value; }
+  void SetReturnValue(tableEntry * value) { return_value = value; }
+
+  // While parallel, the nodes being run are shared with other threads, so
+  // they must not keep per-node state (such as cached result entries).
+  bool InParallel() const { return parallel; }
+  void SetParallel(bool in_parallel) { parallel = in_parallel; }
+
+  // The table pool thread number thread (from 1) runs a parallel builtin's
+  // callbacks in.  The entries made there end up in the builtin's results,
+  // so they are kept until this table is reset.
+  symbolTable * GetParallelTable(int thread) {
+    while ((int) parallel_tables.size() < thread) {
+      symbolTable * worker_table = new symbolTable;
+      worker_table->SetParallel(true);
+      parallel_tables.push_back(worker_table);
+    }
+    return parallel_tables[thread - 1];
+  }
 };
 
 #endif
@@ -6,90 +6,179 @@
 #include <map>
 #include <string>
 #include <sstream>
+#include <utility>
 #include <vector>
 
+#include "heap_profile.h"
+#include "property_map.h"
+#include "type_info.h"
+#include "typed_array.h"
+
 class symbolTable;
+class ASTNode_Function;
 
 // All of the stored information about a single variable
 class tableEntry {
   friend class symbolTable;
 protected:
   int type_id;       // What is the type of this variable?
-  std::string name;  // Variable name used by sourcecode.
+  uint32_t name;     // Atom of the variable name used by sourcecode.
   int scope;         // What scope was this variable declared at?
   bool is_temp;      // Is this variable just temporary (internal to compiler)
   tableEntry * next; // A pointer to another variable that this one is shadowing
 
   union {
-    float n;
+    double n;
     bool b;
     std::string * s;
-    std::map<std::string, tableEntry*> * o;
+    propertyMap * o;
     std::map<unsigned int, tableEntry*> * a;
     tableEntry * r;
+    typedArray * t;
+    ASTNode_Function * f;
   };
 
+  // Unnamed, undefined entry (used for call stack slots)
+  tableEntry()
+    : type_id(0)
+    , name(atomTable::EMPTY)
+    , scope(-1)
+    , is_temp(true)
+    , next(NULL)
+    , s(NULL)
+  {
+  }
+
   tableEntry(int in_type)
     : type_id (in_type)
-    , name("__TEMP__")
+    , name(atomTable::TEMP)
     , scope(-1)
     , is_temp(true)
     , next(NULL)
+    , s(NULL)
   {
   }
 
-  tableEntry(int in_type, const std::string in_name)
+  tableEntry(int in_type, uint32_t in_name)
     : type_id(in_type)
     , name(in_name)
     , scope(-1)
     , is_temp(false)
     , next(NULL)
+    , s(NULL)
   {
   }
   virtual ~tableEntry() { ; }
 
+  // Delete the string, object or array this entry holds.  Only the symbol
+  // table calls this, when it frees every entry at once: values are shared
+  // by referring to the entry that holds them, never by their pointers.
+  void FreeValue() {
+    switch (type_id) {
+      case Type::STRING: delete s; break;
+      case Type::OBJECT: delete o; break;
+      case Type::ARRAY: delete a; break;
+      case Type::TYPED_ARRAY: delete t; break;
+    }
+    s = NULL;
+  }
+
 public:
   int GetType()                const { return type_id; }
-  std::string GetName()        const { return name; }
+  const std::string & GetName() const { return atom_table.GetName(name); }
+  uint32_t GetAtom()           const { return name; }
   int GetScope()               const { return scope; }
   bool GetTemp()               const { return is_temp; }
   tableEntry * GetNext()       const { return next; }
-  float GetNumberValue()       const { return n; }
+  double GetNumberValue()      const { return n; }
   bool GetBoolValue()          const { return b; }
-  std::string GetStringValue() const { return *s; }
+  const std::string & GetStringValue() const { return *s; }
   tableEntry * GetReference()  const { return r; }
-  tableEntry * GetProperty(std::string p) {
-    if(o->find(p) == o->end()) {
-      return NULL;
-    }
-    else {
-      return (*o)[p];
-    }
-  }
-  std::map<std::string, tableEntry*>  * GetPropertyMap() const { return o; }
+  tableEntry * GetProperty(uint32_t atom) const { return o->Get(atom); }
+  propertyMap * GetPropertyMap() const { return o; }
   std::map<unsigned int, tableEntry*>  * GetArray() const { return a; }
   tableEntry * GetIndex(unsigned int pos) {
-    if(a->find(pos) == a->end()) {
-      return NULL;
-    }
-    else {
-      return (*a)[pos];
-    }
+    std::map<unsigned int, tableEntry*>::const_iterator it = a->find(pos);
+    return it == a->end() ? NULL : it->second;
   }
   std::map<unsigned int, tableEntry*>  * GetArrayMap() const { return a; }
+  typedArray * GetTypedArray() const { return t; }
+  ASTNode_Function * GetFunction() const { return f; }
 
   void SetType(int type) { type_id = type; }
-  void SetName(std::string in_name) { name = in_name; }
   void SetScope(int in_scope) { scope = in_scope; }
   void SetNext(tableEntry * in_next) { next = in_next; }
-  void SetNumberValue(float n) { this->n = n; }
+  void SetNumberValue(double n) { this->n = n; }
   void SetBoolValue(bool b) { this->b = b; }
-  void SetStringValue(std::string s) { this->s = new std::string(s); }
+  // Make this entry a number, freeing the string it may hold.
+  void AssignNumberValue(double n) {
+    if (type_id == Type::STRING) delete s;
+    type_id = Type::NUMBER;
+    this->n = n;
+  }
+  void SetStringValue(std::string s) {
+    this->s = new std::string(std::move(s));
+    if (HeapProfile::tracking) {
+      HeapProfile::Allocated(NULL, sizeof(std::string) + this->s->capacity());
+    }
+  }
+  // Replace the string this entry holds, reusing its buffer.
+  void AssignStringValue(const char * text, size_t length) {
+    if (!s) {
+      SetStringValue(std::string(text, length));
+      return;
+    }
+    size_t old_capacity = s->capacity();
+    s->assign(text, length);
+    if (HeapProfile::tracking && s->capacity() > old_capacity) {
+      HeapProfile::Allocated(NULL, s->capacity() - old_capacity);
+    }
+  }
+  void AppendStringValue(const std::string & tail) {
+    size_t old_capacity = s->capacity();
+    s->append(tail);
+    if (HeapProfile::tracking && s->capacity() != old_capacity) {
+      HeapProfile::Allocated(NULL, s->capacity() - old_capacity);
+    }
+  }
   void SetReference(tableEntry * ref) { r = ref; }
-  void SetProperty(std::string k, tableEntry * v) { (*o)[k] = v; }
+  void SetFunction(ASTNode_Function * func) { f = func; }
+  void SetProperty(uint32_t atom, tableEntry * v) { o->Set(atom, v); }
   void SetIndex(unsigned int pos, tableEntry * v) { (*a)[pos] = v; }
-  void InitializeObject() { o = new std::map<std::string, tableEntry*>(); }
-  void InitializeArray() { a = new std::map<unsigned int, tableEntry*>(); }
+  void InitializeObject() {
+    o = new propertyMap();
+    if (HeapProfile::tracking) HeapProfile::Allocated(NULL, o->GetBytes());
+  }
+  // Start with a copy of layout's keys and values.
+  void InitializeObject(const propertyMap & layout) {
+    o = new propertyMap(layout);
+    if (HeapProfile::tracking) HeapProfile::Allocated(NULL, o->GetBytes());
+  }
+  void InitializeArray() {
+    a = new std::map<unsigned int, tableEntry*>();
+    if (HeapProfile::tracking) HeapProfile::Allocated(NULL, sizeof(*a));
+  }
+  void InitializeTypedArray(int kind, unsigned int length) {
+    t = new typedArray(kind, length);
+    if (HeapProfile::tracking) HeapProfile::Allocated(NULL, t->GetBytes());
+  }
+  // Take the string or typed array from `from`, leaving it an empty one of
+  // the same kind, so a large value changes hands without being copied.
+  void TakeValue(tableEntry * from) {
+    type_id = from->type_id;
+    if (type_id == Type::STRING) {
+      s = from->s;
+      from->s = new std::string;
+      if (HeapProfile::tracking) {
+        HeapProfile::Allocated(NULL, sizeof(std::string) + from->s->capacity());
+      }
+    }
+    else if (type_id == Type::TYPED_ARRAY) {
+      t = from->t;
+      from->t = new typedArray(t->GetKind(), 0);
+      if (HeapProfile::tracking) HeapProfile::Allocated(NULL, from->t->GetBytes());
+    }
+  }
 };
 
 #endif
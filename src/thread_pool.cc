@@ -0,0 +1,75 @@
+#include "thread_pool.h"
+
+#include <cstdlib>
+
+threadPool::threadPool(int num_threads)
+  : task(NULL), task_data(NULL), num_tasks(0), next_task(0), busy(0), batch(0)
+{
+  for (int i = 1; i < num_threads; i++) {
+    workers.push_back(std::thread(&threadPool::WorkerLoop, this, i));
+  }
+}
+
+threadPool & threadPool::Get()
+{
+  // Never destroyed: the workers stay parked until the process exits.
+  static threadPool * pool = NULL;
+  if (!pool) {
+    int num_threads = std::thread::hardware_concurrency();
+    const char * limit = getenv("V9_THREADS");
+    if (limit && atoi(limit) > 0) num_threads = atoi(limit);
+    if (num_threads < 1) num_threads = 1;
+    pool = new threadPool(num_threads);
+  }
+  return *pool;
+}
+
+// Claim and run tasks until none are left.
+void threadPool::RunTasks(int thread_id)
+{
+  int task_id;
+  while ((task_id = next_task.fetch_add(1)) < num_tasks) {
+    task(task_data, task_id, thread_id);
+  }
+}
+
+void threadPool::WorkerLoop(int thread_id)
+{
+  unsigned int seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (batch == seen) work_ready.wait(guard);
+      seen = batch;
+    }
+
+    RunTasks(thread_id);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (--busy == 0) work_done.notify_one();
+  }
+}
+
+void threadPool::Run(int in_num_tasks, taskFunc in_task, void * in_data)
+{
+  if (workers.empty() || in_num_tasks <= 1) {
+    for (int i = 0; i < in_num_tasks; i++) in_task(in_data, i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    task = in_task;
+    task_data = in_data;
+    num_tasks = in_num_tasks;
+    next_task = 0;
+    busy = (int) workers.size();
+    batch++;
+  }
+  work_ready.notify_all();
+
+  RunTasks(0);
+
+  std::unique_lock<std::mutex> guard(lock);
+  while (busy > 0) work_done.wait(guard);
+}
@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for the data-parallel builtins.  Run() splits
+// a batch into numbered tasks that the workers and the calling thread claim
+// in turn, and returns once all of them are done.  Batches do not nest.
+class threadPool {
+public:
+  // Runs task number task_id on thread number thread_id (0 is the caller).
+  typedef void (*taskFunc)(void * data, int task_id, int thread_id);
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable work_ready;  // A new batch was posted
+  std::condition_variable work_done;   // The last worker left the batch
+
+  taskFunc task;                       // The current batch
+  void * task_data;
+  int num_tasks;
+  std::atomic<int> next_task;          // Next unclaimed task number
+  int busy;                            // Workers still in the batch
+  unsigned int batch;                  // Number of batches posted so far
+
+  threadPool(int num_threads);
+  threadPool(const threadPool &);
+  threadPool & operator=(const threadPool &);
+
+  void WorkerLoop(int thread_id);
+  void RunTasks(int thread_id);
+
+public:
+  // The shared pool, started on first use with one thread per core.  The
+  // environment variable V9_THREADS overrides the number of threads.
+  static threadPool & Get();
+
+  int GetNumThreads() const { return (int) workers.size() + 1; }
+  void Run(int in_num_tasks, taskFunc in_task, void * in_data);
+};
+
+#endif
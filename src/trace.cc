@@ -0,0 +1,137 @@
+#include "trace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+
+namespace {
+
+  typedef std::chrono::steady_clock traceClock;
+
+  // Set while the program's statics are constructed, which is as close to
+  // the process starting as the clock can see.
+  const traceClock::time_point process_start = traceClock::now();
+
+  std::mutex lock;       // Guards the file; workers and pool threads trace too
+  FILE * file = NULL;
+
+  std::atomic<int> next_thread_id(1);
+  thread_local int thread_id = 0;  // Assigned on the thread's first event
+
+  // Number this thread (the main thread writes first, so it is 1), and name
+  // it in the trace.  Called with lock held.
+  int ThreadId() {
+    if (thread_id == 0) {
+      thread_id = next_thread_id++;
+      fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}",
+              (int) getpid(), thread_id, thread_id == 1 ? "main" : "thread");
+    }
+    return thread_id;
+  }
+
+  // Write the fields every event has, up to its args.
+  void WriteHeader(const char * name, const char * category, const char * phase,
+                   Trace::timestamp ts) {
+    int tid = ThreadId();
+    fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%s\", "
+                  "\"ts\": %llu.%03u, \"pid\": %d, \"tid\": %d",
+            name, category, phase, (unsigned long long) (ts / 1000),
+            (unsigned) (ts % 1000), (int) getpid(), tid);
+  }
+
+  void WriteArgs(const std::string & args) {
+    if (args != "") fprintf(file, ", \"args\": {%s}", args.c_str());
+    fputs("}", file);
+  }
+
+};
+
+// Trace
+
+namespace Trace {
+
+  bool enabled = false;
+
+  bool Open(const std::string & path, std::string & error)
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    file = fopen(path.c_str(), "w");
+    if (!file) {
+      error = "cannot write '" + path + "': " + strerror(errno);
+      return false;
+    }
+    fputs("[\n", file);
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+                  "\"args\": {\"name\": \"v9\"}}", (int) getpid());
+    enabled = true;
+    return true;
+  }
+
+  void Close()
+  {
+    std::lock_guard<std::mutex> hold(lock);
+    if (!file) return;
+    enabled = false;
+    fputs("\n]\n", file);
+    fclose(file);
+    file = NULL;
+  }
+
+  timestamp Now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      traceClock::now() - process_start).count();
+  }
+
+  std::string Arg(const char * key, long long value)
+  {
+    return "\"" + std::string(key) + "\": " + std::to_string(value);
+  }
+
+  std::string Arg(const char * key, const std::string & value)
+  {
+    std::string out = "\"" + std::string(key) + "\": \"";
+    for (size_t i = 0; i < value.size(); i++) {
+      unsigned char c = value[i];
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      }
+      else if (c < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out += escaped;
+      }
+      else out += c;
+    }
+    return out + "\"";
+  }
+
+  void WriteSpan(const char * name, const char * category, timestamp start,
+                 const std::string & args)
+  {
+    timestamp end = Now();
+    std::lock_guard<std::mutex> hold(lock);
+    if (!file) return;
+    WriteHeader(name, category, "X", start);
+    fprintf(file, ", \"dur\": %llu.%03u", (unsigned long long) ((end - start) / 1000),
+            (unsigned) ((end - start) % 1000));
+    WriteArgs(args);
+  }
+
+  void WriteInstant(const char * name, const char * category, const std::string & args)
+  {
+    timestamp now = Now();
+    std::lock_guard<std::mutex> hold(lock);
+    if (!file) return;
+    WriteHeader(name, category, "i", now);
+    fputs(", \"s\": \"t\"", file);
+    WriteArgs(args);
+  }
+
+};
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string>
+
+// Timeline of a run in Chrome's trace-event format (--trace=FILE), for
+// chrome://tracing or Perfetto.  Each phase of the run is a complete ("X")
+// event, written when it ends; internal events such as arena resets are
+// instant ("i") events.  The file is finished when the process exits, after
+// the global symbol table is torn down.  When tracing is off each call below
+// is one test of a flag.
+namespace Trace {
+  typedef uint64_t timestamp;  // Nanoseconds since the process started
+
+  // Loops and symbol table teardowns that take less than this are left out
+  // of the trace, so that inner loops and the small tables that carry
+  // worker messages do not swamp it.
+  const timestamp MIN_SPAN_NANOS = 100000;
+
+  extern bool enabled;
+
+  // Start writing the trace to path.  Returns false and sets error if the
+  // file cannot be created.
+  bool Open(const std::string & path, std::string & error);
+
+  // Finish the file.  Later events are dropped.
+  void Close();
+
+  timestamp Now();
+
+  // "key": value pairs for an event's args; join several with ", ".
+  std::string Arg(const char * key, long long value);
+  std::string Arg(const char * key, const std::string & value);
+
+  void WriteSpan(const char * name, const char * category, timestamp start,
+                 const std::string & args);
+  void WriteInstant(const char * name, const char * category, const std::string & args);
+
+  // Record a span from start until now.
+  inline void Span(const char * name, const char * category, timestamp start,
+                   const std::string & args = std::string()) {
+    if (enabled) WriteSpan(name, category, start, args);
+  }
+
+  // Record it only if it took at least MIN_SPAN_NANOS.
+  inline void LongSpan(const char * name, const char * category, timestamp start,
+                       const std::string & args = std::string()) {
+    if (enabled && Now() - start >= MIN_SPAN_NANOS) WriteSpan(name, category, start, args);
+  }
+
+  // Record an event with no duration.
+  inline void Instant(const char * name, const char * category,
+                      const std::string & args = std::string()) {
+    if (enabled) WriteInstant(name, category, args);
+  }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "type_infer.h"
+#include "ast.h"
+#include "operators.h"
+#include "v9-parser.tab.hh"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+
+namespace {
+
+  const int UNKNOWN = -1;  // May hold anything
+  const int PENDING = -2;  // No assignment seen yet (the inference is optimistic)
+
+  int Join(int a, int b) {
+    if (a == PENDING) return b;
+    if (b == PENDING) return a;
+    return a == b ? a : UNKNOWN;
+  }
+
+  // Type of a + b: a string if either side is one, otherwise a number once
+  // both sides are known.
+  int AddType(int a, int b) {
+    if (a == Type::STRING || b == Type::STRING) return Type::STRING;
+    if (a == UNKNOWN || b == UNKNOWN) return UNKNOWN;
+    if (a == PENDING || b == PENDING) return PENDING;
+    return Type::NUMBER;
+  }
+
+  // A global by its entry, or a local by its function and slot.
+  struct variable {
+    tableEntry * entry;
+    ASTNode_Function * function;
+    int slot;
+
+    bool operator<(const variable & other) const {
+      if (entry != other.entry) return entry < other.entry;
+      if (function != other.function) return function < other.function;
+      return slot < other.slot;
+    }
+  };
+
+  // Variables that are sure to have been assigned at a point in the program.
+  typedef std::set<variable> assignedSet;
+
+  class inference {
+  private:
+    std::map<variable, int> types;  // Join of every value assigned to each variable
+    ASTNode_Function * function;    // Function being walked, or NULL at top level
+    bool changed;                   // A variable's type changed during this walk
+    bool rewrite;                   // Replace nodes on this walk
+    int num_replaced;
+
+    // The variable node names, if it is one; parameters are left out.
+    bool Lookup(ASTNode * node, variable & var) const {
+      var.entry = NULL;
+      var.function = NULL;
+      var.slot = -1;
+      if (ASTNode_Variable * global = dynamic_cast<ASTNode_Variable *>(node)) {
+        var.entry = global->GetVarEntry();
+        return true;
+      }
+      ASTNode_LocalVariable * local = dynamic_cast<ASTNode_LocalVariable *>(node);
+      if (!local || !function || local->GetSlot() < function->GetNumParams()) return false;
+      var.function = function;
+      var.slot = local->GetSlot();
+      return true;
+    }
+
+    void Write(ASTNode * node, int type, assignedSet & assigned) {
+      variable var;
+      if (!Lookup(node, var)) return;
+
+      std::map<variable, int>::iterator it = types.find(var);
+      int old_type = it == types.end() ? PENDING : it->second;
+      int new_type = Join(old_type, type);
+      if (new_type != old_type) {
+        types[var] = new_type;
+        changed = true;
+      }
+      if (type >= 0) assigned.insert(var);
+    }
+
+    int Read(ASTNode * node, const assignedSet & assigned) const {
+      variable var;
+      if (!Lookup(node, var) || !assigned.count(var)) return UNKNOWN;
+      std::map<variable, int>::const_iterator it = types.find(var);
+      return it == types.end() ? PENDING : it->second;
+    }
+
+    static void Intersect(assignedSet & a, const assignedSet & b) {
+      assignedSet both;
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                            std::inserter(both, both.begin()));
+      a.swap(both);
+    }
+
+    int WalkChildren(ASTNode * node, assignedSet & assigned) {
+      for (int i = 0; i < node->GetNumChildren(); i++) Walk(node, i, assigned);
+      return UNKNOWN;
+    }
+
+    // An assignment's target: a variable is written, while a property's
+    // object and key are read.
+    void WalkTarget(ASTNode * parent, assignedSet & assigned) {
+      ASTNode * target = parent->GetChild(0);
+      if (dynamic_cast<ASTNode_Property *>(target)) WalkChildren(target, assigned);
+    }
+
+    // Walk child i of parent, with assigned holding the variables assigned
+    // before it runs (and afterwards, those assigned after).  Returns the
+    // type of its value.
+    int Walk(ASTNode * parent, int i, assignedSet & assigned) {
+      ASTNode * node = parent->GetChild(i);
+      if (!node) return UNKNOWN;
+
+      if (ASTNode_Function * func = dynamic_cast<ASTNode_Function *>(node)) {
+        // A function can be called before anything at top level has run.
+        ASTNode_Function * outer = function;
+        function = func;
+        assignedSet none;
+        WalkChildren(func, none);
+        function = outer;
+        return UNKNOWN;
+      }
+      if (dynamic_cast<ASTNode_Variable *>(node) || dynamic_cast<ASTNode_LocalVariable *>(node)) {
+        return Read(node, assigned);
+      }
+      if (ASTNode_Literal * literal = dynamic_cast<ASTNode_Literal *>(node)) {
+        WalkChildren(literal, assigned);
+        int type = literal->GetType();
+        if (type == Type::OBJECT || type == Type::ARRAY) return UNKNOWN;
+        return type;
+      }
+      if (ASTNode_Assign * assign = dynamic_cast<ASTNode_Assign *>(node)) {
+        WalkTarget(assign, assigned);
+        int type = Walk(assign, 1, assigned);
+        Write(assign->GetChild(0), type, assigned);
+
+        ASTNode * target = assign->GetChild(0);
+        bool to_variable = dynamic_cast<ASTNode_Variable *>(target) ||
+                           dynamic_cast<ASTNode_LocalVariable *>(target);
+        if (rewrite && type == Type::NUMBER && to_variable &&
+            !dynamic_cast<ASTNode_NumberAssign *>(assign)) {
+          Replace(parent, i, new ASTNode_NumberAssign(target, assign->GetChild(1)));
+        }
+        return UNKNOWN;
+      }
+      if (ASTNode_CompoundAssign * update = dynamic_cast<ASTNode_CompoundAssign *>(node)) {
+        WalkTarget(update, assigned);
+        int current = Read(update->GetChild(0), assigned);
+        int value = Walk(update, 1, assigned);
+        int type = UNKNOWN;
+        if (update->GetOp() == '+') type = AddType(current, value);
+        else if (Operators::MathOp(update->GetOp()) < 0 || value >= 0) type = Type::NUMBER;
+        Write(update->GetChild(0), type, assigned);
+        return UNKNOWN;
+      }
+      if (ASTNode_Math1 * math = dynamic_cast<ASTNode_Math1 *>(node)) {
+        Walk(math, 0, assigned);
+        if (math->GetOp() == INCREMENT || math->GetOp() == DECREMENT) {
+          Write(math->GetChild(0), Type::NUMBER, assigned);
+        }
+        return Type::NUMBER;
+      }
+      if (ASTNode_Math2 * math = dynamic_cast<ASTNode_Math2 *>(node)) {
+        int type1 = Walk(math, 0, assigned);
+        int type2 = Walk(math, 1, assigned);
+        bool numbers = type1 == Type::NUMBER && type2 == Type::NUMBER;
+        if (rewrite && numbers && !dynamic_cast<ASTNode_NumberMath2 *>(math)) {
+          Replace(parent, i, new ASTNode_NumberMath2(math->GetChild(0), math->GetChild(1),
+                                                     math->GetOp()));
+        }
+        return math->GetOp() == '+' ? AddType(type1, type2) : Type::NUMBER;
+      }
+      if (ASTNode_Comparison * comp = dynamic_cast<ASTNode_Comparison *>(node)) {
+        int type1 = Walk(comp, 0, assigned);
+        int type2 = Walk(comp, 1, assigned);
+        bool numbers = type1 == Type::NUMBER && type2 == Type::NUMBER;
+        if (rewrite && numbers && !dynamic_cast<ASTNode_NumberComparison *>(comp)) {
+          Replace(parent, i, new ASTNode_NumberComparison(comp->GetChild(0), comp->GetChild(1),
+                                                          comp->GetOp()));
+        }
+        return Type::BOOL;
+      }
+      if (dynamic_cast<ASTNode_Bool2 *>(node)) {
+        // The right side may not run.
+        Walk(node, 0, assigned);
+        assignedSet right = assigned;
+        Walk(node, 1, right);
+        return Type::BOOL;
+      }
+      if (dynamic_cast<ASTNode_Bool1 *>(node) || dynamic_cast<ASTNode_BoolCast *>(node)) {
+        WalkChildren(node, assigned);
+        return Type::BOOL;
+      }
+      if (dynamic_cast<ASTNode_Bitwise1 *>(node) || dynamic_cast<ASTNode_Bitwise2 *>(node) ||
+          dynamic_cast<ASTNode_NumberCast *>(node)) {
+        WalkChildren(node, assigned);
+        return Type::NUMBER;
+      }
+      if (dynamic_cast<ASTNode_StringCast *>(node) || dynamic_cast<ASTNode_TypeOf *>(node)) {
+        WalkChildren(node, assigned);
+        return Type::STRING;
+      }
+      if (dynamic_cast<ASTNode_If *>(node)) {
+        Walk(node, 0, assigned);
+        assignedSet other = assigned;
+        Walk(node, 1, assigned);
+        Walk(node, 2, other);
+        Intersect(assigned, other);
+        return UNKNOWN;
+      }
+      if (dynamic_cast<ASTNode_While *>(node)) {
+        // The condition runs at least once; the body may not.
+        Walk(node, 0, assigned);
+        assignedSet body = assigned;
+        Walk(node, 1, body);
+        return UNKNOWN;
+      }
+      if (dynamic_cast<ASTNode_For *>(node)) {
+        Walk(node, 0, assigned);
+        Walk(node, 1, assigned);
+        assignedSet body = assigned;
+        Walk(node, 3, body);
+        // A continue may skip the rest of the body, so the update can only
+        // count on what was assigned before the body.
+        assignedSet update = assigned;
+        Walk(node, 2, update);
+        return UNKNOWN;
+      }
+      if (dynamic_cast<ASTNode_ForIn *>(node)) {
+        Write(node->GetChild(0), UNKNOWN, assigned);
+        Walk(node, 1, assigned);
+        assignedSet body = assigned;
+        Walk(node, 2, body);
+        return UNKNOWN;
+      }
+      if (dynamic_cast<ASTNode_Delete *>(node)) {
+        WalkTarget(node, assigned);
+        Write(node->GetChild(0), UNKNOWN, assigned);
+        return UNKNOWN;
+      }
+      return WalkChildren(node, assigned);
+    }
+
+    void Replace(ASTNode * parent, int i, ASTNode * variant) {
+      variant->SetLineNum(parent->GetChild(i)->GetLineNum());
+      variant->SetResultSlot(parent->GetChild(i)->GetResultSlot());
+      parent->SetChild(i, variant);
+      num_replaced++;
+    }
+
+    void WalkProgram(ASTNode * program) {
+      function = NULL;
+      changed = false;
+      assignedSet assigned;
+      WalkChildren(program, assigned);
+    }
+
+  public:
+    inference() : function(NULL), changed(false), rewrite(false), num_replaced(0) { ; }
+
+    int Run(ASTNode * program) {
+      // Each variable's type can only move from PENDING to a type to
+      // UNKNOWN, so this ends.
+      do WalkProgram(program); while (changed);
+
+      rewrite = true;
+      WalkProgram(program);
+      return num_replaced;
+    }
+  };
+
+};
+
+// TypeInference
+
+namespace TypeInference {
+
+  int Specialize(ASTNode * program)
+  {
+    inference pass;
+    return pass.Run(program);
+  }
+
+};
@@ -0,0 +1,24 @@
+#ifndef TYPE_INFER_H
+#define TYPE_INFER_H
+
+class ASTNode;
+
+// Static type inference over a parsed program, run once before it is cached
+// or run.  Each variable's type is the join of every value assigned to it
+// anywhere in the program (the inference starts optimistic and iterates to a
+// fixed point), and a read has that type only where an assignment is sure to
+// have run first: before then the variable is still undefined.  Parameters,
+// and anything the pass cannot follow (calls, properties, for-in keys), are
+// unknown.
+//
+// '+', '-', '*', '/', '%' and comparisons whose operands are both proven to
+// be numbers are replaced with ASTNode_NumberMath2 and
+// ASTNode_NumberComparison, and assignments of a proven number to a variable
+// with ASTNode_NumberAssign; these skip the type dispatch.  Every other site
+// keeps the generic node.
+namespace TypeInference {
+  // Returns the number of nodes replaced.
+  int Specialize(ASTNode * program);
+};
+
+#endif
@@ -11,6 +11,8 @@ namespace Type {
       case ARRAY: return "array";
       case REFERENCE: return "reference";
       case NLL: return "null";
+      case TYPED_ARRAY: return "typedarray";
+      case FUNCTION: return "function";
     }
     return "unknown";
   }
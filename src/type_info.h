@@ -5,7 +5,7 @@
 
 namespace Type {
   enum TypeNames { VOID=0, NUMBER, BOOL, STRING, OBJECT, ARRAY, REFERENCE,
-                   NLL };
+                   NLL, TYPED_ARRAY, FUNCTION };
 
   // Convert the internal type to a string like "int"
   std::string AsString(int type);
@@ -0,0 +1,590 @@
+#include "typed_array.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V9_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Every bulk operation goes through one of these tables, picked once for the
+// CPU we are running on.  Kernels may assume n > 0; the typedArray wrappers
+// deal with empty arrays themselves.
+struct kernelTable {
+  const char * name;
+
+  void (*fill_f64)(double * a, size_t n, double v);
+  double (*sum_f64)(const double * a, size_t n);
+  double (*min_f64)(const double * a, size_t n);
+  double (*max_f64)(const double * a, size_t n);
+  void (*scale_f64)(double * a, size_t n, double k);
+  void (*add_f64)(double * a, const double * b, size_t n);
+  void (*mul_f64)(double * a, const double * b, size_t n);
+  double (*dot_f64)(const double * a, const double * b, size_t n);
+
+  void (*fill_i32)(int32_t * a, size_t n, int32_t v);
+  int64_t (*sum_i32)(const int32_t * a, size_t n);
+  int32_t (*min_i32)(const int32_t * a, size_t n);
+  int32_t (*max_i32)(const int32_t * a, size_t n);
+  void (*add_i32)(int32_t * a, const int32_t * b, size_t n);
+  void (*mul_i32)(int32_t * a, const int32_t * b, size_t n);
+};
+
+// Scalar kernels (used on every CPU for loop tails, and alone when no SIMD
+// instruction set is available).
+
+namespace {
+
+  void FillF64Scalar(double * a, size_t n, double v) {
+    for (size_t i = 0; i < n; i++) a[i] = v;
+  }
+  double SumF64Scalar(const double * a, size_t n) {
+    double total = 0.0;
+    for (size_t i = 0; i < n; i++) total += a[i];
+    return total;
+  }
+  double MinF64Scalar(const double * a, size_t n) {
+    double result = a[0];
+    for (size_t i = 0; i < n; i++) {
+      if (std::isnan(a[i])) return a[i];
+      if (a[i] < result) result = a[i];
+    }
+    return result;
+  }
+  double MaxF64Scalar(const double * a, size_t n) {
+    double result = a[0];
+    for (size_t i = 0; i < n; i++) {
+      if (std::isnan(a[i])) return a[i];
+      if (a[i] > result) result = a[i];
+    }
+    return result;
+  }
+  void ScaleF64Scalar(double * a, size_t n, double k) {
+    for (size_t i = 0; i < n; i++) a[i] *= k;
+  }
+  void AddF64Scalar(double * a, const double * b, size_t n) {
+    for (size_t i = 0; i < n; i++) a[i] += b[i];
+  }
+  void MulF64Scalar(double * a, const double * b, size_t n) {
+    for (size_t i = 0; i < n; i++) a[i] *= b[i];
+  }
+  double DotF64Scalar(const double * a, const double * b, size_t n) {
+    double total = 0.0;
+    for (size_t i = 0; i < n; i++) total += a[i] * b[i];
+    return total;
+  }
+
+  void FillI32Scalar(int32_t * a, size_t n, int32_t v) {
+    for (size_t i = 0; i < n; i++) a[i] = v;
+  }
+  int64_t SumI32Scalar(const int32_t * a, size_t n) {
+    int64_t total = 0;
+    for (size_t i = 0; i < n; i++) total += a[i];
+    return total;
+  }
+  int32_t MinI32Scalar(const int32_t * a, size_t n) {
+    int32_t result = a[0];
+    for (size_t i = 1; i < n; i++) if (a[i] < result) result = a[i];
+    return result;
+  }
+  int32_t MaxI32Scalar(const int32_t * a, size_t n) {
+    int32_t result = a[0];
+    for (size_t i = 1; i < n; i++) if (a[i] > result) result = a[i];
+    return result;
+  }
+  // Integer add and multiply wrap around like Int32Array stores (Math.imul).
+  void AddI32Scalar(int32_t * a, const int32_t * b, size_t n) {
+    for (size_t i = 0; i < n; i++) a[i] = (int32_t) ((uint32_t) a[i] + (uint32_t) b[i]);
+  }
+  void MulI32Scalar(int32_t * a, const int32_t * b, size_t n) {
+    for (size_t i = 0; i < n; i++) a[i] = (int32_t) ((uint32_t) a[i] * (uint32_t) b[i]);
+  }
+
+  const kernelTable scalar_kernels = {
+    "scalar",
+    FillF64Scalar, SumF64Scalar, MinF64Scalar, MaxF64Scalar,
+    ScaleF64Scalar, AddF64Scalar, MulF64Scalar, DotF64Scalar,
+    FillI32Scalar, SumI32Scalar, MinI32Scalar, MaxI32Scalar,
+    AddI32Scalar, MulI32Scalar
+  };
+
+#ifdef V9_X86_KERNELS
+
+  // SSE2 kernels (always present on x86-64).
+
+  __attribute__((target("sse2")))
+  void FillF64SSE2(double * a, size_t n, double v) {
+    __m128d vv = _mm_set1_pd(v);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(a + i, vv);
+    FillF64Scalar(a + i, n - i, v);
+  }
+  __attribute__((target("sse2")))
+  double SumF64SSE2(const double * a, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+      acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + SumF64Scalar(a + i, n - i);
+  }
+  __attribute__((target("sse2")))
+  double MinF64SSE2(const double * a, size_t n) {
+    if (n < 2) return MinF64Scalar(a, n);
+    __m128d best = _mm_loadu_pd(a), nan_seen = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      __m128d v = _mm_loadu_pd(a + i);
+      nan_seen = _mm_or_pd(nan_seen, _mm_cmpunord_pd(v, v));
+      best = _mm_min_pd(best, v);
+    }
+    if (_mm_movemask_pd(nan_seen)) return std::numeric_limits<double>::quiet_NaN();
+    double lanes[2];
+    _mm_storeu_pd(lanes, best);
+    double result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    if (i < n) {
+      double tail = MinF64Scalar(a + i, n - i);
+      if (std::isnan(tail) || tail < result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("sse2")))
+  double MaxF64SSE2(const double * a, size_t n) {
+    if (n < 2) return MaxF64Scalar(a, n);
+    __m128d best = _mm_loadu_pd(a), nan_seen = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      __m128d v = _mm_loadu_pd(a + i);
+      nan_seen = _mm_or_pd(nan_seen, _mm_cmpunord_pd(v, v));
+      best = _mm_max_pd(best, v);
+    }
+    if (_mm_movemask_pd(nan_seen)) return std::numeric_limits<double>::quiet_NaN();
+    double lanes[2];
+    _mm_storeu_pd(lanes, best);
+    double result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    if (i < n) {
+      double tail = MaxF64Scalar(a + i, n - i);
+      if (std::isnan(tail) || tail > result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("sse2")))
+  void ScaleF64SSE2(double * a, size_t n, double k) {
+    __m128d kk = _mm_set1_pd(k);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), kk));
+    ScaleF64Scalar(a + i, n - i, k);
+  }
+  __attribute__((target("sse2")))
+  void AddF64SSE2(double * a, const double * b, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    AddF64Scalar(a + i, b + i, n - i);
+  }
+  __attribute__((target("sse2")))
+  void MulF64SSE2(double * a, const double * b, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+      _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    MulF64Scalar(a + i, b + i, n - i);
+  }
+  __attribute__((target("sse2")))
+  double DotF64SSE2(const double * a, const double * b, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + DotF64Scalar(a + i, b + i, n - i);
+  }
+
+  __attribute__((target("sse2")))
+  void FillI32SSE2(int32_t * a, size_t n, int32_t v) {
+    __m128i vv = _mm_set1_epi32(v);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i *) (a + i), vv);
+    FillI32Scalar(a + i, n - i, v);
+  }
+  __attribute__((target("sse2")))
+  int64_t SumI32SSE2(const int32_t * a, size_t n) {
+    // Sign-extend each lane to 64 bits so long sums cannot overflow.
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i sign = _mm_srai_epi32(v, 31);
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    return lanes[0] + lanes[1] + SumI32Scalar(a + i, n - i);
+  }
+  __attribute__((target("sse2")))
+  void AddI32SSE2(int32_t * a, const int32_t * b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+      _mm_storeu_si128((__m128i *) (a + i), _mm_add_epi32(va, vb));
+    }
+    AddI32Scalar(a + i, b + i, n - i);
+  }
+
+  // SSE2 has no 32-bit integer min, max or low multiply; those stay scalar.
+  const kernelTable sse2_kernels = {
+    "sse2",
+    FillF64SSE2, SumF64SSE2, MinF64SSE2, MaxF64SSE2,
+    ScaleF64SSE2, AddF64SSE2, MulF64SSE2, DotF64SSE2,
+    FillI32SSE2, SumI32SSE2, MinI32Scalar, MaxI32Scalar,
+    AddI32SSE2, MulI32Scalar
+  };
+
+  // AVX2 kernels.
+
+  __attribute__((target("avx2")))
+  void FillF64AVX2(double * a, size_t n, double v) {
+    __m256d vv = _mm256_set1_pd(v);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(a + i, vv);
+    FillF64Scalar(a + i, n - i, v);
+  }
+  __attribute__((target("avx2")))
+  double SumF64AVX2(const double * a, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+      acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + SumF64Scalar(a + i, n - i);
+  }
+  __attribute__((target("avx2")))
+  double MinF64AVX2(const double * a, size_t n) {
+    if (n < 4) return MinF64Scalar(a, n);
+    __m256d best = _mm256_loadu_pd(a), nan_seen = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256d v = _mm256_loadu_pd(a + i);
+      nan_seen = _mm256_or_pd(nan_seen, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+      best = _mm256_min_pd(best, v);
+    }
+    if (_mm256_movemask_pd(nan_seen)) return std::numeric_limits<double>::quiet_NaN();
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    double result = MinF64Scalar(lanes, 4);
+    if (i < n) {
+      double tail = MinF64Scalar(a + i, n - i);
+      if (std::isnan(tail) || tail < result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("avx2")))
+  double MaxF64AVX2(const double * a, size_t n) {
+    if (n < 4) return MaxF64Scalar(a, n);
+    __m256d best = _mm256_loadu_pd(a), nan_seen = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256d v = _mm256_loadu_pd(a + i);
+      nan_seen = _mm256_or_pd(nan_seen, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+      best = _mm256_max_pd(best, v);
+    }
+    if (_mm256_movemask_pd(nan_seen)) return std::numeric_limits<double>::quiet_NaN();
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    double result = MaxF64Scalar(lanes, 4);
+    if (i < n) {
+      double tail = MaxF64Scalar(a + i, n - i);
+      if (std::isnan(tail) || tail > result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("avx2")))
+  void ScaleF64AVX2(double * a, size_t n, double k) {
+    __m256d kk = _mm256_set1_pd(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kk));
+    }
+    ScaleF64Scalar(a + i, n - i, k);
+  }
+  __attribute__((target("avx2")))
+  void AddF64AVX2(double * a, const double * b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    AddF64Scalar(a + i, b + i, n - i);
+  }
+  __attribute__((target("avx2")))
+  void MulF64AVX2(double * a, const double * b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    MulF64Scalar(a + i, b + i, n - i);
+  }
+  __attribute__((target("avx2")))
+  double DotF64AVX2(const double * a, const double * b, size_t n) {
+    // Separate multiply and add (no FMA) so results match the other kernels.
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+      acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                               _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + DotF64Scalar(a + i, b + i, n - i);
+  }
+
+  __attribute__((target("avx2")))
+  void FillI32AVX2(int32_t * a, size_t n, int32_t v) {
+    __m256i vv = _mm256_set1_epi32(v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i *) (a + i), vv);
+    FillI32Scalar(a + i, n - i, v);
+  }
+  __attribute__((target("avx2")))
+  int64_t SumI32AVX2(const int32_t * a, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (a + i));
+      acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+      acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumI32Scalar(a + i, n - i);
+  }
+  __attribute__((target("avx2")))
+  int32_t MinI32AVX2(const int32_t * a, size_t n) {
+    if (n < 8) return MinI32Scalar(a, n);
+    __m256i best = _mm256_loadu_si256((const __m256i *) a);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8) {
+      best = _mm256_min_epi32(best, _mm256_loadu_si256((const __m256i *) (a + i)));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *) lanes, best);
+    int32_t result = MinI32Scalar(lanes, 8);
+    if (i < n) {
+      int32_t tail = MinI32Scalar(a + i, n - i);
+      if (tail < result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("avx2")))
+  int32_t MaxI32AVX2(const int32_t * a, size_t n) {
+    if (n < 8) return MaxI32Scalar(a, n);
+    __m256i best = _mm256_loadu_si256((const __m256i *) a);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8) {
+      best = _mm256_max_epi32(best, _mm256_loadu_si256((const __m256i *) (a + i)));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *) lanes, best);
+    int32_t result = MaxI32Scalar(lanes, 8);
+    if (i < n) {
+      int32_t tail = MaxI32Scalar(a + i, n - i);
+      if (tail > result) result = tail;
+    }
+    return result;
+  }
+  __attribute__((target("avx2")))
+  void AddI32AVX2(int32_t * a, const int32_t * b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+      __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+      _mm256_storeu_si256((__m256i *) (a + i), _mm256_add_epi32(va, vb));
+    }
+    AddI32Scalar(a + i, b + i, n - i);
+  }
+  __attribute__((target("avx2")))
+  void MulI32AVX2(int32_t * a, const int32_t * b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+      __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+      _mm256_storeu_si256((__m256i *) (a + i), _mm256_mullo_epi32(va, vb));
+    }
+    MulI32Scalar(a + i, b + i, n - i);
+  }
+
+  const kernelTable avx2_kernels = {
+    "avx2",
+    FillF64AVX2, SumF64AVX2, MinF64AVX2, MaxF64AVX2,
+    ScaleF64AVX2, AddF64AVX2, MulF64AVX2, DotF64AVX2,
+    FillI32AVX2, SumI32AVX2, MinI32AVX2, MaxI32AVX2,
+    AddI32AVX2, MulI32AVX2
+  };
+
+#endif
+
+  // Pick the widest kernel set this CPU supports.  Setting the environment
+  // variable V9_SIMD to "scalar", "sse2" or "avx2" caps the choice, which is
+  // handy when comparing kernels.
+  const kernelTable * SelectKernels() {
+    const char * cap = getenv("V9_SIMD");
+    std::string limit = cap ? cap : "";
+    if (limit == "scalar") return &scalar_kernels;
+#ifdef V9_X86_KERNELS
+    __builtin_cpu_init();
+    if (limit != "sse2" && __builtin_cpu_supports("avx2")) return &avx2_kernels;
+    if (__builtin_cpu_supports("sse2")) return &sse2_kernels;
+#endif
+    return &scalar_kernels;
+  }
+
+  const kernelTable & Kernels() {
+    static const kernelTable * active = SelectKernels();
+    return *active;
+  }
+
+};
+
+// typedArray
+
+typedArray::typedArray(int in_kind, unsigned int in_length)
+  : kind(in_kind), length(in_length), data(NULL)
+{
+  size_t elem_size = (kind == FLOAT64) ? sizeof(double) : sizeof(int32_t);
+  size_t bytes = (length > 0 ? length : 1) * elem_size;
+
+  // Align to a cache line so the vector loads never straddle one needlessly.
+  if (posix_memalign(&data, 64, bytes) != 0) throw std::bad_alloc();
+  memset(data, 0, bytes);
+}
+
+typedArray::~typedArray()
+{
+  free(data);
+}
+
+int32_t typedArray::ToInt32(double value)
+{
+  if (std::isnan(value) || std::isinf(value)) return 0;
+  double wrapped = fmod(trunc(value), 4294967296.0);
+  if (wrapped < 0) wrapped += 4294967296.0;
+  return (int32_t) (uint32_t) wrapped;
+}
+
+const char * typedArray::KernelName()
+{
+  return Kernels().name;
+}
+
+void typedArray::Fill(double value)
+{
+  if (length == 0) return;
+  if (kind == FLOAT64) Kernels().fill_f64(GetFloat64Data(), length, value);
+  else Kernels().fill_i32(GetInt32Data(), length, ToInt32(value));
+}
+
+double typedArray::Sum() const
+{
+  if (length == 0) return 0.0;
+  if (kind == FLOAT64) return Kernels().sum_f64(GetFloat64Data(), length);
+  return (double) Kernels().sum_i32(GetInt32Data(), length);
+}
+
+double typedArray::Min() const
+{
+  if (length == 0) return std::numeric_limits<double>::infinity();
+  if (kind == FLOAT64) return Kernels().min_f64(GetFloat64Data(), length);
+  return Kernels().min_i32(GetInt32Data(), length);
+}
+
+double typedArray::Max() const
+{
+  if (length == 0) return -std::numeric_limits<double>::infinity();
+  if (kind == FLOAT64) return Kernels().max_f64(GetFloat64Data(), length);
+  return Kernels().max_i32(GetInt32Data(), length);
+}
+
+void typedArray::Scale(double factor)
+{
+  if (length == 0) return;
+  if (kind == FLOAT64) {
+    Kernels().scale_f64(GetFloat64Data(), length, factor);
+    return;
+  }
+
+  // Integer results must go through ToInt32 one element at a time.
+  int32_t * a = GetInt32Data();
+  for (unsigned int i = 0; i < length; i++) a[i] = ToInt32(a[i] * factor);
+}
+
+bool typedArray::Add(const typedArray & other)
+{
+  if (other.length != length) return false;
+  if (length == 0) return true;
+
+  if (kind == FLOAT64 && other.kind == FLOAT64) {
+    Kernels().add_f64(GetFloat64Data(), other.GetFloat64Data(), length);
+  }
+  else if (kind == INT32 && other.kind == INT32) {
+    Kernels().add_i32(GetInt32Data(), other.GetInt32Data(), length);
+  }
+  else {
+    for (unsigned int i = 0; i < length; i++) {
+      SetElement(i, GetElement(i) + other.GetElement(i));
+    }
+  }
+  return true;
+}
+
+bool typedArray::Mul(const typedArray & other)
+{
+  if (other.length != length) return false;
+  if (length == 0) return true;
+
+  if (kind == FLOAT64 && other.kind == FLOAT64) {
+    Kernels().mul_f64(GetFloat64Data(), other.GetFloat64Data(), length);
+  }
+  else if (kind == INT32 && other.kind == INT32) {
+    Kernels().mul_i32(GetInt32Data(), other.GetInt32Data(), length);
+  }
+  else {
+    for (unsigned int i = 0; i < length; i++) {
+      SetElement(i, GetElement(i) * other.GetElement(i));
+    }
+  }
+  return true;
+}
+
+bool typedArray::Dot(const typedArray & other, double & result) const
+{
+  if (other.length != length) return false;
+  result = 0.0;
+  if (length == 0) return true;
+
+  if (kind == FLOAT64 && other.kind == FLOAT64) {
+    result = Kernels().dot_f64(GetFloat64Data(), other.GetFloat64Data(), length);
+  }
+  else {
+    for (unsigned int i = 0; i < length; i++) {
+      result += GetElement(i) * other.GetElement(i);
+    }
+  }
+  return true;
+}
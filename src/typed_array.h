@@ -0,0 +1,62 @@
+#ifndef TYPED_ARRAY_H
+#define TYPED_ARRAY_H
+
+#include <cstddef>
+#include <stdint.h>
+
+// Fixed-length numeric array (Float64Array / Int32Array) kept in a single
+// contiguous, aligned buffer so elements are never boxed into table entries.
+class typedArray {
+public:
+  enum ElementKinds { FLOAT64=0, INT32 };
+
+private:
+  int kind;             // What kind of element does this array hold?
+  unsigned int length;  // Number of elements in the buffer
+  void * data;          // Aligned element storage
+
+  typedArray(const typedArray &);
+  typedArray & operator=(const typedArray &);
+
+public:
+  typedArray(int in_kind, unsigned int in_length);
+  ~typedArray();
+
+  int GetKind()             const { return kind; }
+  unsigned int GetLength()  const { return length; }
+  size_t GetBytes()         const {
+    return sizeof(*this) + (size_t) length * (kind == FLOAT64 ? 8 : 4);
+  }
+  double * GetFloat64Data() const { return (double *) data; }
+  int32_t * GetInt32Data()  const { return (int32_t *) data; }
+
+  double GetElement(unsigned int pos) const {
+    if (kind == FLOAT64) return ((double *) data)[pos];
+    return ((int32_t *) data)[pos];
+  }
+  void SetElement(unsigned int pos, double value) {
+    if (kind == FLOAT64) ((double *) data)[pos] = value;
+    else ((int32_t *) data)[pos] = ToInt32(value);
+  }
+
+  // Bulk operations; these run on the best SIMD kernels the CPU supports.
+  void Fill(double value);
+  double Sum() const;
+  double Min() const;
+  double Max() const;
+  void Scale(double factor);
+
+  // Elementwise operations need an array of the same length.  They return
+  // false (and do nothing) on a length mismatch.
+  bool Add(const typedArray & other);
+  bool Mul(const typedArray & other);
+  bool Dot(const typedArray & other, double & result) const;
+
+  // Convert a number to a 32-bit integer with JavaScript wrap-around rules.
+  static int32_t ToInt32(double value);
+
+  // Name of the kernel set picked for this CPU ("avx2", "sse2" or "scalar").
+  static const char * KernelName();
+};
+
+#endif
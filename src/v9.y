@@ -3,29 +3,271 @@
 #include <string>
 #include <fstream>
 #include <stdio.h>
+#include <vector>
 
 #include "symbol_table.h"
 #include "ast.h"
 #include "type_info.h"
+#include "code_cache.h"
+#include "type_infer.h"
+#include "heap_profile.h"
+#include "budget.h"
+#include "event_loop.h"
+#include "file_reader.h"
+#include "json.h"
+#include "server.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "worker.h"
+
+#include <atomic>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
+#include <unistd.h>
 
 extern int line_num;
 extern int yylex();
+extern std::string code_cache_dir;
+extern std::string source_text;
+extern bool stream_mode;
+extern std::vector<std::string> script_paths;
+extern bool batch_mode;
+extern std::string serve_path;
+extern std::string heap_snapshot_path;
+extern bool track_allocations;
+extern std::string make_snapshot_path;
+extern std::mutex print_lock;
+
+// Closes the --trace file.  It is defined before symbol_table, so it is
+// destroyed after it and the trace includes the table's teardown.
+struct traceCloser {
+  ~traceCloser() { Trace::Close(); }
+} trace_closer;
 
 symbolTable symbol_table;
-int error_count = 0;
+std::atomic<int> error_count(0);  // Workers report errors too
+thread_local bool parsing_worker = false;  // Errors are the worker's, not counted
+int loop_depth = 0;        // Loops enclosing the statement being parsed
+int saved_loop_depth = 0;  // Loop depth outside the function being parsed
+uint32_t stream_mark = 0;  // End of the nodes kept so far when streaming
+ASTNode * parsed_program = NULL;  // Set by the program rule
+
+// Globals to set (name, JSON text) before the next program runs, for --serve.
+std::vector<std::pair<std::string, std::string> > input_bindings;
 
 // Create an error function to call when the current line has an error
 void yyerror(std::string err_string) {
+  std::lock_guard<std::mutex> hold(print_lock);
   std::cout << "ERROR(line " << line_num << "): "
        << err_string << std::endl;
-  error_count++;
+  if (!parsing_worker) error_count++;
 }
 
 // Create an alternate error function when a *different* line than being read in has an error.
 void yyerror2(std::string err_string, int orig_line) {
+  std::lock_guard<std::mutex> hold(print_lock);
   std::cout << "ERROR(line " << orig_line << "): "
        << err_string << std::endl;
-  error_count++;
+  if (!parsing_worker) error_count++;
+}
+
+// Give up on the current script.  In a batch (or a server) the next script
+// still runs.  A parallel builtin's tasks catch the abort, and the builtin
+// aborts again on the caller's thread once every task has stopped.  A worker
+// ends, and its parent hears of it when it next receives.
+void AbortScript() {
+  if (!batch_mode && !in_parallel_task && !Workers::InWorker()) exit(1);
+  throw scriptAborted();
+}
+
+// Build a call to one of the worker, event loop or reader builtins (BUILTIN
+// is the node class), checking the argument count.
+template <typename BUILTIN>
+ASTNode * BuildBuiltinCall(int function, std::string name, ASTNode * args) {
+  ASTNode * node = new BUILTIN(function);
+  if (args) {
+    node->TransferChildren(args);
+    delete args;
+  }
+  if (!BUILTIN::CheckArgCount(function, node->GetNumChildren())) {
+    yyerror("wrong number of arguments to '" + name + "'");
+    AbortScript();
+  }
+  node->SetLineNum(line_num);
+  return node;
+}
+
+// Build a call to a function, resolving the callee now if it is known.
+ASTNode * BuildCall(std::string name, ASTNode * args) {
+  int worker_function = ASTNode_Worker::LookupFunction(name);
+  if (worker_function != ASTNode_Worker::UNKNOWN) {
+    return BuildBuiltinCall<ASTNode_Worker>(worker_function, name, args);
+  }
+  int async_function = ASTNode_Async::LookupFunction(name);
+  if (async_function != ASTNode_Async::UNKNOWN) {
+    return BuildBuiltinCall<ASTNode_Async>(async_function, name, args);
+  }
+  int reader_function = ASTNode_FileRead::LookupFunction(name);
+  if (reader_function != ASTNode_FileRead::UNKNOWN) {
+    return BuildBuiltinCall<ASTNode_FileRead>(reader_function, name, args);
+  }
+
+  int callee_slot = symbol_table.LookupLocal(name);
+  tableEntry * callee_entry = NULL;
+  if (callee_slot < 0) callee_entry = symbol_table.Lookup(name);
+
+  // Inside a function the result gets a slot in the caller's frame, from
+  // AssignResultSlots() once the body is parsed.
+  ASTNode * node = new ASTNode_Call(name, callee_entry, callee_slot);
+  if (args) {
+    node->TransferChildren(args);
+    delete args;
+  }
+  node->SetLineNum(line_num);
+  return node;
+}
+
+// Build a call to an array or typed array method, checking the name and
+// argument count.
+ASTNode * BuildMethodCall(ASTNode * obj, std::string name, ASTNode * args) {
+  ASTNode * node = NULL;
+  int method = ASTNode_ArrayMethod::LookupMethod(name);
+  if (method != ASTNode_ArrayMethod::UNKNOWN) {
+    node = new ASTNode_ArrayMethod(obj, method);
+  }
+  else {
+    method = ASTNode_TypedArrayMethod::LookupMethod(name);
+    if (method == ASTNode_TypedArrayMethod::UNKNOWN) {
+      yyerror("unknown method '" + name + "'");
+      AbortScript();
+    }
+    node = new ASTNode_TypedArrayMethod(obj, method);
+  }
+
+  if (args) {
+    node->TransferChildren(args);
+    delete args;
+  }
+
+  int num_args = node->GetNumChildren() - 1;
+  if (dynamic_cast<ASTNode_ArrayMethod *>(node)) {
+    if (!ASTNode_ArrayMethod::CheckArgCount(method, num_args)) {
+      yyerror("wrong number of arguments to method '" + name + "'");
+      AbortScript();
+    }
+  }
+  else if (num_args != ASTNode_TypedArrayMethod::GetArgCount(method)) {
+    std::stringstream err_string;
+    err_string << "method '" << name << "' expects "
+               << ASTNode_TypedArrayMethod::GetArgCount(method) << " argument(s)";
+    yyerror(err_string.str());
+    AbortScript();
+  }
+
+  node->SetLineNum(line_num);
+  return node;
+}
+
+// Build a call to 'JSON.parse' or 'JSON.stringify'.
+ASTNode * BuildJsonCall(std::string name, ASTNode * arg) {
+  int method = ASTNode_Json::LookupMethod(name);
+  if (method == ASTNode_Json::UNKNOWN) {
+    yyerror("unknown method 'JSON." + name + "'");
+    AbortScript();
+  }
+
+  ASTNode * node = new ASTNode_Json(arg, method);
+  node->SetLineNum(line_num);
+  return node;
+}
+
+// Write the heap reports asked for on the command line once the program
+// ends, and exit with an error if it was stopped early.
+void FinishRun() {
+  if (heap_snapshot_path != "") {
+    std::string error;
+    if (!HeapProfile::WriteSnapshot(heap_snapshot_path, symbol_table, error)) {
+      std::cerr << "ERROR: --heap-snapshot: " << error << std::endl;
+    }
+  }
+  if (track_allocations) HeapProfile::ReportAllocations(std::cerr);
+
+  int stop_reason = Budget::GetStopReason();
+  if (stop_reason != Budget::RUNNING) {
+    std::cout << "ERROR: script stopped: " << Budget::DescribeStop(stop_reason) << std::endl;
+    AbortScript();
+  }
+}
+
+// Set each input binding on the global the program declared by that name;
+// bindings it does not declare are ignored.
+void BindInputs() {
+  for (size_t i = 0; i < input_bindings.size(); i++) {
+    tableEntry * var = symbol_table.Lookup(input_bindings[i].first);
+    if (!var) continue;
+
+    std::string error;
+    tableEntry * value = Json::Parse(input_bindings[i].second, symbol_table, error);
+    if (!value) {
+      std::cout << "ERROR: input '" << input_bindings[i].first << "': " << error << std::endl;
+      error_count++;
+      AbortScript();
+    }
+    ASTNode * assign = new ASTNode_Assign(new ASTNode_Variable(var), new ASTNode_Variable(value));
+    assign->Interpret(symbol_table);
+  }
+}
+
+// Free every node, once the program they belong to is done with.
+void ResetArena() {
+  if (Trace::enabled) Trace::Instant("ast_arena.Reset", "memory",
+                                     Trace::Arg("bytes", ast_arena.GetMark()));
+  ast_arena.Reset();
+}
+
+// Run the top-level statements of program one at a time, as its block
+// would, recording a span for each.
+void InterpretTraced(ASTNode * program) {
+  if (Budget::Poll()) {
+    symbol_table.SetCompletion(symbolTable::HALT);
+    return;
+  }
+  for (int i = 0; i < program->GetNumChildren(); i++) {
+    ASTNode * statement = program->GetChild(i);
+    Trace::timestamp start = Trace::Now();
+    HeapProfile::SetLine(statement->GetLineNum());
+    statement->Interpret(symbol_table);
+    Trace::Span("statement", "run", start, Trace::Arg("line", statement->GetLineNum()));
+    if (symbol_table.GetCompletion() != symbolTable::NORMAL) break;
+  }
+}
+
+// Run a whole parsed program and then its event loop, then free its nodes.
+void RunProgram(ASTNode * program) {
+  BindInputs();
+  Trace::timestamp start = Trace::Now();
+  if (Trace::enabled) InterpretTraced(program);
+  else program->Interpret(symbol_table);
+  Trace::Span("Interpret", "run", start);
+
+  start = Trace::Now();
+  EventLoop::Run(symbol_table);
+  Trace::Span("EventLoop::Run", "run", start);
+
+  start = Trace::Now();
+  FileReader::CloseAll();
+  Workers::Finish();
+  FinishRun();
+  Trace::Span("finish", "teardown", start);
+  ResetArena();
+}
+
+// Ctrl-C stops the script at its next poll, so the reports above are still
+// written; a second Ctrl-C quits at once.
+void HandleInterrupt(int signal_number) {
+  if (Budget::ShuttingDown()) _exit(130);
+  Budget::Shutdown();
 }
 
 %}
@@ -35,7 +277,7 @@ void yyerror2(std::string err_string, int orig_line) {
   ASTNode * ast_node;
 }
 
-%token CASSIGN_ADD CASSIGN_SUB CASSIGN_MULT CASSIGN_DIV CASSIGN_MOD INCREMENT DECREMENT LSHIFT RSHIFT ZF_RSHIFT CASSIGN_BITWISE_AND CASSIGN_BITWISE_OR CASSIGN_BITWISE_XOR CASSIGN_LSHIFT CASSIGN_RSHIFT CASSIGN_ZF_RSHIFT COMP_EQU COMP_NEQU COMP_LESS COMP_LTE COMP_GTR COMP_GTE COMP_SEQU COMP_SNEQU BOOL_AND BOOL_OR TRUE FALSE NLL CONSOLE LOG NUMBER STRING BOOLEAN TO_STRING TYPEOF VOID JOIN POP PUSH COMMAND_IF COMMAND_ELSE COMMAND_WHILE COMMAND_FOR COMMAND_IN COMMAND_BREAK COMMAND_DELETE
+%token CASSIGN_ADD CASSIGN_SUB CASSIGN_MULT CASSIGN_DIV CASSIGN_MOD INCREMENT DECREMENT LSHIFT RSHIFT ZF_RSHIFT CASSIGN_BITWISE_AND CASSIGN_BITWISE_OR CASSIGN_BITWISE_XOR CASSIGN_LSHIFT CASSIGN_RSHIFT CASSIGN_ZF_RSHIFT COMP_EQU COMP_NEQU COMP_LESS COMP_LTE COMP_GTR COMP_GTE COMP_SEQU COMP_SNEQU BOOL_AND BOOL_OR TRUE FALSE NLL CONSOLE JSON LOG NUMBER STRING BOOLEAN TO_STRING TYPEOF VOID JOIN POP PUSH FLOAT64_ARRAY INT32_ARRAY COMMAND_IF COMMAND_ELSE COMMAND_WHILE COMMAND_FOR COMMAND_IN COMMAND_BREAK COMMAND_CONTINUE COMMAND_DELETE COMMAND_FUNCTION COMMAND_RETURN
 %token <lexeme> NUMBER_LIT STRING_LIT ID VAR
 
 %left '.'
@@ -57,17 +299,53 @@ void yyerror2(std::string err_string, int orig_line) {
 %nonassoc NOELSE
 %nonassoc COMMAND_ELSE
 
-%type <ast_node> var_declare expression declare_assign statement statement_list var_usage lhs_ok command argument_list property_list code_block if_start while_start for_declare for_start for_in_start flow_command
+%type <ast_node> var_declare expression declare_assign statement statement_list top_statement_list var_usage lhs_ok command argument_list property_list code_block if_start while_start for_declare for_start for_in_start flow_command function_start function_head function_declare
 %%
 
-program:      statement_list {
-                 // Traverse AST
-                 $1->Interpret(symbol_table);
+program:      top_statement_list {
+                 // Streamed statements have already run.
+                 if (!stream_mode) {
+                   Trace::timestamp start = Trace::Now();
+                   int replaced = TypeInference::Specialize($1);
+                   Trace::Span("TypeInference::Specialize", "parse", start,
+                               Trace::Arg("replaced", replaced));
+                 }
+
+                 if (code_cache_dir != "" &&
+                     !CodeCache::Save(code_cache_dir, source_text, $1)) {
+                   std::cerr << "WARNING: could not write code cache in "
+                             << code_cache_dir << std::endl;
+                 }
+                 if (batch_mode && !stream_mode) CodeCache::Remember(source_text, $1);
 
-                 delete $1;
+                 // RunSource() traverses it (when streaming, that is already
+                 // done statement by statement).
+                 parsed_program = $1;
               }
              ;
 
+top_statement_list:     {
+                   $$ = new ASTNode_Block;
+                   stream_mark = ast_arena.GetMark();
+                 }
+        |        top_statement_list statement {
+                   // When streaming, run each top-level statement as soon as it
+                   // is parsed and free it, rather than building the whole tree.
+                   // Function declarations stay alive for later calls.
+                   if ($2 != NULL && stream_mode &&
+                       dynamic_cast<ASTNode_Function *>($2) == NULL) {
+                     Trace::timestamp start = Trace::Now();
+                     $2->Interpret(symbol_table);
+                     Trace::Span("statement", "run", start, Trace::Arg("line", $2->GetLineNum()));
+                     ast_arena.Release(stream_mark);
+                     if (symbol_table.GetCompletion() == symbolTable::HALT) FinishRun();
+                   }
+                   else if ($2 != NULL) $1->AddChild($2);
+                   stream_mark = ast_arena.GetMark();
+                   $$ = $1;
+                 }
+        ;
+
 statement_list:         {
                    $$ = new ASTNode_Block;
                  }
@@ -82,21 +360,30 @@ statement:   var_declare ';'    {  $$ = $1;  }
         |    expression ';'     {  $$ = $1;  }
         |    command ';'        {  $$ = $1;  }
         |    flow_command       {  $$ = $1;  }
+        |    function_declare   {  $$ = $1;  }
         |    code_block         {  $$ = $1;  }
         |    ';'                {  $$ = NULL;  }
         ;
 
 var_declare:        VAR ID {
-                  if (symbol_table.InCurScope($2) != 0) {
+                  bool redeclared = symbol_table.InFunction() ?
+                    symbol_table.LocalInCurScope($2) : symbol_table.InCurScope($2);
+                  if (redeclared) {
                     std::string err_string = "redeclaration of variable '";
                     err_string += $2;
                     err_string += "'";
                     yyerror(err_string);
-                    exit(1);
+                    AbortScript();
                   }
 
-                  tableEntry * cur_entry = symbol_table.AddEntry(0, $2);
-                  $$ = new ASTNode_Variable(cur_entry);
+                  // Function locals live in the activation record instead.
+                  if (symbol_table.InFunction()) {
+                    $$ = new ASTNode_LocalVariable(symbol_table.AddLocal($2), $2);
+                  }
+                  else {
+                    tableEntry * cur_entry = symbol_table.AddEntry(0, $2);
+                    $$ = new ASTNode_Variable(cur_entry);
+                  }
                   $$->SetLineNum(line_num);
                 }
         ;
@@ -108,15 +395,21 @@ declare_assign:  var_declare '=' expression {
         ;
 
 var_usage:   ID {
-               tableEntry * cur_entry = symbol_table.Lookup($1);
-               if (cur_entry == NULL) {
-                 std::string err_string = "unknown variable '";
-                 err_string += $1;
-                 err_string += "'";
-                 yyerror(err_string);
-                 exit(1);
+               int slot = symbol_table.LookupLocal($1);
+               if (slot >= 0) {
+                 $$ = new ASTNode_LocalVariable(slot, $1);
+               }
+               else {
+                 tableEntry * cur_entry = symbol_table.Lookup($1);
+                 if (cur_entry == NULL) {
+                   std::string err_string = "unknown variable '";
+                   err_string += $1;
+                   err_string += "'";
+                   yyerror(err_string);
+                   AbortScript();
+                 }
+                 $$ = new ASTNode_Variable(cur_entry);
                }
-               $$ = new ASTNode_Variable(cur_entry);
                $$->SetLineNum(line_num);
              }
         ;
@@ -233,50 +526,47 @@ expression:  expression '+' expression {
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_ADD expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Math2($1, $3, '+') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '+');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_SUB expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Math2($1, $3, '-') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '-');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_MULT expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Math2($1, $3, '*') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '*');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_DIV expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Math2($1, $3, '/') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '/');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_MOD expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Math2($1, $3, '%') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '%');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_BITWISE_AND expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Bitwise2($1, $3, '&'));
+               $$ = new ASTNode_CompoundAssign($1, $3, '&');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_BITWISE_OR expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Bitwise2($1, $3, '|') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '|');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_BITWISE_XOR expression {
-               $$ = new ASTNode_Assign($1, new ASTNode_Bitwise2($1, $3, '^') );
+               $$ = new ASTNode_CompoundAssign($1, $3, '^');
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_LSHIFT expression {
-               ASTNode * op = new ASTNode_Bitwise2($1, $3, LSHIFT);
-               $$ = new ASTNode_Assign($1, op);
+               $$ = new ASTNode_CompoundAssign($1, $3, LSHIFT);
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_RSHIFT expression {
-               ASTNode * op = new ASTNode_Bitwise2($1, $3, RSHIFT);
-               $$ = new ASTNode_Assign($1, op);
+               $$ = new ASTNode_CompoundAssign($1, $3, RSHIFT);
                $$->SetLineNum(line_num);
              }
         |    lhs_ok CASSIGN_ZF_RSHIFT expression {
-               ASTNode * op = new ASTNode_Bitwise2($1, $3, ZF_RSHIFT);
-               $$ = new ASTNode_Assign($1, op);
+               $$ = new ASTNode_CompoundAssign($1, $3, ZF_RSHIFT);
                $$->SetLineNum(line_num);
              }
         |    INCREMENT var_usage {
@@ -341,9 +631,11 @@ expression:  expression '+' expression {
                $$->SetLineNum(line_num);
              }
         |    '{' property_list '}' {
-               $$ = new ASTNode_Literal(Type::OBJECT);
-               $$->TransferChildren($2);
+               ASTNode_Literal * literal = new ASTNode_Literal(Type::OBJECT);
+               literal->TransferChildren($2);
+               literal->InternKeys();
                delete $2;
+               $$ = literal;
                $$->SetLineNum(line_num);
              }
         |    var_usage { $$ = $1; }
@@ -393,6 +685,29 @@ expression:  expression '+' expression {
         |    var_usage '.' POP '(' ')' {
                $$ = new ASTNode_Pop($1);
             }
+        |    FLOAT64_ARRAY '(' expression ')' {
+               $$ = new ASTNode_TypedArrayNew($3, typedArray::FLOAT64);
+               $$->SetLineNum(line_num);
+            }
+        |    INT32_ARRAY '(' expression ')' {
+               $$ = new ASTNode_TypedArrayNew($3, typedArray::INT32);
+               $$->SetLineNum(line_num);
+            }
+        |    ID '(' ')' {
+               $$ = BuildCall($1, NULL);
+            }
+        |    ID '(' argument_list ')' {
+               $$ = BuildCall($1, $3);
+            }
+        |    JSON '.' ID '(' expression ')' {
+               $$ = BuildJsonCall($3, $5);
+            }
+        |    var_usage '.' ID '(' ')' {
+               $$ = BuildMethodCall($1, $3, NULL);
+            }
+        |    var_usage '.' ID '(' argument_list ')' {
+               $$ = BuildMethodCall($1, $3, $5);
+            }
         ;
 
 argument_list:  argument_list ',' expression {
@@ -414,10 +729,47 @@ command:   CONSOLE '.' LOG '(' argument_list ')' {
              $$->SetLineNum(line_num);
              delete $5;
            }
+        |  CONSOLE '.' ID '(' expression ')' {
+             std::string name = $3;
+             if (name != "heapSnapshot") {
+               yyerror("unknown method 'console." + name + "'");
+               AbortScript();
+             }
+             $$ = new ASTNode_HeapSnapshot($5);
+             $$->SetLineNum(line_num);
+           }
         |  COMMAND_BREAK {
+             if (loop_depth == 0) {
+               yyerror("break outside of a loop");
+               AbortScript();
+             }
              $$ = new ASTNode_Break();
              $$->SetLineNum(line_num);
            }
+        |  COMMAND_CONTINUE {
+             if (loop_depth == 0) {
+               yyerror("continue outside of a loop");
+               AbortScript();
+             }
+             $$ = new ASTNode_Continue();
+             $$->SetLineNum(line_num);
+           }
+        |  COMMAND_RETURN {
+             if (!symbol_table.InFunction()) {
+               yyerror("return outside of a function");
+               AbortScript();
+             }
+             $$ = new ASTNode_Return(NULL);
+             $$->SetLineNum(line_num);
+           }
+        |  COMMAND_RETURN expression {
+             if (!symbol_table.InFunction()) {
+               yyerror("return outside of a function");
+               AbortScript();
+             }
+             $$ = new ASTNode_Return($2);
+             $$->SetLineNum(line_num);
+           }
         |  COMMAND_DELETE var_usage {
              $$ = new ASTNode_Delete($2);
              $$->SetLineNum(line_num);
@@ -433,6 +785,7 @@ if_start:  COMMAND_IF '(' expression ')' {
 while_start:  COMMAND_WHILE '(' expression ')' {
                 $$ = new ASTNode_While($3, NULL);
                 $$->SetLineNum(line_num);
+                loop_depth++;
               }
            ;
 
@@ -443,12 +796,14 @@ for_declare:  declare_assign { $$ = $1; }
 for_start:  COMMAND_FOR '(' for_declare ';' expression ';' expression ')' {
                 $$ = new ASTNode_For($3, $5, $7, NULL);
                 $$->SetLineNum(line_num);
+                loop_depth++;
               }
            ;
 
 for_in_start:  COMMAND_FOR '(' var_declare COMMAND_IN var_usage ')' {
                 $$ = new ASTNode_ForIn($3, $5, NULL);
                 $$->SetLineNum(line_num);
+                loop_depth++;
               }
            ;
 
@@ -464,30 +819,317 @@ flow_command:  if_start statement COMMAND_ELSE statement {
             |  while_start statement {
                  $$ = $1;
                  $$->SetChild(1, $2);
+                 loop_depth--;
                }
             |  for_start statement {
                  $$ = $1;
                  $$->SetChild(3, $2);
+                 loop_depth--;
                }
             |  for_in_start statement {
                  $$ = $1;
                  $$->SetChild(2, $2);
+                 loop_depth--;
                }
             ;
 
+function_start:  COMMAND_FUNCTION ID {
+                   if (symbol_table.InFunction()) {
+                     yyerror("functions cannot be declared inside functions");
+                     AbortScript();
+                   }
+                   if (symbol_table.InCurScope($2)) {
+                     std::string err_string = "redeclaration of variable '";
+                     err_string += $2;
+                     err_string += "'";
+                     yyerror(err_string);
+                     AbortScript();
+                   }
+
+                   tableEntry * cur_entry = symbol_table.AddEntry(0, $2);
+                   $$ = new ASTNode_Function(cur_entry, $2);
+                   $$->SetLineNum(line_num);
+
+                   // Parameters and locals are scoped to the function, and
+                   // break/continue cannot reach loops outside of it.
+                   symbol_table.BeginFunction();
+                   symbol_table.IncScope();
+                   saved_loop_depth = loop_depth;
+                   loop_depth = 0;
+                 }
+              ;
+
+parameter_list:  ID {
+                   symbol_table.AddLocal($1);
+                 }
+              |  parameter_list ',' ID {
+                   if (symbol_table.LocalInCurScope($3)) {
+                     std::string err_string = "duplicate parameter '";
+                     err_string += $3;
+                     err_string += "'";
+                     yyerror(err_string);
+                     AbortScript();
+                   }
+                   symbol_table.AddLocal($3);
+                 }
+              ;
+
+function_head:   function_start '(' ')' { $$ = $1; }
+              |  function_start '(' parameter_list ')' {
+                   ((ASTNode_Function *) $1)->SetNumParams(symbol_table.GetFrameSize());
+                   $$ = $1;
+                 }
+              ;
+
+function_declare:  function_head code_block {
+                     symbol_table.DecScope();
+                     $2->AssignResultSlots(symbol_table);
+                     ((ASTNode_Function *) $1)->SetFrameSize(symbol_table.EndFunction());
+                     loop_depth = saved_loop_depth;
+                     $1->AddChild($2);
+                     $$ = $1;
+                   }
+                ;
+
 block_start: '{' { symbol_table.IncScope(); } ;
 block_end:   '}' { symbol_table.DecScope(); } ;
 code_block:  block_start statement_list block_end { $$ = $2; } ;
 
 %%
 void LexMain(int argc, char * argv[]);
+bool LoadScript(const std::string & path, bool streamed);
+void ScanSource();
 
-int main(int argc, char * argv[])
+// Parse the script in source_text, which the scanner is already reading,
+// declaring its variables in symbol_table.  Returns NULL if it did not parse.
+ASTNode * ParseSource()
+{
+  // A cache hit skips lexing and parsing entirely.  Batches also remember
+  // every program they parse, for scripts that appear more than once.
+  ASTNode * program = NULL;
+  Trace::timestamp start = Trace::Now();
+  if (code_cache_dir != "") {
+    program = CodeCache::Load(code_cache_dir, source_text, symbol_table);
+    Trace::Span("CodeCache::Load", "cache", start, Trace::Arg("hit", program != NULL));
+  }
+  if (!program && batch_mode && !stream_mode) {
+    start = Trace::Now();
+    program = CodeCache::Recall(source_text, symbol_table);
+    Trace::Span("CodeCache::Recall", "cache", start, Trace::Arg("hit", program != NULL));
+  }
+  if (program) return program;
+
+  parsed_program = NULL;
+  start = Trace::Now();
+  int status = yyparse();
+  Trace::Span("yyparse", "parse", start);
+  if (status != 0) return NULL;
+  return parsed_program;
+}
+
+// Run the script in source_text.  Returns false if it did not parse,
+// reported an error or was stopped.
+bool RunSource()
 {
   error_count = 0;
+  loop_depth = saved_loop_depth = 0;
+
+  // The snapshot's globals are declared before the script is parsed, so
+  // the parser resolves the script's uses of them.
+  if (Snapshot::IsOpen()) {
+    Trace::timestamp start = Trace::Now();
+    int restored = Snapshot::Restore(symbol_table);
+    Trace::Span("Snapshot::Restore", "startup", start, Trace::Arg("globals", restored));
+  }
+
+  try {
+    ASTNode * program = ParseSource();
+    if (!program) return false;
+    RunProgram(program);
+  }
+  catch (scriptAborted &) {
+    EventLoop::Reset();
+    FileReader::CloseAll();
+    Workers::Finish();
+    ResetArena();
+    return false;
+  }
+  return error_count == 0;
+}
+
+// The scanner's and parser's globals, which a worker's parse borrows while
+// the main script is running.  Its errors are printed but not counted.
+struct parseState {
+  std::string source_text;
+  int line_num;
+  int loop_depth;
+  int saved_loop_depth;
+
+  parseState() : line_num(::line_num), loop_depth(::loop_depth),
+                 saved_loop_depth(::saved_loop_depth) {
+    source_text.swap(::source_text);
+    ::loop_depth = ::saved_loop_depth = 0;
+    parsing_worker = true;
+  }
+  ~parseState() {
+    ::source_text.swap(source_text);
+    ::line_num = line_num;
+    ::loop_depth = loop_depth;
+    ::saved_loop_depth = saved_loop_depth;
+    parsing_worker = false;
+  }
+};
+
+// Parse the worker script at path into table, for Workers::Start().  The
+// parser declares into symbol_table, so table takes its place meanwhile.
+// Only the error set here, which the caller reports, counts against the
+// main script.
+ASTNode * CompileWorker(const std::string & path, symbolTable & table,
+                        std::string & error)
+{
+  if (stream_mode) {
+    error = "workers cannot be started with --stream";
+    return NULL;
+  }
+
+  parseState saved;
+  ASTNode * program = NULL;
+  symbol_table.Swap(table);
+  try {
+    if (!LoadScript(path, false)) error = "cannot read '" + path + "'";
+    else if (!(program = ParseSource())) error = "'" + path + "' did not parse";
+  }
+  catch (scriptAborted &) {
+    symbol_table.Swap(table);
+    throw;
+  }
+  symbol_table.Swap(table);
+  return program;
+}
+
+// Run a worker's program on its own thread, then hand it its messages, with
+// its event loop run after each.  A fatal error ends just the worker; returns
+// false if one did.
+bool RunWorker(ASTNode * program, symbolTable & table)
+{
+  bool ok = true;
+  try {
+    Trace::timestamp start = Trace::Now();
+    program->Interpret(table);
+    Trace::Span("Interpret", "run", start);
+    EventLoop::Run(table);
+    if (table.GetCompletion() != symbolTable::HALT) Workers::ServeMessages(table);
+    EventLoop::Run(table);
+  }
+  catch (scriptAborted &) {
+    EventLoop::Reset();
+    ok = false;
+  }
+  FileReader::CloseAll();
+  return ok;
+}
+
+// Run one script file.  Returns false if it could not be read or failed.
+bool RunScript(const std::string & path)
+{
+  Trace::timestamp start = Trace::Now();
+  bool loaded = LoadScript(path, stream_mode);
+  Trace::Span("LoadScript", "startup", start);
+  bool ok = loaded && RunSource();
+  Trace::Span("script", "run", start, Trace::Arg("path", path));
+  return ok;
+}
+
+// Answer one --serve request with a fresh global scope, as for each script
+// in a batch, and hand back everything the script printed.
+bool ServeRequest(const Server::request & req, std::string & output)
+{
+  symbol_table.Reset();
+  HeapProfile::Reset();
+  Budget::Reset();
+  input_bindings = req.bindings;
+
+  std::ostringstream printed;
+  std::streambuf * old_out = std::cout.rdbuf(printed.rdbuf());
+  std::streambuf * old_err = std::cerr.rdbuf(printed.rdbuf());
+  bool ok;
+  if (req.path != "") ok = RunScript(req.path);
+  else {
+    source_text = req.source;
+    ScanSource();
+    ok = RunSource();
+  }
+  std::cout.rdbuf(old_out);
+  std::cerr.rdbuf(old_err);
+
+  input_bindings.clear();
+  output = printed.str();
+  return ok;
+}
+
+bool ServeStopping()
+{
+  return Budget::ShuttingDown();
+}
+
+int main(int argc, char * argv[])
+{
+  Trace::timestamp start = Trace::Now();
   LexMain(argc, argv);
+  Trace::Span("LexMain", "startup", start);
+  signal(SIGINT, HandleInterrupt);
+  Trace::Span("startup", "startup", 0);
+
+  if (serve_path != "") {
+    signal(SIGTERM, HandleInterrupt);
+    std::string error;
+    if (!Server::Serve(serve_path, ServeRequest, ServeStopping, error)) {
+      std::cerr << "ERROR: --serve: " << error << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (make_snapshot_path != "") {
+    if (!RunScript(script_paths[0])) return 1;
+
+    std::vector<std::string> skipped;
+    std::string error;
+    if (!Snapshot::Write(make_snapshot_path, symbol_table, skipped, error)) {
+      std::cerr << "ERROR: --make-snapshot: " << error << std::endl;
+      return 1;
+    }
+    for (size_t i = 0; i < skipped.size(); i++) {
+      std::cerr << "WARNING: --make-snapshot: function '" << skipped[i]
+                << "' is not saved" << std::endl;
+    }
+    return 0;
+  }
+
+  if (!batch_mode) {
+    RunScript(script_paths[0]);
+    return 0;
+  }
+
+  // Batch mode: each script starts from an empty global scope, but the atom
+  // table, call stack, node arena, thread pool and remembered programs carry
+  // over.  A header on stdout starts each script's output.
+  int num_failed = 0;
+  for (size_t i = 0; i < script_paths.size(); i++) {
+    if (i > 0) {
+      Trace::timestamp start = Trace::Now();
+      symbol_table.Reset();
+      HeapProfile::Reset();
+      Budget::Reset();
+      Trace::Span("symbolTable::Reset", "memory", start);
+    }
 
-  yyparse();
+    std::cout << "==> " << script_paths[i] << " <==" << std::endl;
+    if (!RunScript(script_paths[i])) num_failed++;
+    if (Budget::ShuttingDown()) break;
+  }
 
-  return 0;
+  std::cout.flush();
+  std::cerr << script_paths.size() << " scripts, " << num_failed << " failed" << std::endl;
+  return num_failed > 0 ? 1 : 0;
 }
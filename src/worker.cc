@@ -0,0 +1,344 @@
+#include "worker.h"
+#include "ast.h"
+#include "ast_arena.h"
+#include "budget.h"
+#include "operators.h"
+#include "spsc_queue.h"
+#include "symbol_table.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Parse the script at path into table (in v9.y, beside the parser).  Returns
+// NULL and sets error if it cannot be read or does not parse.
+extern ASTNode * CompileWorker(const std::string & path, symbolTable & table,
+                               std::string & error);
+// Run a worker's program on the calling thread, stopping at a fatal error.
+// Returns false if there was one.
+extern bool RunWorker(ASTNode * program, symbolTable & table);
+
+namespace {
+
+  // A value in transit.  Its entries belong to values until the receiver
+  // adopts them.
+  struct message {
+    symbolTable values;
+    tableEntry * root;
+  };
+
+  const int SPIN_LIMIT = 200;  // Empty polls before a receiver goes to sleep
+  const int WAIT_MS = 10;      // Longest sleep between checks for a stop
+
+  // One direction of a worker's link.  Messages go through the lock-free
+  // queue; the lock and condition variable are only for a receiver that has
+  // found the queue empty for a while and gone to sleep.
+  class channel {
+  private:
+    spscQueue<message *> queue;
+    std::atomic<bool> closed;    // No more messages will be sent
+    std::atomic<bool> failed;    // ...because the sender stopped with an error
+    std::atomic<bool> sleeping;  // The receiver is (about to be) waiting on wake
+    std::mutex lock;
+    std::condition_variable wake;
+
+    void Wake() {
+      // Pairs with the fence in Receive(): either the receiver sees the new
+      // message, or this sees it sleeping.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> hold(lock);
+        wake.notify_one();
+      }
+    }
+
+  public:
+    channel() : closed(false), failed(false), sleeping(false) { ; }
+    ~channel() {
+      message * msg;
+      while (queue.Pop(msg)) delete msg;
+    }
+
+    bool IsClosed() const { return closed.load(std::memory_order_relaxed); }
+    bool HasFailed() const { return failed.load(std::memory_order_relaxed); }
+
+    void Send(message * msg) {
+      queue.Push(msg);
+      Wake();
+    }
+
+    void Close() {
+      closed.store(true, std::memory_order_release);
+      Wake();
+    }
+
+    // Close the channel because the sender has stopped with an error.
+    void Fail() {
+      failed.store(true, std::memory_order_relaxed);
+      Close();
+    }
+
+    // The next message, or NULL once the channel is closed and empty or the
+    // script has been stopped.
+    message * Receive() {
+      message * msg = NULL;
+      for (int polls = 0; ; polls++) {
+        if (queue.Pop(msg)) return msg;
+        if (closed.load(std::memory_order_acquire)) return queue.Pop(msg) ? msg : NULL;
+        if (Budget::Interrupted() || Budget::GetStopReason() != Budget::RUNNING) return NULL;
+        if (polls < SPIN_LIMIT) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        std::unique_lock<std::mutex> hold(lock);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queue.Pop(msg)) {
+          sleeping.store(false, std::memory_order_relaxed);
+          return msg;
+        }
+        if (!closed.load(std::memory_order_acquire)) {
+          wake.wait_for(hold, std::chrono::milliseconds(WAIT_MS));
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  struct worker {
+    symbolTable table;   // The worker's own variables and temporaries
+    ASTNode * program;
+    channel inbox;       // Parent to worker
+    channel outbox;      // Worker to parent
+    std::thread thread;
+  };
+
+  std::vector<worker *> workers;         // Workers of the main script, by id - 1
+  thread_local worker * current = NULL;  // The worker this thread runs, if any
+
+  void WorkerMain(worker * self) {
+    current = self;
+    bool ok = RunWorker(self->program, self->table);
+    ast_arena.EndChunk();
+    if (ok) self->outbox.Close();
+    else self->outbox.Fail();
+  }
+
+  // Copy value into msg, following references.  copies maps each entry
+  // already copied to its copy, so shared parts stay shared and cycles end.
+  tableEntry * CopyInto(message & msg, tableEntry * value, bool move_string,
+                        std::map<tableEntry *, tableEntry *> & copies,
+                        std::string & error) {
+    value = Operators::Operand(value);
+    if (!value) return msg.values.AddTempEntry(Type::VOID);
+
+    std::map<tableEntry *, tableEntry *>::iterator seen = copies.find(value);
+    if (seen != copies.end()) return seen->second;
+
+    tableEntry * copy = msg.values.AddTempEntry(value->GetType());
+    copies[value] = copy;
+    switch (value->GetType()) {
+      case Type::NUMBER:
+        copy->SetNumberValue(value->GetNumberValue());
+        break;
+      case Type::BOOL:
+        copy->SetBoolValue(value->GetBoolValue());
+        break;
+      case Type::STRING:
+        if (move_string) copy->TakeValue(value);
+        else copy->SetStringValue(value->GetStringValue());
+        break;
+      case Type::TYPED_ARRAY:
+        copy->TakeValue(value);
+        break;
+      case Type::OBJECT: {
+        propertyMap * props = value->GetPropertyMap();
+        copy->InitializeObject();
+        for (int i = 0; i < props->GetSize(); i++) {
+          const propertyMap::Entry & prop = props->GetEntry(i);
+          tableEntry * prop_copy = CopyInto(msg, prop.value, false, copies, error);
+          if (!prop_copy) return NULL;
+          copy->SetProperty(prop.atom, prop_copy);
+        }
+        break;
+      }
+      case Type::ARRAY: {
+        std::map<unsigned int, tableEntry *> * elements = value->GetArray();
+        copy->InitializeArray();
+        for (std::map<unsigned int, tableEntry *>::iterator it = elements->begin();
+             it != elements->end(); it++) {
+          tableEntry * element_copy = CopyInto(msg, it->second, false, copies, error);
+          if (!element_copy) return NULL;
+          copy->SetIndex(it->first, element_copy);
+        }
+        break;
+      }
+      case Type::FUNCTION:
+        error = "functions cannot be posted";
+        return NULL;
+    }
+    return copy;
+  }
+
+  worker * GetWorker(int id, std::string & error) {
+    if (id < 1 || id > (int) workers.size()) {
+      error = "no such worker";
+      return NULL;
+    }
+    return workers[id - 1];
+  }
+
+  // The channel this thread sends to id on, or receives from id on.
+  channel * Outbound(int id, std::string & error) {
+    if (current) {
+      if (id == Workers::PARENT) return &current->outbox;
+      error = "a worker can only post to the main script";
+      return NULL;
+    }
+    if (id == Workers::PARENT) {
+      error = "the main script must say which worker to post to";
+      return NULL;
+    }
+    worker * target = GetWorker(id, error);
+    if (!target) return NULL;
+    if (target->inbox.IsClosed()) {
+      error = "the worker was closed";
+      return NULL;
+    }
+    return &target->inbox;
+  }
+
+  channel * Inbound(int id, std::string & error) {
+    if (current) {
+      if (id == Workers::PARENT) return &current->inbox;
+      error = "a worker can only receive from the main script";
+      return NULL;
+    }
+    if (id == Workers::PARENT) {
+      error = "the main script must say which worker to receive from";
+      return NULL;
+    }
+    worker * source = GetWorker(id, error);
+    return source ? &source->outbox : NULL;
+  }
+
+};
+
+// Workers
+
+namespace Workers {
+
+  int Start(const std::string & path, std::string & error)
+  {
+    if (current) {
+      error = "workers cannot start workers";
+      return 0;
+    }
+
+    worker * fresh = new worker;
+    try {
+      fresh->program = CompileWorker(path, fresh->table, error);
+    }
+    catch (...) {
+      delete fresh;
+      throw;
+    }
+    if (!fresh->program) {
+      delete fresh;
+      return 0;
+    }
+
+    // From here on other threads intern names and allocate nodes too.
+    if (workers.empty()) atom_table.SetShared(true);
+    ast_arena.SetParallel(true);
+    fresh->thread = std::thread(WorkerMain, fresh);
+    workers.push_back(fresh);
+    return (int) workers.size();
+  }
+
+  bool Post(int id, tableEntry * value, bool move_string, std::string & error)
+  {
+    channel * out = Outbound(id, error);
+    if (!out) return false;
+
+    message * msg = new message;
+    std::map<tableEntry *, tableEntry *> copies;
+    msg->root = CopyInto(*msg, value, move_string, copies, error);
+    if (!msg->root) {
+      delete msg;
+      return false;
+    }
+    out->Send(msg);
+    return true;
+  }
+
+  tableEntry * Receive(int id, symbolTable & table, std::string & error)
+  {
+    channel * in = Inbound(id, error);
+    if (!in) return NULL;
+
+    message * msg = in->Receive();
+    if (!msg) {
+      if (in->HasFailed()) error = "the worker stopped with an error";
+      return NULL;
+    }
+    table.AdoptTemps(msg->values);
+    tableEntry * value = msg->root;
+    delete msg;
+    return value;
+  }
+
+  bool Close(int id, std::string & error)
+  {
+    if (current) {
+      error = "only the main script closes workers";
+      return false;
+    }
+    worker * target = GetWorker(id, error);
+    if (!target) return false;
+    target->inbox.Close();
+    return true;
+  }
+
+  void Finish()
+  {
+    if (current || workers.empty()) return;
+
+    for (size_t i = 0; i < workers.size(); i++) workers[i]->inbox.Close();
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i]->thread.join();
+      ast_arena.SetParallel(false);
+    }
+    atom_table.SetShared(false);
+    ast_arena.EndChunk();
+
+    for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+    workers.clear();
+  }
+
+  bool InWorker()
+  {
+    return current != NULL;
+  }
+
+  void ServeMessages(symbolTable & table)
+  {
+    tableEntry * handler = Operators::Operand(table.Lookup("onmessage"));
+    if (!handler || handler->GetType() != Type::FUNCTION) return;
+    ASTNode_Function * func = handler->GetFunction();
+
+    tableEntry * out_var = table.AddTempEntry(Type::VOID);
+    std::string error;
+    tableEntry * value;
+    while ((value = Receive(PARENT, table, error)) != NULL) {
+      func->Invoke(table, &value, 1, out_var, func->GetLineNum());
+      if (table.GetCompletion() == symbolTable::HALT) break;
+    }
+  }
+
+};
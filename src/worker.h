@@ -0,0 +1,55 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <string>
+
+class tableEntry;
+class symbolTable;
+
+// Worker threads.  Worker(path) parses a script into a symbol table of its
+// own and runs it on a new thread, so it shares no variables with the script
+// that started it.  The two talk through a pair of channels, each a lock-free
+// single-producer, single-consumer queue of messages.
+//
+// A message is a copy of a value made by the sender in a table of its own;
+// the receiver adopts that table's entries as they are, so objects and
+// arrays are copied once.  Typed arrays are not copied at all: their storage
+// moves to the receiver and the sender's array is left empty.  A string
+// computed for the message (rather than read from a variable) moves too.
+//
+// Only the main script starts workers, and a worker only talks to it.
+namespace Workers {
+  const int PARENT = 0;  // The worker id a worker uses for the main script
+
+  // Start running the script at path; returns the new worker's id (from 1),
+  // or 0 and sets error.
+  int Start(const std::string & path, std::string & error);
+
+  // Send value to worker id (or, from a worker, to PARENT).  move_string
+  // lets a top-level string value be moved rather than copied.
+  bool Post(int id, tableEntry * value, bool move_string, std::string & error);
+
+  // Wait for the next message from worker id (or PARENT) and hand its value
+  // to table.  Returns NULL once the sender has finished or closed the
+  // channel and everything it sent has been read, or if the script is
+  // stopped; error is set if id is not valid here, or if the worker stopped
+  // with an error.
+  tableEntry * Receive(int id, symbolTable & table, std::string & error);
+
+  // Tell worker id that no more messages are coming.
+  bool Close(int id, std::string & error);
+
+  // Close every channel to the workers and wait for them all to finish.
+  // Called when the main script ends, before its syntax tree is freed.
+  void Finish();
+
+  // Is this thread running a worker's script?
+  bool InWorker();
+
+  // Run on a worker's thread after its script: if it declares a function
+  // onmessage, call it with each message from the parent until the parent
+  // closes the channel or finishes.
+  void ServeMessages(symbolTable & table);
+};
+
+#endif